@@ -82,6 +82,15 @@ static inline double pow(int x, double y) { return std::pow((double)x, y); }
 //
 // #define DISABLE_STICKY_STARTUP_OPTIONS
 
+// Uncomment to keep the cell_see_cell() cache in small bit-packed blocks
+// that are only allocated for cells actually looked at, instead of a
+// fixed table for the whole level. This considerably reduces the memory
+// used by each game, which matters on servers running many of them, at
+// the cost of slightly slower lookups. scripts/los-bench.lua compares
+// the two.
+//
+// #define COMPACT_GLOBALLOS
+
 // Uncomment to let valgrind debug unitialized uses of global classes
 // (you, env, clua, dlua, crawl_state).
 //
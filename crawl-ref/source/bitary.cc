@@ -7,6 +7,11 @@
 
 #include "bitary.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define BIT_ROW_AVX2
+# include <immintrin.h>
+#endif
+
 bit_vector::bit_vector(unsigned long s)
     : size(s)
 {
@@ -77,3 +82,122 @@ bit_vector bit_vector::operator & (const bit_vector& other) const
         res.data[w] = data[w] & other.data[w];
     return res;
 }
+
+/////////////////////////////////////////////////////////////////////////////
+// Row kernels.
+
+// The number of words in a row holding nbits bits.
+int bit_row_words(unsigned long nbits)
+{
+    const unsigned long words = (nbits + 63) / 64;
+    return (words + BIT_ROW_WORDS - 1) / BIT_ROW_WORDS * BIT_ROW_WORDS;
+}
+
+// dst |= src
+static void _row_or_scalar(uint64_t *dst, const uint64_t *src, int nwords)
+{
+    for (int w = 0; w < nwords; ++w)
+        dst[w] |= src[w];
+}
+
+// dst |= a & b
+static void _row_or_and_scalar(uint64_t *dst, const uint64_t *a,
+                               const uint64_t *b, int nwords)
+{
+    for (int w = 0; w < nwords; ++w)
+        dst[w] |= a[w] & b[w];
+}
+
+// dst = a & ~b
+static void _row_andnot_scalar(uint64_t *dst, const uint64_t *a,
+                               const uint64_t *b, int nwords)
+{
+    for (int w = 0; w < nwords; ++w)
+        dst[w] = a[w] & ~b[w];
+}
+
+#ifdef BIT_ROW_AVX2
+__attribute__((target("avx2")))
+static inline __m256i _load256(const uint64_t *p)
+{
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+}
+
+__attribute__((target("avx2")))
+static inline void _store256(uint64_t *p, __m256i v)
+{
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+}
+
+__attribute__((target("avx2")))
+static void _row_or_avx2(uint64_t *dst, const uint64_t *src, int nwords)
+{
+    for (int w = 0; w < nwords; w += BIT_ROW_WORDS)
+    {
+        _store256(dst + w,
+                  _mm256_or_si256(_load256(dst + w), _load256(src + w)));
+    }
+}
+
+__attribute__((target("avx2")))
+static void _row_or_and_avx2(uint64_t *dst, const uint64_t *a,
+                             const uint64_t *b, int nwords)
+{
+    for (int w = 0; w < nwords; w += BIT_ROW_WORDS)
+    {
+        const __m256i ab = _mm256_and_si256(_load256(a + w), _load256(b + w));
+        _store256(dst + w, _mm256_or_si256(_load256(dst + w), ab));
+    }
+}
+
+__attribute__((target("avx2")))
+static void _row_andnot_avx2(uint64_t *dst, const uint64_t *a,
+                             const uint64_t *b, int nwords)
+{
+    // _mm256_andnot_si256(x, y) is ~x & y.
+    for (int w = 0; w < nwords; w += BIT_ROW_WORDS)
+    {
+        _store256(dst + w,
+                  _mm256_andnot_si256(_load256(b + w), _load256(a + w)));
+    }
+}
+#endif
+
+struct bit_row_kernels
+{
+    void (*row_or)(uint64_t *, const uint64_t *, int);
+    void (*row_or_and)(uint64_t *, const uint64_t *, const uint64_t *, int);
+    void (*row_andnot)(uint64_t *, const uint64_t *, const uint64_t *, int);
+};
+
+static bit_row_kernels _choose_row_kernels()
+{
+#ifdef BIT_ROW_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return { _row_or_avx2, _row_or_and_avx2, _row_andnot_avx2 };
+#endif
+    return { _row_or_scalar, _row_or_and_scalar, _row_andnot_scalar };
+}
+
+static const bit_row_kernels row_kernels = _choose_row_kernels();
+
+void bit_row_or(uint64_t *dst, const uint64_t *src, int nwords)
+{
+    ASSERT(nwords % BIT_ROW_WORDS == 0);
+    row_kernels.row_or(dst, src, nwords);
+}
+
+void bit_row_or_and(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                    int nwords)
+{
+    ASSERT(nwords % BIT_ROW_WORDS == 0);
+    row_kernels.row_or_and(dst, a, b, nwords);
+}
+
+void bit_row_andnot(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                    int nwords)
+{
+    ASSERT(nwords % BIT_ROW_WORDS == 0);
+    row_kernels.row_andnot(dst, a, b, nwords);
+}
@@ -36,6 +36,31 @@ protected:
 };
 
 #define LONGSIZE (sizeof(unsigned long)*8)
+
+// Kernels on rows of 64-bit words, used by losight() on its packed
+// blockrays table. Row lengths must be multiples of BIT_ROW_WORDS, which
+// allows 256-bit operations on CPUs that support them; the implementation
+// is chosen at run time, with a plain word-by-word fallback.
+#define BIT_ROW_WORDS 4
+
+int bit_row_words(unsigned long nbits);
+void bit_row_or(uint64_t *dst, const uint64_t *src, int nwords);
+void bit_row_or_and(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                    int nwords);
+void bit_row_andnot(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                    int nwords);
+
+static inline int bit_lowest_set(uint64_t word)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(word);
+#else
+    int i = 0;
+    for (; !(word & 1); word >>= 1)
+        ++i;
+    return i;
+#endif
+}
 #ifndef ULONG_MAX
 #define ULONG_MAX ((unsigned long)(-1))
 #endif
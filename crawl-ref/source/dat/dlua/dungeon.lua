@@ -237,6 +237,37 @@ function dgn_set_map(map)
   return old_map
 end
 
+-- Map chunk functions are shared by every map with the same code. One
+-- that is already running (placing a subvault with the same code, say)
+-- is run from a copy, so that the two runs don't share an environment.
+local dgn_running_chunks = { }
+
+-- Catching an error loses the stack it was raised from, which
+-- dlua_chunk::rewrite_chunk_errors reads the vault's line from, so take a
+-- traceback first. Errors raised by Lua code already say where they come
+-- from, and those from the map's dgn functions carry a traceback of their
+-- own (see crawl.err_trace).
+local function dgn_map_chunk_error(err)
+  if type(err) ~= "string" or string.find(err, '^%[string "')
+     or string.find(err, "stack traceback:", 1, true) then
+    return err
+  end
+  return debug.traceback(err, 2)
+end
+
+local function dgn_run_map_chunk(chunk, env)
+  if dgn_running_chunks[chunk] then
+    chunk = loadstring(string.dump(chunk))
+  end
+  dgn_running_chunks[chunk] = true
+  local ok, ret = xpcall(setfenv(chunk, env), dgn_map_chunk_error)
+  dgn_running_chunks[chunk] = nil
+  if not ok then
+    error(ret, 0)
+  end
+  return ret
+end
+
 -- Given a list of map chunk functions, runs each one in order in that
 -- map's environment (wrapped with setfenv) and returns the return
 -- value of the last chunk. If the caller is interested in the return
@@ -252,7 +283,7 @@ function dgn_run_map(...)
     local env = dgn_map_meta_wrap(g_dgn_curr_map, dgn)
     for _, map_chunk_function in pairs(map_chunk_functions) do
       if map_chunk_function then
-        ret = setfenv(map_chunk_function, env)()
+        ret = dgn_run_map_chunk(map_chunk_function, env)
       end
     end
     return ret
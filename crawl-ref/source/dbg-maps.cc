@@ -7,10 +7,21 @@
 
 #include "dbg-maps.h"
 
+#include <chrono>
+#include <exception>
+
+#ifdef UNIX
+# include <cerrno>
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
+
+#include "artefact.h"
 #include "branch.h"
 #include "chardump.h"
 #include "crash.h"
 #include "dbg-objstat.h"
+#include "dlua.h"
 #include "dungeon.h"
 #include "env.h"
 #include "initfile.h"
@@ -19,9 +30,12 @@
 #include "message.h"
 #include "ng-init.h"
 #include "player.h"
+#include "random.h"
 #include "shopping.h"
 #include "state.h"
 #include "stringutil.h"
+#include "syscalls.h"
+#include "tags.h"
 #include "view.h"
 
 #ifdef DEBUG_STATISTICS
@@ -43,15 +57,120 @@ static string last_error;
 
 static int levels_tried = 0, levels_failed = 0;
 static int build_attempts = 0, level_vetoes = 0;
+// Time spent finding the maps that could be used for a level or tag.
+static int map_lookups = 0;
+static int64_t map_lookup_ns = 0;
 // Map from message to counts.
 static map<string, int> veto_messages;
 
-void mapstat_report_map_build_start()
+// Whether this is a worker process building some of the iterations.
+static bool is_worker = false;
+
+// Where the time building levels went, by branch.
+struct levelgen_stats
+{
+    levelgen_stats() : attempts(0), wasted(0), ns(0), wasted_ns(0) { }
+
+    int attempts, wasted;
+    int64_t ns, wasted_ns;
+    map<string, int64_t> phase_ns, phase_wasted_ns;
+    // Wasted attempts, by the phase they failed in.
+    map<string, int> phase_failures;
+};
+static map<int, levelgen_stats> levelgen_by_branch;
+// Wasted attempts and time, by the last map tried in them.
+static map<string, int> map_failures;
+static map<string, int64_t> map_wasted_ns;
+
+// The attempt being built, if any, and the innermost phase in it.
+static mapstat_build_attempt *current_attempt = nullptr;
+static mapstat_phase *current_phase = nullptr;
+static branch_type attempt_branch;
+static map<string, int64_t> attempt_phase_ns;
+static int64_t attempt_phases_ns;
+static const char *attempt_failed_phase;
+static string attempt_last_map;
+
+static int64_t _now_ns()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+mapstat_build_attempt::mapstat_build_attempt()
+    : success(false), start(_now_ns())
 {
+    ASSERT(!current_attempt);
+    current_attempt = this;
+    attempt_branch = you.where_are_you;
+    attempt_phase_ns.clear();
+    attempt_phases_ns = 0;
+    attempt_failed_phase = nullptr;
+    attempt_last_map.clear();
+
     build_attempts++;
     map_builds[level_id::current()].first++;
 }
 
+mapstat_build_attempt::~mapstat_build_attempt()
+{
+    current_attempt = nullptr;
+
+    const int64_t elapsed = _now_ns() - start;
+    attempt_phase_ns["other"] += elapsed - attempt_phases_ns;
+
+    levelgen_stats &stats = levelgen_by_branch[attempt_branch];
+    stats.attempts++;
+    stats.ns += elapsed;
+    for (const auto &entry : attempt_phase_ns)
+        stats.phase_ns[entry.first] += entry.second;
+
+    if (success)
+        return;
+
+    stats.wasted++;
+    stats.wasted_ns += elapsed;
+    for (const auto &entry : attempt_phase_ns)
+        stats.phase_wasted_ns[entry.first] += entry.second;
+    stats.phase_failures[attempt_failed_phase ? attempt_failed_phase
+                                              : "other"]++;
+
+    const string blamed = attempt_last_map.empty() ? "(no map)"
+                                                   : attempt_last_map;
+    map_failures[blamed]++;
+    map_wasted_ns[blamed] += elapsed;
+}
+
+void mapstat_build_attempt::failed_in(const char *phase)
+{
+    if (!attempt_failed_phase)
+        attempt_failed_phase = phase;
+}
+
+mapstat_phase::mapstat_phase(const char *_name)
+    : outer(current_phase), name(_name), start(_now_ns()), inner(0)
+{
+    current_phase = this;
+}
+
+mapstat_phase::~mapstat_phase()
+{
+    current_phase = outer;
+    if (!current_attempt)
+        return;
+
+    const int64_t elapsed = _now_ns() - start;
+    attempt_phase_ns[name] += elapsed - inner;
+    if (outer)
+        outer->inner += elapsed;
+    else
+        attempt_phases_ns += elapsed;
+
+    // The first phase to be left by an exception is where it was thrown.
+    if (uncaught_exception())
+        current_attempt->failed_in(name);
+}
+
 void mapstat_report_map_veto(const string &message)
 {
     level_vetoes++;
@@ -59,6 +178,12 @@ void mapstat_report_map_veto(const string &message)
     map_builds[level_id::current()].second++;
 }
 
+void mapstat_report_map_lookup(int64_t nanoseconds)
+{
+    map_lookups++;
+    map_lookup_ns += nanoseconds;
+}
+
 static bool _is_disconnected_level()
 {
     // Don't care about non-Dungeon levels.
@@ -85,7 +210,7 @@ static bool _do_build_level()
     watchdog();
 
     no_messages mx;
-    if (kbhit() && key_is_escape(getchk()))
+    if (!is_worker && kbhit() && key_is_escape(getchk()))
     {
         mprf(MSGCH_WARN, "User requested cancel");
         return false;
@@ -223,11 +348,344 @@ static bool _build_dungeon()
     return true;
 }
 
+// Build every level once. The RNG is seeded from the base seed and the
+// iteration number alone, and everything an earlier iteration could have
+// left behind is reset, so an iteration builds the same levels whether it
+// runs on its own or after any others.
+static bool _build_iteration(uint32_t base_seed, int iter)
+{
+    uint64_t seed[2] = { base_seed, (uint64_t) iter };
+    seed_rng(seed, ARRAYSZ(seed));
+
+    dlua.callfn("dgn_clear_data", "");
+    you.uniq_map_tags.clear();
+    you.uniq_map_names.clear();
+    you.unique_creatures.reset();
+    you.unique_items.init(UNIQ_NOT_EXISTS);
+    you.octopus_king_rings = 0;
+    initialise_branch_depths();
+    init_level_connectivity();
+    if (!_build_dungeon())
+        return false;
+    if (crawl_state.obj_stat_gen)
+        objstat_iteration_stats();
+    return true;
+}
+
+static bool _build_iterations(uint32_t base_seed, int first, int last)
+{
+    for (int i = first; i < last; ++i)
+    {
+        clear_messages();
+        mprf("On %d of %d; %d g, %d fail, %u err%s, %u uniq, "
+             "%d try, %d (%.2f%%) vetoes",
+             i, SysEnv.map_gen_iters, levels_tried, levels_failed,
+             (unsigned int)errors.size(),
+             last_error.empty() ? "" : (" (" + last_error + ")").c_str(),
+             (unsigned int)use_count.size(), build_attempts, level_vetoes,
+             build_attempts ? level_vetoes * 100.0 / build_attempts : 0.0);
+        printf("%d..", i + 1);
+        fflush(stdout);
+        if (!_build_iteration(base_seed, i))
+            return false;
+    }
+    return true;
+}
+
+static void _marshall_counts(writer &outf, const map<string, int> &counts)
+{
+    marshallInt(outf, counts.size());
+    for (const auto &entry : counts)
+    {
+        marshallString(outf, entry.first);
+        marshallInt(outf, entry.second);
+    }
+}
+
+static void _merge_counts(reader &inf, map<string, int> &counts)
+{
+    for (int i = unmarshallInt(inf); i > 0; --i)
+    {
+        const string name = unmarshallString(inf);
+        counts[name] += unmarshallInt(inf);
+    }
+}
+
+static void _marshall_times(writer &outf, const map<string, int64_t> &times)
+{
+    marshallInt(outf, times.size());
+    for (const auto &entry : times)
+    {
+        marshallString(outf, entry.first);
+        marshallSigned(outf, entry.second);
+    }
+}
+
+static void _merge_times(reader &inf, map<string, int64_t> &times)
+{
+    for (int i = unmarshallInt(inf); i > 0; --i)
+    {
+        const string name = unmarshallString(inf);
+        times[name] += unmarshallSigned(inf);
+    }
+}
+
+// Write the map statistics gathered by a worker. Everything in them is a
+// count, a total or a set, so merging is the same however the iterations
+// were split.
+static void _save_map_stats(writer &outf)
+{
+    marshallInt(outf, levels_tried);
+    marshallInt(outf, levels_failed);
+    marshallInt(outf, build_attempts);
+    marshallInt(outf, level_vetoes);
+    marshallInt(outf, map_lookups);
+    marshallSigned(outf, map_lookup_ns);
+    marshallInt(outf, dlua_chunks_compiled);
+    marshallInt(outf, dlua_chunks_loaded);
+    marshallInt(outf, dlua_chunks_reused);
+    marshallString(outf, last_error);
+
+    _marshall_counts(outf, try_count);
+    _marshall_counts(outf, use_count);
+    _marshall_counts(outf, success_count);
+    _marshall_counts(outf, veto_messages);
+
+    marshallInt(outf, level_mapcounts.size());
+    for (const auto &entry : level_mapcounts)
+    {
+        entry.first.save(outf);
+        marshallInt(outf, entry.second);
+    }
+
+    marshallInt(outf, map_builds.size());
+    for (const auto &entry : map_builds)
+    {
+        entry.first.save(outf);
+        marshallInt(outf, entry.second.first);
+        marshallInt(outf, entry.second.second);
+    }
+
+    marshallInt(outf, level_mapsused.size());
+    for (const auto &entry : level_mapsused)
+    {
+        entry.first.save(outf);
+        marshallInt(outf, entry.second.size());
+        for (const string &name : entry.second)
+            marshallString(outf, name);
+    }
+
+    marshallInt(outf, map_levelsused.size());
+    for (const auto &entry : map_levelsused)
+    {
+        marshallString(outf, entry.first);
+        marshallInt(outf, entry.second.size());
+        for (const level_id &lid : entry.second)
+            lid.save(outf);
+    }
+
+    marshallInt(outf, levelgen_by_branch.size());
+    for (const auto &entry : levelgen_by_branch)
+    {
+        const levelgen_stats &stats = entry.second;
+        marshallInt(outf, entry.first);
+        marshallInt(outf, stats.attempts);
+        marshallInt(outf, stats.wasted);
+        marshallSigned(outf, stats.ns);
+        marshallSigned(outf, stats.wasted_ns);
+        _marshall_times(outf, stats.phase_ns);
+        _marshall_times(outf, stats.phase_wasted_ns);
+        _marshall_counts(outf, stats.phase_failures);
+    }
+    _marshall_counts(outf, map_failures);
+    _marshall_times(outf, map_wasted_ns);
+}
+
+static void _merge_map_stats(reader &inf)
+{
+    levels_tried += unmarshallInt(inf);
+    levels_failed += unmarshallInt(inf);
+    build_attempts += unmarshallInt(inf);
+    level_vetoes += unmarshallInt(inf);
+    map_lookups += unmarshallInt(inf);
+    map_lookup_ns += unmarshallSigned(inf);
+    dlua_chunks_compiled += unmarshallInt(inf);
+    dlua_chunks_loaded += unmarshallInt(inf);
+    dlua_chunks_reused += unmarshallInt(inf);
+    const string error = unmarshallString(inf);
+    if (!error.empty())
+        last_error = error;
+
+    _merge_counts(inf, try_count);
+    _merge_counts(inf, use_count);
+    _merge_counts(inf, success_count);
+    _merge_counts(inf, veto_messages);
+
+    for (int i = unmarshallInt(inf); i > 0; --i)
+    {
+        level_id lid;
+        lid.load(inf);
+        level_mapcounts[lid] += unmarshallInt(inf);
+    }
+
+    for (int i = unmarshallInt(inf); i > 0; --i)
+    {
+        level_id lid;
+        lid.load(inf);
+        map_builds[lid].first += unmarshallInt(inf);
+        map_builds[lid].second += unmarshallInt(inf);
+    }
+
+    for (int i = unmarshallInt(inf); i > 0; --i)
+    {
+        level_id lid;
+        lid.load(inf);
+        set<string> &maps = level_mapsused[lid];
+        for (int j = unmarshallInt(inf); j > 0; --j)
+            maps.insert(unmarshallString(inf));
+    }
+
+    for (int i = unmarshallInt(inf); i > 0; --i)
+    {
+        set<level_id> &levels = map_levelsused[unmarshallString(inf)];
+        for (int j = unmarshallInt(inf); j > 0; --j)
+        {
+            level_id lid;
+            lid.load(inf);
+            levels.insert(lid);
+        }
+    }
+
+    for (int i = unmarshallInt(inf); i > 0; --i)
+    {
+        levelgen_stats &stats = levelgen_by_branch[unmarshallInt(inf)];
+        stats.attempts += unmarshallInt(inf);
+        stats.wasted += unmarshallInt(inf);
+        stats.ns += unmarshallSigned(inf);
+        stats.wasted_ns += unmarshallSigned(inf);
+        _merge_times(inf, stats.phase_ns);
+        _merge_times(inf, stats.phase_wasted_ns);
+        _merge_counts(inf, stats.phase_failures);
+    }
+    _merge_counts(inf, map_failures);
+    _merge_times(inf, map_wasted_ns);
+}
+
+#ifdef UNIX
+// The parent's pid keeps shards left over from other runs out of this one.
+static string _shard_filename(pid_t parent, int job)
+{
+    return make_stringf("mapstat-%d-%d.shard", (int) parent, job);
+}
+
+// In a forked worker: build some of the iterations, write out what was
+// gathered and exit without going through the usual shutdown.
+static NORETURN void _run_worker(uint32_t base_seed, pid_t parent, int job,
+                                 int first, int last)
+{
+    is_worker = true;
+    // Only report what this worker did, not what it inherited.
+    map_lookups = 0;
+    map_lookup_ns = 0;
+    dlua_chunks_compiled = dlua_chunks_loaded = dlua_chunks_reused = 0;
+
+    bool built;
+    {
+        no_messages mx;
+        built = _build_iterations(base_seed, first, last);
+    }
+
+    const string filename = _shard_filename(parent, job);
+    FILE *fp = fopen_u(filename.c_str(), "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "Unable to write %s: %s\n", filename.c_str(),
+                strerror(errno));
+        _exit(1);
+    }
+
+    writer outf(filename, fp);
+    marshallBoolean(outf, built);
+    _save_map_stats(outf);
+    if (crawl_state.obj_stat_gen)
+        objstat_save_shard(outf);
+    const bool ok = outf.succeeded();
+    fclose(fp);
+    fflush(stdout);
+    _exit(ok ? 0 : 1);
+}
+
+// Split the iterations between forked workers and merge what they gathered.
+// Any iterations that couldn't be handed to a worker are built here.
+static bool _build_iterations_in_workers(uint32_t base_seed)
+{
+    const int iters = SysEnv.map_gen_iters;
+    const int jobs = min(SysEnv.map_gen_jobs, iters);
+    const pid_t parent = getpid();
+    vector<pid_t> workers;
+    int assigned = 0;
+    for (int job = 0; job < jobs; ++job)
+    {
+        const int last = (int64_t) iters * (job + 1) / jobs;
+        fflush(stdout);
+        fflush(stderr);
+        const pid_t pid = fork();
+        if (pid == -1)
+        {
+            fprintf(stderr, "Couldn't fork: %s\n", strerror(errno));
+            break;
+        }
+        if (!pid)
+            _run_worker(base_seed, parent, job, assigned, last);
+        workers.push_back(pid);
+        assigned = last;
+    }
+
+    bool built = _build_iterations(base_seed, assigned, iters);
+
+    for (unsigned int job = 0; job < workers.size(); ++job)
+    {
+        const string filename = _shard_filename(parent, job);
+        int status;
+        if (waitpid(workers[job], &status, 0) == -1
+            || !WIFEXITED(status) || WEXITSTATUS(status))
+        {
+            // Whatever it managed to write can't be trusted.
+            fprintf(stderr, "Worker %u failed.\n", job);
+            built = false;
+            unlink_u(filename.c_str());
+            continue;
+        }
+
+        FILE *fp = fopen_u(filename.c_str(), "rb");
+        if (!fp)
+        {
+            fprintf(stderr, "Worker %u left no results.\n", job);
+            built = false;
+            continue;
+        }
+
+        reader inf(fp);
+        if (!unmarshallBoolean(inf))
+            built = false;
+        _merge_map_stats(inf);
+        if (crawl_state.obj_stat_gen)
+            objstat_merge_shard(inf);
+        fclose(fp);
+        unlink_u(filename.c_str());
+    }
+
+    return built;
+}
+#endif
+
 /**
  * Build dungeon levels for mapstat or objstat.
  *
  * The exact branches/levels built and number of build iterations is set by the
- * command-line options for mapstat/objstat.
+ * command-line options for mapstat/objstat. With -jobs, the iterations are
+ * shared between forked workers; as every iteration is seeded on its own,
+ * the statistics are the same as building them all in this process.
 
  * @returns True if all iterations built successfully. For mapstat, this can
  * return false if an iteration produced a disconnected level, since for
@@ -240,31 +698,23 @@ bool mapstat_build_levels()
 {
     if (!generated_levels.size())
         _dungeon_places();
+
+    // Make the run repeatable with -seed.
+    const uint32_t base_seed = Options.seed ? Options.seed : get_uint32();
+    printf("Seed: %x\n", base_seed);
     printf("Iteration: ");
     fflush(stdout);
-    for (int i = 0; i < SysEnv.map_gen_iters; ++i)
-    {
-        clear_messages();
-        mprf("On %d of %d; %d g, %d fail, %u err%s, %u uniq, "
-             "%d try, %d (%.2f%%) vetoes",
-             i, SysEnv.map_gen_iters, levels_tried, levels_failed,
-             (unsigned int)errors.size(),
-             last_error.empty() ? "" : (" (" + last_error + ")").c_str(),
-             (unsigned int)use_count.size(), build_attempts, level_vetoes,
-             build_attempts ? level_vetoes * 100.0 / build_attempts : 0.0);
-        printf("%d..", i + 1);
-        fflush(stdout);
-        dlua.callfn("dgn_clear_data", "");
-        you.uniq_map_tags.clear();
-        you.uniq_map_names.clear();
-        you.unique_creatures.reset();
-        initialise_branch_depths();
-        init_level_connectivity();
-        if (!_build_dungeon())
-            return false;
-        if (crawl_state.obj_stat_gen)
-            objstat_iteration_stats();
-    }
+
+    bool built;
+#ifdef UNIX
+    if (SysEnv.map_gen_jobs > 1)
+        built = _build_iterations_in_workers(base_seed);
+    else
+#endif
+        built = _build_iterations(base_seed, 0, SysEnv.map_gen_iters);
+
+    if (!built)
+        return false;
     printf("Finished.\n");
     fflush(stdout);
     return true;
@@ -273,6 +723,7 @@ bool mapstat_build_levels()
 void mapstat_report_map_try(const map_def &map)
 {
     try_count[map.name]++;
+    attempt_last_map = map.name;
 }
 
 void mapstat_report_map_use(const map_def &map)
@@ -320,6 +771,50 @@ static void _check_mapless(const level_id &lid, vector<level_id> &mapless)
         mapless.push_back(lid);
 }
 
+static void _write_levelgen_stats(FILE *outf)
+{
+    if (levelgen_by_branch.empty())
+        return;
+
+    fprintf(outf, "\n\nLevel generation by branch (ms, wasted ms, "
+                  "failures):\n");
+    for (const auto &entry : levelgen_by_branch)
+    {
+        const levelgen_stats &stats = entry.second;
+        fprintf(outf, "\n%s: %d attempts, %d wasted; "
+                      "%.1f ms in all, %.1f ms wasted\n",
+                branches[entry.first].abbrevname,
+                stats.attempts, stats.wasted,
+                stats.ns / 1e6, stats.wasted_ns / 1e6);
+
+        multimap<int64_t, string> phases;
+        for (const auto &phase : stats.phase_ns)
+            phases.insert(make_pair(phase.second, phase.first));
+        for (auto i = phases.rbegin(); i != phases.rend(); ++i)
+        {
+            fprintf(outf, "  %-20s %10.1f %10.1f %6d\n",
+                    i->second.c_str(), i->first / 1e6,
+                    lookup(stats.phase_wasted_ns, i->second, 0) / 1e6,
+                    lookup(stats.phase_failures, i->second, 0));
+        }
+    }
+
+    if (map_failures.empty())
+        return;
+
+    fprintf(outf, "\n\nWasted level builds by last map tried "
+                  "(ms wasted, failures):\n");
+    multimap<int64_t, string> sortedmaps;
+    for (const auto &entry : map_wasted_ns)
+        sortedmaps.insert(make_pair(entry.second, entry.first));
+    int count = 0;
+    for (auto i = sortedmaps.rbegin(); i != sortedmaps.rend(); ++i)
+    {
+        fprintf(outf, "%3d) %10.1f %6d %s\n", ++count, i->first / 1e6,
+                map_failures[i->second], i->second.c_str());
+    }
+}
+
 static void _write_map_stats()
 {
     const char *out_file = "mapstat.log";
@@ -330,6 +825,14 @@ static void _write_map_stats()
     fprintf(outf, "Levels attempted: %d, built: %d, failed: %d\n",
             levels_tried, levels_tried - levels_failed,
             levels_failed);
+    if (map_lookups)
+    {
+        fprintf(outf, "Map lookups: %d, %.1f ms in all, %.1f us each\n",
+                map_lookups, map_lookup_ns / 1e6,
+                map_lookup_ns / 1e3 / map_lookups);
+    }
+    fprintf(outf, "Map Lua chunks: %d compiled, %d loaded, %d reused\n",
+            dlua_chunks_compiled, dlua_chunks_loaded, dlua_chunks_reused);
     if (!errors.empty())
     {
         fprintf(outf, "\n\nMap errors:\n");
@@ -406,6 +909,8 @@ static void _write_map_stats()
             fprintf(outf, "%3d) %s\n", i->first, i->second.c_str());
     }
 
+    _write_levelgen_stats(outf);
+
     if (!unused_maps.empty() && !SysEnv.map_gen_range.get())
     {
         fprintf(outf, "\n\nUnused maps:\n\n");
@@ -13,10 +13,49 @@ void mapstat_report_map_try(const map_def &map);
 void mapstat_report_map_use(const map_def &map);
 void mapstat_report_map_success(const string &map_name);
 void mapstat_report_error(const map_def &map, const string &err);
-void mapstat_report_map_build_start();
 void mapstat_report_map_veto(const string &message);
+void mapstat_report_map_lookup(int64_t nanoseconds);
 void mapstat_generate_stats();
 bool mapstat_build_levels();
+
+// One attempt at building a level, timed for mapstat. An attempt that
+// hasn't been marked as built when it ends was wasted, and its time and
+// failure are blamed on the phase that failed and on the last map tried.
+class mapstat_build_attempt
+{
+public:
+    mapstat_build_attempt();
+    ~mapstat_build_attempt();
+
+    void built() { success = true; }
+    void failed_in(const char *phase);
+
+private:
+    bool success;
+    int64_t start;
+
+    friend class mapstat_phase;
+};
+
+// A phase of level generation, timed from construction to destruction.
+// Phases may nest; each is charged only for the time not spent in the
+// phases inside it. A veto is blamed on the innermost phase it leaves.
+class mapstat_phase
+{
+public:
+    mapstat_phase(const char *name);
+    ~mapstat_phase();
+
+private:
+    mapstat_phase *outer;
+    const char *name;
+    int64_t start;
+    int64_t inner;
+};
+
+# define MAPSTAT_PHASE(name) mapstat_phase _mapstat_phase(name)
+#else
+# define MAPSTAT_PHASE(name)
 #endif
 
 #endif
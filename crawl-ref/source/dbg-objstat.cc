@@ -38,6 +38,7 @@
 #include "state.h"
 #include "stepdown.h"
 #include "stringutil.h"
+#include "tags.h"
 #include "terrain.h"
 #include "version.h"
 
@@ -840,6 +841,201 @@ void objstat_iteration_stats()
     }
 }
 
+static bool _is_min_field(const string &field)
+{
+    return field == "NumMin" || field == "AllNumMin";
+}
+
+static bool _is_max_field(const string &field)
+{
+    return field == "NumMax" || field == "AllNumMax";
+}
+
+// The summary levels aren't real places, so they're not packed the way
+// saved levels are.
+static void _marshall_stat_level(writer &outf, const level_id &lev)
+{
+    marshallInt(outf, lev.branch);
+    marshallInt(outf, lev.depth);
+}
+
+static level_id _unmarshall_stat_level(reader &inf)
+{
+    const branch_type br = static_cast<branch_type>(unmarshallInt(inf));
+    const int depth = unmarshallInt(inf);
+    return level_id(br, depth);
+}
+
+static void _marshall_stats(writer &outf, const map<string, double> &stats)
+{
+    marshallInt(outf, stats.size());
+    for (const auto &entry : stats)
+    {
+        uint64_t bits;
+        memcpy(&bits, &entry.second, sizeof(bits));
+        marshallString(outf, entry.first);
+        marshallUnsigned(outf, bits);
+    }
+}
+
+// Every stat is a sum of whole or half numbers, so adding them up is exact
+// and the order in which shards are merged doesn't matter.
+static void _merge_stats(reader &inf, map<string, double> &stats)
+{
+    for (int i = unmarshallInt(inf); i > 0; --i)
+    {
+        const string field = unmarshallString(inf);
+        const uint64_t bits = unmarshallUnsigned(inf);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+
+        auto it = stats.find(field);
+        if (it == stats.end())
+            stats[field] = value;
+        else if (_is_min_field(field))
+            it->second = min(it->second, value);
+        else if (_is_max_field(field))
+            it->second = max(it->second, value);
+        else
+            it->second += value;
+    }
+}
+
+static void _marshall_brands(writer &outf, const vector<int> &brands)
+{
+    marshallInt(outf, brands.size());
+    for (int count : brands)
+        marshallInt(outf, count);
+}
+
+static void _merge_brands(reader &inf, vector<int> &brands)
+{
+    const unsigned int size = unmarshallInt(inf);
+    ASSERT(size == brands.size());
+    for (int &count : brands)
+        count += unmarshallInt(inf);
+}
+
+static void _marshall_equip_brands(writer &outf, const brand_records &brands)
+{
+    marshallInt(outf, brands.size());
+    for (const auto &entry : brands)
+    {
+        _marshall_stat_level(outf, entry.first);
+        marshallInt(outf, entry.second.size());
+        for (const auto &type_brands : entry.second)
+        {
+            marshallInt(outf, type_brands.size());
+            for (const vector<int> &antiq_brands : type_brands)
+                _marshall_brands(outf, antiq_brands);
+        }
+    }
+}
+
+static void _merge_equip_brands(reader &inf, brand_records &brands)
+{
+    for (int i = unmarshallInt(inf); i > 0; --i)
+    {
+        auto &lev_brands = brands[_unmarshall_stat_level(inf)];
+        const unsigned int num_types = unmarshallInt(inf);
+        ASSERT(num_types == lev_brands.size());
+        for (auto &type_brands : lev_brands)
+        {
+            const unsigned int num_antiqs = unmarshallInt(inf);
+            ASSERT(num_antiqs == type_brands.size());
+            for (vector<int> &antiq_brands : type_brands)
+                _merge_brands(inf, antiq_brands);
+        }
+    }
+}
+
+/**
+ * Write the statistics gathered so far, for merging into another process's
+ * with objstat_merge_shard().
+ */
+void objstat_save_shard(writer &outf)
+{
+    marshallInt(outf, item_recs.size());
+    for (const auto &entry : item_recs)
+    {
+        _marshall_stat_level(outf, entry.first);
+        marshallInt(outf, entry.second.size());
+        for (const auto &class_recs : entry.second)
+        {
+            marshallInt(outf, class_recs.size());
+            for (const auto &stats : class_recs)
+                _marshall_stats(outf, stats);
+        }
+    }
+
+    _marshall_equip_brands(outf, weapon_brands);
+    _marshall_equip_brands(outf, armour_brands);
+
+    marshallInt(outf, missile_brands.size());
+    for (const auto &entry : missile_brands)
+    {
+        _marshall_stat_level(outf, entry.first);
+        marshallInt(outf, entry.second.size());
+        for (const vector<int> &type_brands : entry.second)
+            _marshall_brands(outf, type_brands);
+    }
+
+    marshallInt(outf, monster_recs.size());
+    for (const auto &entry : monster_recs)
+    {
+        _marshall_stat_level(outf, entry.first);
+        marshallInt(outf, entry.second.size());
+        for (const auto &mentry : entry.second)
+        {
+            marshallInt(outf, mentry.first);
+            _marshall_stats(outf, mentry.second);
+        }
+    }
+}
+
+/**
+ * Add statistics written by objstat_save_shard() to our own. Both processes
+ * must have been set up for the same levels.
+ */
+void objstat_merge_shard(reader &inf)
+{
+    for (int i = unmarshallInt(inf); i > 0; --i)
+    {
+        auto &lev_recs = item_recs[_unmarshall_stat_level(inf)];
+        const unsigned int num_classes = unmarshallInt(inf);
+        ASSERT(num_classes == lev_recs.size());
+        for (auto &class_recs : lev_recs)
+        {
+            const unsigned int num_entries = unmarshallInt(inf);
+            ASSERT(num_entries == class_recs.size());
+            for (auto &stats : class_recs)
+                _merge_stats(inf, stats);
+        }
+    }
+
+    _merge_equip_brands(inf, weapon_brands);
+    _merge_equip_brands(inf, armour_brands);
+
+    for (int i = unmarshallInt(inf); i > 0; --i)
+    {
+        auto &lev_brands = missile_brands[_unmarshall_stat_level(inf)];
+        const unsigned int num_types = unmarshallInt(inf);
+        ASSERT(num_types == lev_brands.size());
+        for (vector<int> &type_brands : lev_brands)
+            _merge_brands(inf, type_brands);
+    }
+
+    for (int i = unmarshallInt(inf); i > 0; --i)
+    {
+        auto &lev_recs = monster_recs[_unmarshall_stat_level(inf)];
+        for (int j = unmarshallInt(inf); j > 0; --j)
+        {
+            const int mons_ind = unmarshallInt(inf);
+            _merge_stats(inf, lev_recs[mons_ind]);
+        }
+    }
+}
+
 static void _write_stat_headers(const vector<string> &fields, bool items = true)
 {
     fprintf(stat_outf, "%s\tLevel", items ? "Item" : "Monster");
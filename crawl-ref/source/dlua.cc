@@ -23,6 +23,55 @@ static int dlua_compiled_chunk_writer(lua_State *ls, const void *p,
 ///////////////////////////////////////////////////////////////////////////
 // dlua_chunk
 
+int dlua_chunks_compiled = 0;
+int dlua_chunks_loaded = 0;
+int dlua_chunks_reused = 0;
+
+// Functions loaded for reuse, keyed by their compiled code, are kept in a
+// registry table, so that every copy of a map_def (and every map with the
+// same code) shares one function rather than loading it again each time.
+#define DLUA_LOADED_CHUNKS "dlua_loaded_chunks"
+
+static bool _push_loaded_chunk(lua_State *ls, const string &compiled)
+{
+    lua_getfield(ls, LUA_REGISTRYINDEX, DLUA_LOADED_CHUNKS);
+    if (!lua_istable(ls, -1))
+    {
+        lua_pop(ls, 1);
+        return false;
+    }
+    lua_pushlstring(ls, compiled.data(), compiled.length());
+    lua_rawget(ls, -2);
+    lua_remove(ls, -2);
+    if (lua_isfunction(ls, -1))
+        return true;
+    lua_pop(ls, 1);
+    return false;
+}
+
+// Remembers the function on top of the stack, leaving it there.
+static void _remember_loaded_chunk(lua_State *ls, const string &compiled)
+{
+    lua_getfield(ls, LUA_REGISTRYINDEX, DLUA_LOADED_CHUNKS);
+    if (!lua_istable(ls, -1))
+    {
+        lua_pop(ls, 1);
+        lua_newtable(ls);
+        lua_pushvalue(ls, -1);
+        lua_setfield(ls, LUA_REGISTRYINDEX, DLUA_LOADED_CHUNKS);
+    }
+    lua_pushlstring(ls, compiled.data(), compiled.length());
+    lua_pushvalue(ls, -3);
+    lua_rawset(ls, -3);
+    lua_pop(ls, 1);
+}
+
+void dlua_chunk::forget_loaded(CLua &interp)
+{
+    lua_pushnil(interp);
+    lua_setfield(interp, LUA_REGISTRYINDEX, DLUA_LOADED_CHUNKS);
+}
+
 dlua_chunk::dlua_chunk(const string &_context)
     : file(), chunk(), compiled(), context(_context), first(-1),
       last(-1), error()
@@ -146,13 +195,27 @@ int dlua_chunk::check_op(CLua &interp, int err)
     return err;
 }
 
-int dlua_chunk::load(CLua &interp)
+int dlua_chunk::load(CLua &interp, bool reuse)
 {
     if (!compiled.empty())
     {
-        return check_op(interp,
-                         interp.loadbuffer(compiled.c_str(), compiled.length(),
-                                           context.c_str()));
+        if (reuse && _push_loaded_chunk(interp, compiled))
+        {
+            error.clear();
+            dlua_chunks_reused++;
+            return 0;
+        }
+
+        const int err =
+            check_op(interp,
+                     interp.loadbuffer(compiled.c_str(), compiled.length(),
+                                       context.c_str()));
+        if (err)
+            return err;
+        dlua_chunks_loaded++;
+        if (reuse)
+            _remember_loaded_chunk(interp, compiled);
+        return 0;
     }
 
     if (empty())
@@ -172,9 +235,13 @@ int dlua_chunk::load(CLua &interp)
         const char *e = lua_tostring(interp, -1);
         error = e? e : "Unknown error compiling chunk";
         lua_pop(interp, 2);
+        return err;
     }
     compiled = out.str();
-    return err;
+    dlua_chunks_compiled++;
+    if (reuse)
+        _remember_loaded_chunk(interp, compiled);
+    return 0;
 }
 
 int dlua_chunk::run(CLua &interp)
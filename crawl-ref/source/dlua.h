@@ -56,7 +56,9 @@ public:
     void add(int line, const string &line2);
     void set_chunk(const string &s);
 
-    int load(CLua &interp);
+    // If reuse is set, the function may be one loaded earlier from the
+    // same code, so it must not be changed other than by setfenv.
+    int load(CLua &interp, bool reuse = false);
     int run(CLua &interp);
     int load_call(CLua &interp, const char *function);
     void set_file(const string &s);
@@ -71,8 +73,14 @@ public:
 
     void write(writer&) const;
     void read(reader&);
+
+    static void forget_loaded(CLua &interp);
 };
 
+// How chunks were loaded: compiled from source, loaded from compiled code,
+// or reused from an earlier load.
+extern int dlua_chunks_compiled, dlua_chunks_loaded, dlua_chunks_reused;
+
 void init_dungeon_lua();
 
 #endif
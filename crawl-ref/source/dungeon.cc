@@ -276,6 +276,25 @@ static void _count_gold()
     }
 }
 
+/**
+ * Build the current level from a random stream of its own, keyed by the
+ * game's level generation seed and the level's name. A seeded game then
+ * has the same levels whatever else was randomised before, and whether or
+ * not they were built ahead (see build_levels_ahead()). Games from before
+ * this go on building levels from the gameplay stream.
+ */
+bool level_stream_builder(bool enable_random_maps,
+                          dungeon_feature_type dest_stairs_type)
+{
+    if (you.props.exists(GAMEPLAY_LEVELGEN_KEY))
+        return builder(enable_random_maps, dest_stairs_type);
+
+    const string name = level_id::current().describe();
+    rng_substream rng(you.game_seeds[SEED_LEVELGEN],
+                      hash32(name.data(), name.size()));
+    return builder(enable_random_maps, dest_stairs_type);
+}
+
 /**********************************************************************
  * builder() - kickoff for the dungeon generator.
  *********************************************************************/
@@ -326,7 +345,8 @@ bool builder(bool enable_random_maps, dungeon_feature_type dest_stairs_type)
         you.uniq_map_names = uniq_names;
     }
 
-    if (!crawl_state.map_stat_gen && !crawl_state.obj_stat_gen)
+    if (!crawl_state.map_stat_gen && !crawl_state.obj_stat_gen
+        && !crawl_state.building_ahead)
     {
         // Failed to build level, bail out.
         if (crawl_state.need_save)
@@ -350,7 +370,7 @@ static bool _build_level_vetoable(bool enable_random_maps,
                                   dungeon_feature_type dest_stairs_type)
 {
 #ifdef DEBUG_STATISTICS
-    mapstat_report_map_build_start();
+    mapstat_build_attempt attempt;
 #endif
 
     dgn_reset_level(enable_random_maps);
@@ -377,6 +397,9 @@ static bool _build_level_vetoable(bool enable_random_maps,
     if (crawl_state.game_standard_levelgen()
         && !_valid_dungeon_level())
     {
+#ifdef DEBUG_STATISTICS
+        attempt.failed_in("validation");
+#endif
         return false;
     }
 
@@ -416,6 +439,9 @@ static bool _build_level_vetoable(bool enable_random_maps,
             mprf(MSGCH_ERROR, "branch epilogue for %s failed: %s",
                               level_id::current().describe().c_str(),
                               dlua.error.c_str());
+#ifdef DEBUG_STATISTICS
+            attempt.failed_in("branch epilogue");
+#endif
             return false;
         }
 
@@ -434,6 +460,7 @@ static bool _build_level_vetoable(bool enable_random_maps,
 #ifdef DEBUG_STATISTICS
     for (auto vault : _you_all_vault_list)
         mapstat_report_map_success(vault);
+    attempt.built();
 #endif
 
     return true;
@@ -458,6 +485,7 @@ static void _builder_assertions()
 // fixups.
 static void _dgn_postprocess_level()
 {
+    MAPSTAT_PHASE("postprocess");
     shoals_postprocess_level();
     _builder_assertions();
     _calc_density();
@@ -898,6 +926,7 @@ int dgn_count_disconnected_zones(bool choose_stairless,
 
 static void _fixup_hell_stairs()
 {
+    MAPSTAT_PHASE("fixup stairs");
     for (rectangle_iterator ri(1); ri; ++ri)
     {
         if (feat_is_stone_stair_up(grd(*ri))
@@ -910,6 +939,7 @@ static void _fixup_hell_stairs()
 
 static void _fixup_pandemonium_stairs()
 {
+    MAPSTAT_PHASE("fixup stairs");
     for (rectangle_iterator ri(1); ri; ++ri)
     {
         if (feat_is_stone_stair_up(grd(*ri))
@@ -1111,6 +1141,7 @@ static bool _is_level_stair_connected(dungeon_feature_type feat)
 
 static bool _valid_dungeon_level()
 {
+    MAPSTAT_PHASE("validation");
     // D:1 only.
     // Also, what's the point of this check?  Regular connectivity should
     // do that already.
@@ -1271,6 +1302,7 @@ static int _num_mons_wanted()
 
 static void _fixup_walls()
 {
+    MAPSTAT_PHASE("fixup walls");
     // If level part of Dis -> all walls metal.
     // If Vaults:$ -> all walls metal or crystal.
     // If part of crypt -> all walls stone.
@@ -1367,6 +1399,7 @@ void fixup_misplaced_items()
  */
 static void _fixup_branch_stairs()
 {
+    MAPSTAT_PHASE("fixup stairs");
     const auto& branch = your_branch();
     const bool root = player_in_branch(root_branch);
     const bool top = you.depth == 1;
@@ -1869,6 +1902,7 @@ static bool _branch_needs_stairs()
 
 static void _dgn_verify_connectivity(unsigned nvaults)
 {
+    MAPSTAT_PHASE("connectivity");
     // After placing vaults, make sure parts of the level have not been
     // disconnected.
     if (dgn_zones && nvaults != env.level_vaults.size())
@@ -1942,6 +1976,7 @@ static void _dgn_verify_connectivity(unsigned nvaults)
 //   in the order their altars are placed.
 static void _build_overflow_temples()
 {
+    MAPSTAT_PHASE("overflow temples");
     // Levels built while in testing mode.
     if (!you.props.exists(OVERFLOW_TEMPLES_KEY))
         return;
@@ -2266,6 +2301,7 @@ static void _place_feature_mimics(dungeon_feature_type dest_stairs_type)
 // regardless of game mode.
 static void _post_vault_build()
 {
+    MAPSTAT_PHASE("post-vault");
     if (player_in_branch(BRANCH_LAIR))
     {
         int depth = you.depth + 1;
@@ -2578,6 +2614,7 @@ static bool _pan_level()
 // to place more vaults after this
 static bool _builder_by_type()
 {
+    MAPSTAT_PHASE("layout");
     if (player_in_branch(BRANCH_LABYRINTH))
     {
         dgn_build_labyrinth_level();
@@ -2997,6 +3034,7 @@ static void _slime_connectivity_fixup()
 // Place vaults with CHANCE: that want to be placed on this level.
 static void _place_chance_vaults()
 {
+    MAPSTAT_PHASE("chance vaults");
     const level_id &lid(level_id::current());
     mapref_vector maps = random_chance_maps_in_depth(lid);
     // [ds] If there are multiple CHANCE maps that share an luniq_ or
@@ -3034,6 +3072,7 @@ static void _place_chance_vaults()
 
 static void _place_minivaults()
 {
+    MAPSTAT_PHASE("minivaults");
     const map_def *vault = nullptr;
     // First place the vault requested with &P
     if (you.props.exists("force_minivault")
@@ -3108,6 +3147,7 @@ static bool _shaft_known(int depth)
 
 static void _place_traps()
 {
+    MAPSTAT_PHASE("traps");
     const int num_traps = num_traps_for_place();
     int level_number = env.absdepth0;
 
@@ -3343,6 +3383,7 @@ static bool _place_vault_by_tag(const string &tag)
 
 static void _place_branch_entrances(bool use_vaults)
 {
+    MAPSTAT_PHASE("branch entrances");
     // Find what branch entrances are already placed, and what branch
     // entrances could be placed here.
     bool branch_entrance_placed[NUM_BRANCHES];
@@ -3428,6 +3469,7 @@ static void _place_branch_entrances(bool use_vaults)
 
 static void _place_extra_vaults()
 {
+    MAPSTAT_PHASE("extra vaults");
     int tries = 0;
     while (true)
     {
@@ -3458,6 +3500,7 @@ static void _place_extra_vaults()
 // Return the number of uniques placed.
 static int _place_uniques()
 {
+    MAPSTAT_PHASE("uniques");
 #ifdef DEBUG_UNIQUE_PLACEMENT
     FILE *ostat = fopen("unique_placement.log", "a");
     fprintf(ostat, "--- Looking to place uniques on %s\n",
@@ -3656,6 +3699,7 @@ bool door_vetoed(const coord_def pos)
 
 static void _builder_monsters()
 {
+    MAPSTAT_PHASE("monsters");
     if (player_in_branch(BRANCH_TEMPLE))
         return;
 
@@ -3724,6 +3768,7 @@ static void _randomly_place_item(int item)
  */
 static void _builder_items()
 {
+    MAPSTAT_PHASE("items");
     int i = 0;
     object_class_type specif_type = OBJ_RANDOM;
     int items_levels = env.absdepth0;
@@ -24,6 +24,9 @@
 #define TEMPLE_MAP_KEY       "temple_map_key"
 #define TEMPLE_SIZE_KEY      "temple_size_key"
 
+// Set in games from before levels were built from streams of their own.
+#define GAMEPLAY_LEVELGEN_KEY "gameplay_levelgen"
+
 const unsigned short INVALID_MAP_INDEX = 10000;
 
 // Should be the larger of GXM/GYM
@@ -186,6 +189,9 @@ void write_level_connectivity(writer &th);
 
 bool builder(bool enable_random_maps = true,
              dungeon_feature_type dest_stairs_type = NUM_FEATURES);
+bool level_stream_builder(bool enable_random_maps = true,
+                          dungeon_feature_type dest_stairs_type
+                              = NUM_FEATURES);
 
 void dgn_clear_vault_placements();
 void dgn_erase_unused_vault_placements();
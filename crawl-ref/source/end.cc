@@ -8,6 +8,9 @@
 #include "end.h"
 
 #include <cerrno>
+#ifdef UNIX
+#include <unistd.h>
+#endif
 
 #include "abyss.h"
 #include "chardump.h"
@@ -16,6 +19,7 @@
 #include "database.h"
 #include "describe.h"
 #include "dungeon.h"
+#include "files.h"
 #include "godpassive.h"
 #include "hints.h"
 #include "invent.h"
@@ -107,6 +111,13 @@ bool CrawlIsCrashing = false;
 
 NORETURN void end(int exit_code, bool print_error, const char *format, ...)
 {
+#ifdef UNIX
+    // A child building a level ahead shares the terminal and the save with
+    // the game, and has nothing of its own to clean up.
+    if (crawl_state.building_ahead)
+        _exit(exit_code ? exit_code : 1);
+#endif
+
     bool need_pause = true;
     disable_other_crashes();
 
@@ -193,6 +204,7 @@ NORETURN void end(int exit_code, bool print_error, const char *format, ...)
 static void _delete_files()
 {
     crawl_state.need_save = false;
+    discard_levels_built_ahead();
     you.save->unlink();
     delete you.save;
     you.save = 0;
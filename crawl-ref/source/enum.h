@@ -5059,6 +5059,7 @@ enum uncancellable_type
 enum seed_type
 {
     SEED_PASSIVE_MAP,          // determinist magic mapping
+    SEED_LEVELGEN,             // levels built on streams of their own
     NUM_SEEDS
 };
 
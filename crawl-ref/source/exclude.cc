@@ -308,6 +308,13 @@ static void _mark_excludes_non_updated(const coord_def &p)
     }
 }
 
+// Tell travel which cells an exclusion at p can have covered.
+static void _travel_exclude_update(const coord_def &p)
+{
+    for (radius_iterator ri(p, LOS_MAX_RANGE, C_SQUARE); ri; ++ri)
+        travel_cell_changed(*ri);
+}
+
 void init_exclusion_los()
 {
     curr_excludes.recompute_excluded_points(true);
@@ -328,6 +335,8 @@ void update_exclusion_los(vector<coord_def> changed)
         _mark_excludes_non_updated(c);
 
     curr_excludes.update_excluded_points(true);
+    for (const auto &entry : curr_excludes)
+        _travel_exclude_update(entry.second.pos);
 }
 
 bool is_excluded(const coord_def &p, const exclude_set &exc)
@@ -384,6 +393,7 @@ static void _exclude_update(const coord_def &p)
 #ifdef USE_TILE
     _tile_exclude_gmap_update(p);
 #endif
+    _travel_exclude_update(p);
     _exclude_update();
 }
 
@@ -395,10 +405,13 @@ static void _exclude_update(const coord_def &p)
 void deferred_exclude_update()
 {
     _exclude_update();
-#ifdef USE_TILE
     for (const auto &entry : curr_excludes)
+    {
+#ifdef USE_TILE
         _tile_exclude_gmap_update(entry.second.pos);
 #endif
+        _travel_exclude_update(entry.second.pos);
+    }
 }
 
 void clear_excludes()
@@ -412,6 +425,7 @@ void clear_excludes()
 
     curr_excludes.clear();
     clear_level_exclusion_annotation();
+    travel_forget_routes();
 
 #ifdef USE_TILE
     for (const auto &entry : excludes)
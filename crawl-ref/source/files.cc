@@ -22,6 +22,8 @@
 #endif
 #include <sys/types.h>
 #ifdef UNIX
+#include <csignal>
+#include <sys/wait.h>
 #include <unistd.h>
 #endif
 
@@ -36,6 +38,7 @@
 #include "dactions.h"
 #include "dgn-overview.h"
 #include "directn.h"
+#include "dlua.h"
 #include "dungeon.h"
 #include "end.h"
 #include "errors.h"
@@ -66,6 +69,7 @@
 #include "state.h"
 #include "stringutil.h"
 #include "syscalls.h"
+#include "tags.h"
 #include "teleport.h"
 #include "terrain.h"
 #ifdef USE_TILE
@@ -88,8 +92,6 @@
 #define F_OK 0
 #endif
 
-static void _save_level(const level_id& lid);
-
 static bool _ghost_version_compatible(reader &ghost_reader);
 
 static bool _restore_tagged_chunk(package *save, const string &name,
@@ -119,24 +121,19 @@ static bool is_save_file_name(const string &name)
     return !strcasecmp(name.c_str() + off, SAVE_SUFFIX);
 }
 
-// Returns the save_info from the save.
+// Returns the save_info from the save. This clobbers "you" and the game
+// type, so the caller must back them up.
 static player_save_info _read_character_info(package *save)
 {
     player_save_info fromfile;
 
-    // Backup before we clobber "you".
-    const player backup(you);
-    unwind_var<game_type> gtype(crawl_state.type);
-
-    try // need a redundant try block just so we can restore the backup
-    {   // (or risk an = operator on you getting misused)
+    try
+    {
         fromfile.save_loadable = _read_char_chunk(save);
         fromfile = you;
     }
     catch (ext_fail_exception &E) {}
 
-    you = backup;
-
     return fromfile;
 }
 
@@ -639,6 +636,12 @@ static vector<player_save_info> _find_saved_characters()
     if (searchpath.empty())
         searchpath = ".";
 
+    // Backup before we clobber "you". Copying the player is much slower
+    // than reading a save's info, so this is done once for all of them:
+    // everything the info is made of is read afresh from each save.
+    const player backup(you);
+    unwind_var<game_type> gtype(crawl_state.type);
+
     for (const string &filename : get_dir_files(searchpath))
     {
         if (is_save_file_name(filename))
@@ -665,6 +668,8 @@ static vector<player_save_info> _find_saved_characters()
 
     }
 
+    you = backup;
+
     sort(chars.begin(), chars.end());
 #endif // !DISABLE_SAVEGAME_LISTS
     return chars;
@@ -743,10 +748,8 @@ static void _write_ghost_version(writer &outf)
         marshallInt(outf, 0);
 }
 
-static void _write_tagged_chunk(const string &chunkname, tag_type tag)
+static void _marshall_tagged_chunk(writer &outf, tag_type tag)
 {
-    writer outf(you.save, chunkname);
-
     // write version
     marshallUByte(outf, TAG_MAJOR_VERSION);
     marshallUByte(outf, TAG_MINOR_VERSION);
@@ -754,6 +757,12 @@ static void _write_tagged_chunk(const string &chunkname, tag_type tag)
     tag_write(tag, outf);
 }
 
+static void _write_tagged_chunk(const string &chunkname, tag_type tag)
+{
+    writer outf(you.save, chunkname);
+    _marshall_tagged_chunk(outf, tag);
+}
+
 static int _get_dest_stair_type(branch_type old_branch,
                                 dungeon_feature_type stair_taken,
                                 bool &find_first)
@@ -1123,6 +1132,369 @@ static bool _leave_level(dungeon_feature_type stair_taken,
 }
 
 
+// Build the level the player is now on, which is new.
+static void _build_new_level(dungeon_feature_type stair_type)
+{
+    env.turns_on_level = -1;
+
+    tile_init_default_flavour();
+    tile_clear_flavour();
+    env.tile_names.clear();
+
+    _clear_env_map();
+
+    level_stream_builder(true, stair_type);
+}
+
+#ifdef UNIX
+// A level being built ahead of the player, by a forked child.
+struct level_ahead
+{
+    pid_t pid;
+    string filename;
+};
+static map<level_id, level_ahead> levels_ahead;
+
+// How many of the levels built ahead were used, or thrown away because
+// they failed or the player changed what they were built from, or went
+// elsewhere.
+static int levels_ahead_used = 0;
+static int levels_ahead_stale = 0;
+static int levels_ahead_unused = 0;
+
+// The player's game keeps numbering monsters while a level is built, so
+// the child numbers its own from this far on.
+static const mid_t LEVEL_AHEAD_MIDS = 100000;
+
+// What level generation reads from the player, but never changes.
+static void _marshall_levelgen_context(writer &th)
+{
+    marshallShort(th, you.species);
+    marshallShort(th, you.religion);
+    marshallShort(th, you.chapter);
+    marshallInt(th, you.zigs_completed);
+    for (int i = 0; i < NUM_RUNE_TYPES; ++i)
+        marshallBoolean(th, you.runes[i]);
+}
+
+// What level generation changes outside of env. A level built ahead is
+// only used if this and the context are the same when the player arrives
+// as when it was started; this is then set to what the build left it as.
+static void _marshall_levelgen_state(writer &th, const level_id &lid)
+{
+    for (int i = 0; i < NUM_MONSTERS; ++i)
+        marshallBoolean(th, you.unique_creatures[i]);
+    for (int i = 0; i < MAX_UNRANDARTS; ++i)
+        marshallByte(th, you.unique_items[i]);
+
+    marshallInt(th, you.uniq_map_tags.size());
+    for (const string &tag : you.uniq_map_tags)
+        marshallString(th, tag);
+    marshallInt(th, you.uniq_map_names.size());
+    for (const string &name : you.uniq_map_names)
+        marshallString(th, name);
+
+    const vector<string> *vaults = map_find(you.vault_list, lid);
+    marshallInt(th, vaults ? vaults->size() : 0);
+    if (vaults)
+        for (const string &vault : *vaults)
+            marshallString(th, vault);
+
+    marshallInt(th, you.attribute[ATTR_GOLD_GENERATED]);
+    marshallUByte(th, you.octopus_king_rings);
+
+    if (!dlua.callfn("dgn_save_data", "u", &th))
+        mprf(MSGCH_ERROR, "Failed to save Lua data: %s", dlua.error.c_str());
+}
+
+static void _unmarshall_levelgen_state(reader &th, const level_id &lid)
+{
+    for (int i = 0; i < NUM_MONSTERS; ++i)
+        you.unique_creatures.set(i, unmarshallBoolean(th));
+    for (int i = 0; i < MAX_UNRANDARTS; ++i)
+        you.unique_items[i] = (unique_item_status_type) unmarshallByte(th);
+
+    you.uniq_map_tags.clear();
+    for (int i = unmarshallInt(th); i > 0; --i)
+        you.uniq_map_tags.insert(unmarshallString(th));
+    you.uniq_map_names.clear();
+    for (int i = unmarshallInt(th); i > 0; --i)
+        you.uniq_map_names.insert(unmarshallString(th));
+
+    vector<string> vaults;
+    for (int i = unmarshallInt(th); i > 0; --i)
+        vaults.push_back(unmarshallString(th));
+    if (!vaults.empty())
+        you.vault_list[lid] = vaults;
+
+    you.attribute[ATTR_GOLD_GENERATED] = unmarshallInt(th);
+    you.octopus_king_rings = unmarshallUByte(th);
+
+    if (!dlua.callfn("dgn_load_data", "u", &th))
+    {
+        mprf(MSGCH_ERROR, "Failed to load Lua persist table: %s",
+             dlua.error.c_str());
+    }
+}
+
+static vector<unsigned char> _levelgen_inputs(const level_id &lid)
+{
+    vector<unsigned char> buf;
+    writer th(&buf);
+    _marshall_levelgen_context(th);
+    _marshall_levelgen_state(th, lid);
+    return buf;
+}
+
+// In the child: build the level, write it out with what it was built from
+// and what it changed, and exit without going through the usual shutdown.
+static NORETURN void _build_level_ahead(const level_id &lid,
+                                        dungeon_feature_type stair_taken,
+                                        const string &filename)
+{
+    crawl_state.building_ahead = true;
+    crawl_state.need_save = false;
+    for (int sig : { SIGHUP, SIGINT, SIGTERM, SIGSEGV, SIGBUS, SIGFPE,
+                     SIGILL, SIGABRT })
+    {
+        signal(sig, SIG_DFL);
+    }
+
+    const vector<unsigned char> inputs = _levelgen_inputs(lid);
+    you.last_mid += LEVEL_AHEAD_MIDS;
+
+    bool dummy;
+    const branch_type old_branch = you.where_are_you;
+    you.where_are_you = lid.branch;
+    you.depth = lid.depth;
+    {
+        no_messages mx;
+        _build_new_level(static_cast<dungeon_feature_type>(
+            _get_dest_stair_type(old_branch, stair_taken, dummy)));
+    }
+    fix_item_coordinates();
+
+    FILE *fp = fopen_u(filename.c_str(), "wb");
+    if (!fp)
+        _exit(1);
+
+    writer outf(filename, fp, true);
+    marshallInt(outf, inputs.size());
+    outf.write(inputs.data(), inputs.size());
+    _marshall_tagged_chunk(outf, TAG_LEVEL);
+    _marshall_levelgen_state(outf, lid);
+    marshallInt(outf, you.last_mid);
+    const bool ok = outf.succeeded();
+    fclose(fp);
+    _exit(ok ? 0 : 1);
+}
+
+static void _build_level_ahead_by(const level_id &lid,
+                                  dungeon_feature_type stair_taken)
+{
+    if (levels_ahead.count(lid) || is_existing_level(lid))
+        return;
+
+    const string filename = make_stringf("%s.%s.ahead",
+                                         get_savedir_filename(you.your_name)
+                                             .c_str(),
+                                         lid.describe().c_str());
+    // The child mustn't inherit the package lock from the writer thread.
+    if (you.save)
+        you.save->finish_async();
+    fflush(stdout);
+    fflush(stderr);
+    const pid_t pid = fork();
+    if (pid == -1)
+    {
+        dprf("Couldn't fork to build %s: %s", lid.describe().c_str(),
+             strerror(errno));
+        return;
+    }
+    if (!pid)
+        _build_level_ahead(lid, stair_taken, filename);
+
+    levels_ahead[lid] = { pid, filename };
+}
+
+// Wait for the level built ahead for the player's new position, and load
+// it if nothing it was built from has changed since.
+static bool _load_level_built_ahead()
+{
+    const level_id lid = level_id::current();
+    const level_ahead *found = map_find(levels_ahead, lid);
+    if (!found)
+        return false;
+
+    const level_ahead ahead = *found;
+    levels_ahead.erase(lid);
+
+    int status;
+    FILE *fp = nullptr;
+    if (waitpid(ahead.pid, &status, 0) != -1
+        && WIFEXITED(status) && !WEXITSTATUS(status))
+    {
+        fp = fopen_u(ahead.filename.c_str(), "rb");
+    }
+    unlink_u(ahead.filename.c_str());
+    if (!fp)
+        return false;
+
+    bool loaded = false;
+    try
+    {
+        reader inf(fp, TAG_MINOR_VERSION);
+        vector<unsigned char> inputs(unmarshallInt(inf));
+        inf.read(inputs.data(), inputs.size());
+        if (inputs == _levelgen_inputs(lid)
+            && unmarshallUByte(inf) == TAG_MAJOR_VERSION
+            && unmarshallUByte(inf) == TAG_MINOR_VERSION)
+        {
+            crawl_state.minor_version = TAG_MINOR_VERSION;
+            tag_read(inf, TAG_LEVEL);
+            _unmarshall_levelgen_state(inf, lid);
+            you.last_mid = max(you.last_mid, (mid_t) unmarshallInt(inf));
+            loaded = true;
+        }
+    }
+    catch (short_read_exception &E)
+    {
+        dprf("Level built ahead for %s is truncated.",
+             lid.describe().c_str());
+    }
+    catch (ext_fail_exception &E)
+    {
+        dprf("Level built ahead for %s is invalid: %s",
+             lid.describe().c_str(), E.what());
+    }
+    fclose(fp);
+
+    if (loaded)
+    {
+        levels_ahead_used++;
+        dprf("Loaded level built ahead for %s.", lid.describe().c_str());
+    }
+    else
+        levels_ahead_stale++;
+    dprf("Levels built ahead: %d used, %d stale, %d unused.",
+         levels_ahead_used, levels_ahead_stale, levels_ahead_unused);
+    return loaded;
+}
+#endif
+
+// Start building the new levels the stairs of the current level lead to.
+void build_levels_ahead()
+{
+#ifdef UNIX
+    if (!Options.pregen_levels
+        || you.props.exists(GAMEPLAY_LEVELGEN_KEY)
+        || !crawl_state.game_standard_levelgen()
+        || !is_connected_branch(you.where_are_you))
+    {
+        return;
+    }
+
+    if (you.depth < brdepth[you.where_are_you])
+    {
+        _build_level_ahead_by(level_id(you.where_are_you, you.depth + 1),
+                              DNGN_STONE_STAIRS_DOWN_I);
+    }
+
+    for (branch_iterator it; it; ++it)
+        if (brentry[it->id] == level_id::current()
+            && brdepth[it->id] > 0
+            && is_connected_branch(it->id))
+        {
+            _build_level_ahead_by(level_id(it->id, 1), it->entry_stairs);
+        }
+#endif
+}
+
+// Stop building levels ahead, and throw away any that were built.
+void discard_levels_built_ahead()
+{
+#ifdef UNIX
+    for (const auto &entry : levels_ahead)
+    {
+        kill(entry.second.pid, SIGKILL);
+        waitpid(entry.second.pid, nullptr, 0);
+        unlink_u(entry.second.filename.c_str());
+    }
+    levels_ahead_unused += levels_ahead.size();
+    levels_ahead.clear();
+#endif
+}
+
+#ifdef UNIX
+// The features, monsters and items of the current level, to tell whether
+// two builds of it came out the same. Monster ids are left out: a level
+// built ahead numbers its monsters from further on.
+static string _level_summary()
+{
+    string summary;
+    for (rectangle_iterator ri(0); ri; ++ri)
+        summary += make_stringf("%d,", env.grid(*ri));
+    for (monster_iterator mi; mi; ++mi)
+    {
+        summary += make_stringf("\n%d@%d,%d", mi->type, mi->pos().x,
+                                mi->pos().y);
+    }
+    for (int i = 0; i < MAX_ITEMS; ++i)
+    {
+        const item_def &item = mitm[i];
+        if (item.defined())
+        {
+            summary += make_stringf("\n%d/%d@%d,%d", item.base_type,
+                                    item.sub_type, item.pos.x, item.pos.y);
+        }
+    }
+    return summary;
+}
+#endif
+
+/**
+ * For tests: build the current level both ahead, in a child, and here
+ * after using up some of the gameplay random stream, as it would be with
+ * pregen_levels off.
+ *
+ * @param[out] ahead The summary of the level built ahead.
+ * @param[out] here  The summary of the level built here.
+ * @return Whether the level built ahead could be used.
+ */
+bool build_level_both_ways(string &ahead, string &here)
+{
+#ifdef UNIX
+    const level_id lid = level_id::current();
+    vector<unsigned char> state;
+    writer outf(&state);
+    _marshall_levelgen_state(outf, lid);
+
+    _build_level_ahead_by(lid, DNGN_STONE_STAIRS_DOWN_I);
+    if (!levels_ahead.count(lid))
+        return false;
+
+    for (int i = 0; i < 1000; ++i)
+        random2(100);
+    bool dummy;
+    _build_new_level(static_cast<dungeon_feature_type>(
+        _get_dest_stair_type(lid.branch, DNGN_STONE_STAIRS_DOWN_I, dummy)));
+    here = _level_summary();
+
+    // Back to where the child started from.
+    you.vault_list.erase(lid);
+    reader inf(state, TAG_MINOR_VERSION);
+    _unmarshall_levelgen_state(inf, lid);
+    if (!_load_level_built_ahead())
+        return false;
+    ahead = _level_summary();
+    return true;
+#else
+    UNUSED(ahead);
+    UNUSED(here);
+    return false;
+#endif
+}
+
 /**
  * Generate a new level.
  *
@@ -1135,9 +1507,6 @@ static bool _leave_level(dungeon_feature_type stair_taken,
 static void _make_level(dungeon_feature_type stair_taken,
                         const level_id& old_level)
 {
-
-    env.turns_on_level = -1;
-
     if (you.chapter == CHAPTER_POCKET_ABYSS
         && player_in_branch(BRANCH_DUNGEON))
     {
@@ -1147,10 +1516,6 @@ static void _make_level(dungeon_feature_type stair_taken,
         you.chapter = CHAPTER_ORB_HUNTING;
     }
 
-    tile_init_default_flavour();
-    tile_clear_flavour();
-    env.tile_names.clear();
-
     // XXX: This is ugly.
     bool dummy;
     dungeon_feature_type stair_type = static_cast<dungeon_feature_type>(
@@ -1158,8 +1523,10 @@ static void _make_level(dungeon_feature_type stair_taken,
                              static_cast<dungeon_feature_type>(stair_taken),
                              dummy));
 
-    _clear_env_map();
-    builder(true, stair_type);
+#ifdef UNIX
+    if (!_load_level_built_ahead())
+#endif
+        _build_new_level(stair_type);
 
     if (!crawl_state.game_is_tutorial()
         && !Options.seed
@@ -1289,7 +1656,7 @@ bool load_level(dungeon_feature_type stair_taken, load_mode_type load_mode,
             if (env.level_state & LSTATE_DELETED)
                 delete_level(old_level), dprf("<lightmagenta>Deleting level.</lightmagenta>");
             else
-                _save_level(old_level);
+                save_level(old_level);
         }
 
         // The player is now between levels.
@@ -1327,6 +1694,11 @@ bool load_level(dungeon_feature_type stair_taken, load_mode_type load_mode,
         _redraw_all();
     }
 
+    // Whatever else was built ahead led from the old level; new ones are
+    // started once this one is saved.
+    if (make_changes)
+        discard_levels_built_ahead();
+
     // Clear map knowledge stair emphasis.
     show_update_emphasis();
 
@@ -1405,7 +1777,10 @@ bool load_level(dungeon_feature_type stair_taken, load_mode_type load_mode,
 
     // Save the created/updated level out to disk:
     if (make_changes)
-        _save_level(level_id::current());
+    {
+        save_level(level_id::current());
+        build_levels_ahead();
+    }
 
     setup_environment_effects();
 
@@ -1532,14 +1907,24 @@ bool load_level(dungeon_feature_type stair_taken, load_mode_type load_mode,
     return just_created_level;
 }
 
-static void _save_level(const level_id& lid)
+void save_level(const level_id& lid)
 {
     travel_cache.get_level_info(lid).update();
 
     // Nail all items to the ground.
     fix_item_coordinates();
 
-    _write_tagged_chunk(lid.describe(), TAG_LEVEL);
+    if (Options.background_save)
+    {
+        // Snapshot the level now; compressing and writing it can go on
+        // while the next level is loaded.
+        vector<unsigned char> buf;
+        writer outf(&buf);
+        _marshall_tagged_chunk(outf, TAG_LEVEL);
+        you.save->write_chunk_async(lid.describe(), move(buf));
+    }
+    else
+        _write_tagged_chunk(lid.describe(), TAG_LEVEL);
 }
 
 #if TAG_MAJOR_VERSION == 34
@@ -1593,10 +1978,69 @@ static void _save_game_base()
     _write_tagged_chunk("chr", TAG_CHR);
 }
 
+// How much of the save, in percent, is space no longer used.
+static int _save_slack(package *save)
+{
+    const uint64_t size = save->get_size();
+    return size ? (uint64_t)save->get_slack() * 100 / size : 0;
+}
+
+// Rewrite every save, of any game type, with at least min_slack percent
+// of unused space.
+void compact_saves(int min_slack)
+{
+    set<string> dirs;
+    for (int i = 0; i < NUM_GAME_TYPE; ++i)
+    {
+        unwind_var<game_type> gt(
+            crawl_state.type,
+            static_cast<game_type>(i));
+
+        string searchpath = _get_savefile_directory();
+        if (dirs.count(searchpath))
+            continue;
+        dirs.insert(searchpath);
+
+        if (searchpath.empty())
+            searchpath = ".";
+
+        for (const string &filename : get_dir_files(searchpath))
+        {
+            if (!is_save_file_name(filename))
+                continue;
+
+            try
+            {
+                package save(_get_savedir_path(filename).c_str(), true);
+                const plen_t size = save.get_size();
+                const int slack = _save_slack(&save);
+                if (slack < min_slack)
+                {
+                    printf("%s: %u bytes, %d%% unused, left as it is\n",
+                           filename.c_str(), size, slack);
+                }
+                else if (save.compact())
+                {
+                    printf("%s: %u bytes, %d%% unused, now %u bytes\n",
+                           filename.c_str(), size, slack, save.get_size());
+                }
+                else
+                    printf("%s: couldn't be rewritten\n", filename.c_str());
+            }
+            catch (ext_fail_exception &E)
+            {
+                printf("%s: %s\n", filename.c_str(), E.what());
+            }
+        }
+    }
+}
+
 // Stack allocated string's go in separate function, so Valgrind doesn't
 // complain.
 static void _save_game_exit()
 {
+    discard_levels_built_ahead();
+
     clua.save_persist();
 
     // Prompt for saving macros.
@@ -1609,7 +2053,7 @@ static void _save_game_exit()
 
     // Must be exiting -- save level & goodbye!
     if (!you.entering_level)
-        _save_level(level_id::current());
+        save_level(level_id::current());
 
     clrscr();
 
@@ -1620,6 +2064,15 @@ static void _save_game_exit()
     tiles.send_exit_reason("saved");
 #endif
 
+    // Reclaim the space of levels rewritten over the course of the game,
+    // and put each chunk back in one piece.
+    you.save->commit();
+    if (!Options.no_save && Options.save_compact_slack
+        && _save_slack(you.save) >= Options.save_compact_slack)
+    {
+        you.save->compact();
+    }
+
     delete you.save;
     you.save = 0;
 }
@@ -1650,7 +2103,11 @@ void save_game(bool leave_game, const char *farewellmsg)
     // If just save, early out.
     if (!leave_game)
     {
-        if (!crawl_state.disables[DIS_SAVE_CHECKPOINTS])
+        if (crawl_state.disables[DIS_SAVE_CHECKPOINTS])
+            return;
+        if (Options.background_save)
+            you.save->commit_async();
+        else
             you.save->commit();
         return;
     }
@@ -1874,6 +2331,7 @@ static bool _restore_game(const string& filename)
         return false;
 
     you.save = new package((_get_savefile_directory() + filename).c_str(), true);
+    you.save->set_codec(Options.save_compression);
 
     if (!_read_char_chunk(you.save))
     {
@@ -2037,7 +2495,7 @@ void level_excursion::go_to(const level_id& next)
     {
         ever_changed_levels = true;
 
-        _save_level(level_id::current());
+        save_level(level_id::current());
         _load_level(next);
 
         LevelInfo &li = travel_cache.get_level_info(next);
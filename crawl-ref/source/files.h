@@ -65,6 +65,7 @@ bool check_mkdir(const string &what, string *dir, bool silent = false);
 
 // Find saved games for all game types.
 vector<player_save_info> find_all_saved_characters();
+void compact_saves(int min_slack);
 
 string get_save_filename(const string &name);
 string get_savedir_filename(const string &name);
@@ -83,6 +84,10 @@ void trackers_init_new_level(bool transit);
 bool load_level(dungeon_feature_type stair_taken, load_mode_type load_mode,
                 const level_id& old_level);
 void delete_level(const level_id &level);
+void save_level(const level_id& lid);
+void build_levels_ahead();
+void discard_levels_built_ahead();
+bool build_level_both_ways(string &ahead, string &here);
 
 void save_game(bool leave_game, const char *bye = nullptr);
 
@@ -198,6 +198,9 @@ const vector<GameOption*> game_options::build_options_list()
         new BoolGameOption(SIMPLE_NAME(explore_auto_rest), false),
         new BoolGameOption(SIMPLE_NAME(travel_key_stop), true),
         new BoolGameOption(SIMPLE_NAME(dump_on_save), true),
+        new BoolGameOption(SIMPLE_NAME(background_save), false),
+        new BoolGameOption(SIMPLE_NAME(pregen_levels), false),
+        new IntGameOption(SIMPLE_NAME(save_compact_slack), 30, 0, 100),
         new BoolGameOption(SIMPLE_NAME(rest_wait_both), false),
         new BoolGameOption(SIMPLE_NAME(cloud_status), !is_tiles()),
         new BoolGameOption(SIMPLE_NAME(darken_beyond_range), true),
@@ -1035,6 +1038,8 @@ void game_options::reset_options()
     dump_kill_places       = KDO_ONE_PLACE;
     dump_item_origins      = IODS_ARTEFACTS | IODS_RODS;
 
+    save_compression       = CODEC_ZLIB;
+
     flush_input[ FLUSH_ON_FAILURE ]     = true;
     flush_input[ FLUSH_BEFORE_COMMAND ] = false;
     flush_input[ FLUSH_ON_MESSAGE ]     = false;
@@ -3183,6 +3188,24 @@ void game_options::read_option_line(const string &str, bool runscript)
 
         new_dump_fields(field, !minus_equal, caret_equal);
     }
+    else if (key == "save_compression")
+    {
+        int codec = 0;
+        while (codec < NUM_CODECS
+               && field != codec_name((package_codec)codec))
+        {
+            ++codec;
+        }
+        if (codec == NUM_CODECS)
+            report_error("Unknown save_compression: %s\n", field.c_str());
+        else if (!codec_supported((package_codec)codec))
+        {
+            report_error("This build can't use %s save_compression.\n",
+                         field.c_str());
+        }
+        else
+            save_compression = (package_codec)codec;
+    }
     else if (key == "dump_kill_places")
     {
         dump_kill_places = (field == "none" ? KDO_NO_PLACES :
@@ -3694,6 +3717,7 @@ enum commandline_option_type
     CLO_MAPSTAT,
     CLO_OBJSTAT,
     CLO_ITERATIONS,
+    CLO_JOBS,
     CLO_ARENA,
     CLO_DUMP_MAPS,
     CLO_TEST,
@@ -3708,6 +3732,7 @@ enum commandline_option_type
     CLO_EXTRA_OPT_LAST,
     CLO_SPRINT_MAP,
     CLO_EDIT_SAVE,
+    CLO_COMPACT_SAVES,
     CLO_PRINT_CHARSET,
     CLO_TUTORIAL,
     CLO_WIZARD,
@@ -3722,6 +3747,8 @@ enum commandline_option_type
     CLO_WEBTILES_SOCKET,
     CLO_AWAIT_CONNECTION,
     CLO_PRINT_WEBTILES_OPTIONS,
+    CLO_WEBTILES_RECORD,
+    CLO_WEBTILES_REPLAY,
 #endif
 
     CLO_NOPS
@@ -3731,14 +3758,15 @@ static const char *cmd_ops[] =
 {
     "scores", "name", "species", "background", "dir", "rc",
     "rcdir", "tscores", "vscores", "scorefile", "morgue", "macro",
-    "mapstat", "objstat", "iters", "arena", "dump-maps", "test", "script",
-    "builddb", "help", "version", "seed", "save-version", "sprint",
+    "mapstat", "objstat", "iters", "jobs", "arena", "dump-maps", "test",
+    "script", "builddb", "help", "version", "seed", "save-version", "sprint",
     "extra-opt-first", "extra-opt-last", "sprint-map", "edit-save",
-    "print-charset", "tutorial", "wizard", "explore", "no-save",
+    "compact-saves", "print-charset", "tutorial", "wizard", "explore", "no-save",
     "gdb", "no-gdb", "nogdb", "throttle", "no-throttle",
     "playable-json",
 #ifdef USE_TILE_WEB
     "webtiles-socket", "await-connection", "print-webtiles-options",
+    "webtiles-record", "webtiles-replay",
 #endif
 };
 
@@ -3828,7 +3856,7 @@ static struct es_command
     { ES_GET,     "get",     false, 1, 2, },
     { ES_PUT,     "put",     true,  1, 2, },
     { ES_RM,      "rm",      true,  1, 1, },
-    { ES_REPACK,  "repack",  false, 0, 0, },
+    { ES_REPACK,  "repack",  true,  0, 0, },
     { ES_INFO,    "info",    false, 0, 0, },
 };
 
@@ -3946,20 +3974,8 @@ static void _edit_save(int argc, char **argv)
         }
         else if (cmd == ES_REPACK)
         {
-            package save2((filename + ".tmp").c_str(), true, true);
-            for (const string &chunk : save.list_chunks())
-            {
-                char buf[16384];
-
-                chunk_reader in(&save, chunk);
-                chunk_writer out(&save2, chunk);
-
-                while (plen_t s = in.read(buf, sizeof(buf)))
-                    out.write(buf, s);
-            }
-            save2.commit();
-            save.unlink();
-            rename_u((filename + ".tmp").c_str(), filename.c_str());
+            if (!save.compact())
+                FAIL("Couldn't rewrite the save file.\n");
         }
         else if (cmd == ES_INFO)
         {
@@ -3969,7 +3985,8 @@ static void _edit_save(int argc, char **argv)
             plen_t frag = save.get_chunk_fragmentation("");
             plen_t flen = save.get_size();
             plen_t slack = save.get_slack();
-            printf("Chunks: (size compressed/uncompressed, fragments, name)\n");
+            printf("Chunks: (size compressed/uncompressed, fragments, "
+                   "compression, name)\n");
             for (const string &chunk : list)
             {
                 int cfrag = save.get_chunk_fragmentation(chunk);
@@ -3981,7 +3998,8 @@ static void _edit_save(int argc, char **argv)
                 plen_t clen = 0;
                 while (plen_t s = in.read(buf, sizeof(buf)))
                     clen += s;
-                printf("%7d/%7d %3u %s\n", cclen, clen, cfrag, chunk.c_str());
+                printf("%7d/%7d %3u %-4s %s\n", cclen, clen, cfrag,
+                       codec_name(save.get_chunk_codec(chunk)), chunk.c_str());
             }
             // the directory is not a chunk visible from the outside
             printf("Fragmentation:    %u/%u (%4.2f)\n", frag, nchunks + 1,
@@ -4167,6 +4185,7 @@ bool parse_args(int argc, char **argv, bool rc_only)
 
     SysEnv.rcdirs.clear();
     SysEnv.map_gen_iters = 0;
+    SysEnv.map_gen_jobs = 1;
 
     if (argc < 2)           // no args!
         return true;
@@ -4346,6 +4365,25 @@ bool parse_args(int argc, char **argv, bool rc_only)
 #endif
             break;
 
+        case CLO_JOBS:
+#ifdef DEBUG_STATISTICS
+            if (!next_is_param || !isadigit(*next_arg))
+            {
+                fprintf(stderr, "Integer argument required for -%s\n", arg);
+                end(1);
+            }
+            else
+            {
+                SysEnv.map_gen_jobs = max(1, atoi(next_arg));
+                nextUsed = true;
+            }
+#else
+            fprintf(stderr, "mapstat and objstat are available only in "
+                    "DEBUG_STATISTICS builds.\n");
+            end(1);
+#endif
+            break;
+
         case CLO_ARENA:
             if (!rc_only)
             {
@@ -4506,6 +4544,11 @@ bool parse_args(int argc, char **argv, bool rc_only)
             _edit_save(argc - current - 1, argv + current + 1);
             end(0);
 
+        case CLO_COMPACT_SAVES:
+            // Always parse.
+            compact_saves(next_is_param ? atoi(next_arg) : 0);
+            end(0);
+
         case CLO_SEED:
             if (!next_is_param)
                 return false;
@@ -4570,6 +4613,20 @@ bool parse_args(int argc, char **argv, bool rc_only)
                 end(0);
             }
             break;
+
+        case CLO_WEBTILES_RECORD:
+            if (!next_is_param)
+                return false;
+            nextUsed            = true;
+            tiles.m_record_name = next_arg;
+            break;
+
+        case CLO_WEBTILES_REPLAY:
+            if (!next_is_param)
+                return false;
+            nextUsed            = true;
+            tiles.m_replay_name = next_arg;
+            break;
 #endif
 
         case CLO_PRINT_CHARSET:
@@ -7,24 +7,36 @@
 
 #include "l_libs.h"
 
+#include <chrono>
+
+#ifdef TARGET_OS_LINUX
+# include <unistd.h>
+#endif
+
 #include "act-iter.h"
 #include "branch.h"
 #include "chardump.h"
 #include "cluautil.h"
 #include "coordit.h"
 #include "dungeon.h"
+#include "errors.h"
 #include "files.h"
 #include "godwrath.h"
 #include "los.h"
+#include "maps.h"
 #include "message.h"
 #include "mon-act.h"
 #include "mon-death.h"
+#include "mon-pathfind.h"
 #include "mon-poly.h"
+#include "package.h"
 #include "religion.h"
 #include "stairs.h"
 #include "state.h"
 #include "stringutil.h"
+#include "terrain.h"
 #include "tileview.h"
+#include "unwind.h"
 #include "view.h"
 #include "wiz-dgn.h"
 
@@ -99,7 +111,7 @@ LUAFN(debug_generate_level)
     tile_init_default_flavour();
     tile_clear_flavour();
     tile_new_level(true);
-    builder(lua_isboolean(ls, 1)? lua_toboolean(ls, 1) : true);
+    level_stream_builder(lua_isboolean(ls, 1)? lua_toboolean(ls, 1) : true);
     return 0;
 }
 
@@ -331,6 +343,226 @@ LUAFN(debug_seen_monsters_react)
     return 0;
 }
 
+// Usage: debug.build_level_both_ways() -> summaries of the current level as
+//            built ahead and as built in place, or nil where it can't be
+//            built ahead.
+LUAFN(debug_build_level_both_ways)
+{
+    string ahead, here;
+    if (!build_level_both_ways(ahead, here))
+        return 0;
+    lua_pushstring(ls, ahead.c_str());
+    lua_pushstring(ls, here.c_str());
+    return 2;
+}
+
+// Usage: debug.rss() -> resident memory of the process in KiB, and how
+//                       much of that is shared with other processes (file
+//                       pages, such as mapped des caches), or nil where
+//                       that isn't known.
+LUAFN(debug_rss)
+{
+#ifdef TARGET_OS_LINUX
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+    long pages, resident, shared;
+    const bool ok = fscanf(statm, "%ld %ld %ld", &pages, &resident,
+                           &shared) == 3;
+    fclose(statm);
+    if (!ok)
+        return 0;
+    const long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    lua_pushnumber(ls, resident * page_kb);
+    lua_pushnumber(ls, shared * page_kb);
+    return 2;
+#else
+    return 0;
+#endif
+}
+
+// Usage: debug.map_stats() -> number of maps, sizeof(map_def), number of
+//                             maps whose full definition is loaded
+LUAFN(debug_map_stats)
+{
+    int loaded = 0;
+    for (int i = 0, count = map_count(); i < count; ++i)
+        if (map_by_index(i)->is_loaded())
+            ++loaded;
+
+    lua_pushnumber(ls, map_count());
+    lua_pushnumber(ls, sizeof(map_def));
+    lua_pushnumber(ls, loaded);
+    return 3;
+}
+
+// Usage: debug.pathfind_bench(searches[, max distance])
+//            -> nanoseconds per search, searches that found a path
+// Times monster_pathfind between random pairs of floor cells of the
+// current level, no further apart than max distance.
+LUAFN(debug_pathfind_bench)
+{
+    const int searches = luaL_checkint(ls, 1);
+    const int max_dist = max(luaL_optint(ls, 2, INFINITE_DISTANCE), 0);
+
+    vector<coord_def> floor;
+    for (rectangle_iterator ri(1); ri; ++ri)
+        if (feat_has_solid_floor(grd(*ri)))
+            floor.push_back(*ri);
+
+    vector<pair<coord_def, coord_def>> pairs;
+    while (!floor.empty() && (int) pairs.size() < searches)
+    {
+        const coord_def src = floor[random2(floor.size())];
+        const coord_def dest = floor[random2(floor.size())];
+        if (grid_distance(src, dest) <= max_dist)
+            pairs.emplace_back(src, dest);
+    }
+
+    if (pairs.empty())
+        return 0;
+
+    int found = 0;
+    const auto start = chrono::steady_clock::now();
+    for (const auto &p : pairs)
+    {
+        monster_pathfind mp;
+        if (mp.init_pathfind(p.first, p.second))
+            ++found;
+    }
+    const chrono::nanoseconds elapsed = chrono::steady_clock::now() - start;
+
+    lua_pushnumber(ls, (double) elapsed.count() / pairs.size());
+    lua_pushnumber(ls, found);
+    return 2;
+}
+
+// Usage: debug.save_bench(rounds[, save name])
+//            -> ms per save, ms per level load, size of the save in bytes,
+//               or nil if the save couldn't be restored
+// Times save_game_state() followed by saving the current level, and then
+// load_level() bringing the level back. If a save name is given, that game
+// is restored first, and saved over, so point it at a copy. Outside a game,
+// the state is saved to a scratch save that is deleted afterwards.
+LUAFN(debug_save_bench)
+{
+    const int rounds = max(luaL_checkint(ls, 1), 1);
+
+    unwind_var<package*> save(you.save);
+    if (lua_isstring(ls, 2))
+    {
+        you.save = nullptr;
+        if (!restore_game(lua_tostring(ls, 2)))
+            return 0;
+    }
+    else if (!you.save)
+        you.save = new package("save-bench.cs", true, true);
+    const bool own_save = you.save != save.original_value();
+
+    typedef chrono::steady_clock bench_clock;
+    bench_clock::duration save_time(0), load_time(0);
+    for (int i = 0; i < rounds; ++i)
+    {
+        const bench_clock::time_point start = bench_clock::now();
+        save_game_state();
+        save_level(level_id::current());
+        const bench_clock::time_point saved = bench_clock::now();
+        load_level(DNGN_STONE_STAIRS_DOWN_I, LOAD_VISITOR, level_id());
+        load_time += bench_clock::now() - saved;
+        save_time += saved - start;
+    }
+    // As when returning from a level_excursion.
+    env.markers.activate_all(false);
+    const plen_t size = you.save->get_size();
+
+    if (own_save)
+    {
+        if (!lua_isstring(ls, 2))
+            you.save->unlink();
+        delete you.save;
+    }
+
+    typedef chrono::duration<double, milli> ms;
+    lua_pushnumber(ls, chrono::duration_cast<ms>(save_time).count() / rounds);
+    lua_pushnumber(ls, chrono::duration_cast<ms>(load_time).count() / rounds);
+    lua_pushnumber(ls, size);
+    return 3;
+}
+
+// Usage: debug.codec_bench(save file, codec[, rounds])
+//            -> ms to write every chunk, ms to read them back, size in bytes,
+//               or nil if this build doesn't support the codec
+// Copies the chunks of a save into a scratch save compressed with the given
+// codec ("zlib", "lz4", "zstd" or "none"), and reads them back. The commit
+// isn't timed, so disk flushes don't drown out the codec.
+LUAFN(debug_codec_bench)
+{
+    const char *file = luaL_checkstring(ls, 1);
+    const string name = luaL_checkstring(ls, 2);
+    const int rounds = max(luaL_optint(ls, 3, 5), 1);
+
+    int codec = 0;
+    while (codec < NUM_CODECS && name != codec_name((package_codec)codec))
+        ++codec;
+    if (codec == NUM_CODECS)
+        luaL_argerror(ls, 2, ("unknown codec: " + name).c_str());
+    if (!codec_supported((package_codec)codec))
+        return 0;
+
+    map<string, vector<char>> chunks;
+    try
+    {
+        package save(file, false);
+        for (const string &chunk : save.list_chunks())
+        {
+            unique_ptr<chunk_reader> inf(save.reader(chunk));
+            inf->read_all(chunks[chunk]);
+        }
+    }
+    catch (const ext_fail_exception &fe)
+    {
+        luaL_error(ls, "%s", fe.what());
+    }
+
+    typedef chrono::steady_clock bench_clock;
+    bench_clock::duration write_time(0), read_time(0);
+    plen_t size = 0;
+    vector<char> data;
+    for (int i = 0; i < rounds; ++i)
+    {
+        package pkg("codec-bench.cs", true, true);
+        pkg.set_codec((package_codec)codec);
+
+        const bench_clock::time_point start = bench_clock::now();
+        for (const auto &chunk : chunks)
+        {
+            unique_ptr<chunk_writer> outf(pkg.writer(chunk.first));
+            if (!chunk.second.empty())
+                outf->write(&chunk.second[0], chunk.second.size());
+        }
+        const bench_clock::time_point written = bench_clock::now();
+        for (const auto &chunk : chunks)
+        {
+            unique_ptr<chunk_reader> inf(pkg.reader(chunk.first));
+            data.clear();
+            inf->read_all(data);
+            ASSERT(data == chunk.second);
+        }
+        read_time += bench_clock::now() - written;
+        write_time += written - start;
+
+        pkg.commit();
+        size = pkg.get_size();
+        pkg.unlink();
+    }
+
+    typedef chrono::duration<double, milli> ms;
+    lua_pushnumber(ls, chrono::duration_cast<ms>(write_time).count() / rounds);
+    lua_pushnumber(ls, chrono::duration_cast<ms>(read_time).count() / rounds);
+    lua_pushnumber(ls, size);
+    return 3;
+}
+
 static const char* disablements[] =
 {
     "spawns",
@@ -391,5 +623,11 @@ const struct luaL_reg debug_dlib[] =
 { "viewwindow", debug_viewwindow },
 { "seen_monsters_react", debug_seen_monsters_react },
 { "disable", debug_disable },
+{ "rss", debug_rss },
+{ "map_stats", debug_map_stats },
+{ "build_level_both_ways", debug_build_level_both_ways },
+{ "pathfind_bench", debug_pathfind_bench },
+{ "save_bench", debug_save_bench },
+{ "codec_bench", debug_codec_bench },
 { nullptr, nullptr }
 };
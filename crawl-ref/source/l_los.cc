@@ -59,11 +59,54 @@ LUAFN(los_cell_see_cell)
     PLUARET(number, cell_see_cell(p, q, LOS_DEFAULT));
 }
 
+static void _push_stat(lua_State *ls, const char *name, uint64_t val)
+{
+    lua_pushstring(ls, name);
+    lua_pushnumber(ls, val);
+    lua_settable(ls, -3);
+}
+
+// Usage: los.cache_stats() -> table of cell_see_cell() cache counters
+LUAFN(los_cache_stats)
+{
+    const globallos_stats &stats = get_globallos_stats();
+    lua_newtable(ls);
+    _push_stat(ls, "hits", stats.hits);
+    _push_stat(ls, "misses", stats.misses);
+    _push_stat(ls, "local_invalidations", stats.local_invalidations);
+    _push_stat(ls, "pairs_kept", stats.pairs_kept);
+    _push_stat(ls, "pairs_dropped", stats.pairs_dropped);
+    _push_stat(ls, "full_invalidations", stats.full_invalidations);
+    return 1;
+}
+
+LUAFN(los_reset_cache_stats)
+{
+    reset_globallos_stats();
+    return 0;
+}
+
+// Usage: los.cache_memory() -> bytes used by the cell_see_cell() cache,
+//                              whether it's the compact variant
+LUAFN(los_cache_memory)
+{
+    lua_pushnumber(ls, globallos_memory_use());
+#ifdef COMPACT_GLOBALLOS
+    lua_pushboolean(ls, true);
+#else
+    lua_pushboolean(ls, false);
+#endif
+    return 2;
+}
+
 const struct luaL_reg los_dlib[] =
 {
     { "findray", los_find_ray },
     { "make_ray", los_make_ray },
     { "cell_see_cell", los_cell_see_cell },
+    { "cache_stats", los_cache_stats },
+    { "reset_cache_stats", los_reset_cache_stats },
+    { "cache_memory", los_cache_memory },
     { nullptr, nullptr }
 };
 
@@ -495,19 +495,28 @@ int getchk()
         return c;
 #endif
 
+    int key;
     switch (get_wch(&c))
     {
     case ERR:
         // getch() returns -1 on EOF, convert that into an Escape. Evil hack,
         // but the alternative is to explicitly check for -1 everywhere where
         // we might otherwise spin in a tight keyboard input loop.
-        return ESCAPE;
+        key = ESCAPE;
+        break;
     case OK:
         // a normal (printable) key
-        return c;
+        key = c;
+        break;
+    default:
+        key = -c;
+        break;
     }
 
-    return -c;
+#ifdef USE_TILE_WEB
+    tiles.record_key(key);
+#endif
+    return key;
 }
 
 int m_getch()
@@ -46,12 +46,22 @@
 
 #include <algorithm>
 #include <cmath>
+#ifndef TARGET_COMPILER_VC
+# include <unistd.h>
+#else
+# include <process.h>
+#endif
 
 #include "areas.h"
 #include "coord.h"
 #include "coordit.h"
 #include "env.h"
+#include "files.h"
+#include "hash.h"
 #include "losglobal.h"
+#include "mon-pathfind.h"
+#include "stringutil.h"
+#include "syscalls.h"
 
 // These determine what rays are cast in the precomputation,
 // and affect start-up time significantly.
@@ -73,9 +83,21 @@ static vector<coord_def> ray_coords;
 // thoses cells p that have blockrays(p)[i] set. In other
 // words, blockrays(p)[i] is set iff an opaque cell p blocks
 // the cellray with index i.
+// The rows blockrays(p) are packed into one table of 64-bit
+// words, blockray_words per row, so that losight() can combine
+// them with the wide kernels from bitary.h. The table is either
+// blockray_storage or part of the mapped cache file.
 static vector<coord_def> cellray_ends;
-typedef FixedArray<bit_vector*, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> blockrays_t;
-static blockrays_t blockrays;
+static int blockray_words = 0;
+static const uint64_t *blockray_table = nullptr;
+static vector<uint64_t> blockray_storage;
+
+// For each cell p, the targets whose minimal cellrays pass through p;
+// that is, the cells whose visibility may change if p's opacity does.
+// Derived from blockrays after the precomputation.
+typedef FixedBitArray<LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> quadrant_mask;
+static FixedArray<quadrant_mask, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1>
+    blocked_targets;
 
 // We also store the minimal cellrays by target position
 // for efficient retrieval by find_ray.
@@ -83,11 +105,14 @@ static blockrays_t blockrays;
 struct cellray;
 static FixedArray<vector<cellray>, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> min_cellrays;
 
-// Temporary arrays used in losight() to track which rays
-// are blocked or have seen a smoke cloud.
+// Temporary rows used in losight() to track which rays
+// are blocked or have seen a smoke cloud, and which are
+// still alive. all_rays has a bit set for every cellray.
 // Allocated when doing the precomputations.
-static bit_vector *dead_rays     = nullptr;
-static bit_vector *smoke_rays    = nullptr;
+static vector<uint64_t> all_rays;
+static vector<uint64_t> dead_rays;
+static vector<uint64_t> smoke_rays;
+static vector<uint64_t> alive_rays;
 
 class quadrant_iterator : public rectangle_iterator
 {
@@ -99,12 +124,32 @@ public:
     }
 };
 
+static const uint64_t *blockrays(const coord_def& p)
+{
+    return blockray_table
+           + (p.y * (LOS_MAX_RANGE + 1) + p.x) * blockray_words;
+}
+
+static void _init_ray_rows(int n_cellrays)
+{
+    all_rays.assign(blockray_words, 0);
+    for (int i = 0; i < n_cellrays; ++i)
+        all_rays[i / 64] |= 1ULL << (i % 64);
+    dead_rays.assign(blockray_words, 0);
+    smoke_rays.assign(blockray_words, 0);
+    alive_rays.assign(blockray_words, 0);
+}
+
+// If the precomputation was loaded from the on-disk cache, blockray_table
+// points into this mapping.
+static const void *ray_cache = nullptr;
+static size_t ray_cache_size = 0;
+
 void clear_rays_on_exit()
 {
-    delete dead_rays;
-    delete smoke_rays;
-    for (quadrant_iterator qi; qi; ++qi)
-        delete blockrays(*qi);
+    blockray_table = nullptr;
+    unmap_file_u(ray_cache, ray_cache_size);
+    ray_cache = nullptr;
 }
 
 // LOS radius.
@@ -382,7 +427,7 @@ static void _create_blockrays()
     // Cellrays are numbered according to the index of their end
     // cell in ray_coords.
     const int n_cellrays = ray_coords.size();
-    blockrays_t all_blockrays;
+    FixedArray<bit_vector*, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> all_blockrays;
     for (quadrant_iterator qi; qi; ++qi)
         all_blockrays(*qi) = new bit_vector(n_cellrays);
 
@@ -407,23 +452,24 @@ static void _create_blockrays()
     for (int i = 0; i < n_min_rays; ++i)
         cellray_ends[i] = ray_coords[min_indices[i]];
 
-    // Compress blockrays accordingly.
+    // Compress blockrays accordingly, packing them into rows.
+    blockray_words = bit_row_words(n_min_rays);
+    blockray_storage.assign((LOS_MAX_RANGE + 1) * (LOS_MAX_RANGE + 1)
+                            * blockray_words, 0);
+    blockray_table = blockray_storage.data();
     for (quadrant_iterator qi; qi; ++qi)
     {
-        blockrays(*qi) = new bit_vector(n_min_rays);
+        uint64_t *row = const_cast<uint64_t *>(blockrays(*qi));
         for (int i = 0; i < n_min_rays; ++i)
-        {
-            blockrays(*qi)->set(i, all_blockrays(*qi)
-                                   ->get(min_indices[i]));
-        }
+            if (all_blockrays(*qi)->get(min_indices[i]))
+                row[i / 64] |= 1ULL << (i % 64);
     }
 
     // We can throw away all_blockrays now.
     for (quadrant_iterator qi; qi; ++qi)
         delete all_blockrays(*qi);
 
-    dead_rays  = new bit_vector(n_min_rays);
-    smoke_rays = new bit_vector(n_min_rays);
+    _init_ray_rows(n_min_rays);
 
     dprf("Cellrays: %d Fullrays: %u Minimal cellrays: %u",
           n_cellrays, (unsigned int)fullrays.size(), n_min_rays);
@@ -448,15 +494,10 @@ static bool _complexity_lt(const pair<int,int>& lhs, const pair<int,int>& rhs)
 }
 
 // Cast all rays
-static void raycast()
+static void _cast_rays()
 {
-    static bool done_raycast = false;
-    if (done_raycast)
-        return;
-
     // Creating all rays for first quadrant
     // We have a considerable amount of overkill.
-    done_raycast = true;
 
     // register perpendiculars FIRST, to make them top choice
     // when selecting beams
@@ -500,6 +541,428 @@ static void raycast()
     _create_blockrays();
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// On-disk cache of the precomputation.
+//
+// The tables above depend only on the constants at the top of this file
+// and on the ray code, so they are stored in the save directory after
+// the first computation. Every later process maps that file read-only
+// (sharing the pages with all other crawl processes) instead of casting
+// the rays again. Bump LOS_CACHE_VERSION when changing how rays are
+// cast or reduced.
+
+#define LOS_CACHE_VERSION 2
+#define LOS_CACHE_BYTE_ORDER 0x01020304
+
+static const char los_cache_magic[8] =
+    { 'C', 'R', 'A', 'W', 'L', 'L', 'O', 'S' };
+
+struct los_cache_header
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t row_words;     // blockray_words
+    uint32_t max_range;
+    uint32_t max_angle;
+    uint32_t intercept_mult;
+    uint32_t n_fullrays;
+    uint32_t n_ray_coords;
+    uint32_t n_cellrays;
+    uint32_t n_min_cellrays;
+    uint32_t checksum;      // of the payload following the header
+    uint32_t unused[2];
+    uint64_t payload_size;
+};
+
+// Payload records; each section is padded to a multiple of 8 bytes,
+// so that the blockrays table at the end is suitably aligned.
+struct los_cache_ray
+{
+    double   start_x, start_y;
+    double   dir_x, dir_y;
+    uint32_t start;
+    uint32_t length;
+};
+
+struct los_cache_coord
+{
+    int32_t x, y;
+};
+
+struct los_cache_cellray
+{
+    uint32_t fullray;
+    uint32_t end;
+    int32_t  imbalance;
+    uint32_t first_diag;
+};
+
+static const int los_cache_cells = (LOS_MAX_RANGE+1) * (LOS_MAX_RANGE+1);
+
+static size_t _cache_padded(size_t len)
+{
+    return (len + 7) & ~(size_t)7;
+}
+
+static size_t _cache_payload_size(const los_cache_header &hdr)
+{
+    return _cache_padded(hdr.n_fullrays * sizeof(los_cache_ray))
+           + _cache_padded(hdr.n_ray_coords * sizeof(los_cache_coord))
+           + _cache_padded(hdr.n_cellrays * sizeof(los_cache_coord))
+           + _cache_padded((los_cache_cells + 1) * sizeof(uint32_t))
+           + _cache_padded(hdr.n_min_cellrays * sizeof(los_cache_cellray))
+           + los_cache_cells * hdr.row_words * sizeof(uint64_t);
+}
+
+template<typename T>
+static void _cache_append(vector<char> &buf, const T &val)
+{
+    const char *p = reinterpret_cast<const char *>(&val);
+    buf.insert(buf.end(), p, p + sizeof(T));
+}
+
+static void _cache_pad(vector<char> &buf)
+{
+    buf.resize(_cache_padded(buf.size()), 0);
+}
+
+template<typename T>
+static const T *_cache_section(const char *&pos, size_t count)
+{
+    const T *sec = reinterpret_cast<const T *>(pos);
+    pos += _cache_padded(count * sizeof(T));
+    return sec;
+}
+
+// The header for the current precomputation, without the checksum.
+static los_cache_header _cache_header()
+{
+    los_cache_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, los_cache_magic, sizeof(hdr.magic));
+    hdr.version        = LOS_CACHE_VERSION;
+    hdr.byte_order     = LOS_CACHE_BYTE_ORDER;
+    hdr.max_range      = LOS_MAX_RANGE;
+    hdr.max_angle      = LOS_MAX_ANGLE;
+    hdr.intercept_mult = LOS_INTERCEPT_MULT;
+    return hdr;
+}
+
+static bool _cache_header_matches(const los_cache_header &hdr)
+{
+    const los_cache_header cur = _cache_header();
+    return !memcmp(hdr.magic, cur.magic, sizeof(hdr.magic))
+           && hdr.version == cur.version
+           && hdr.byte_order == cur.byte_order
+           && hdr.row_words == (uint32_t)bit_row_words(hdr.n_cellrays)
+           && hdr.max_range == cur.max_range
+           && hdr.max_angle == cur.max_angle
+           && hdr.intercept_mult == cur.intercept_mult;
+}
+
+// Serialise the tables built by _cast_rays(), filling in the counts
+// in hdr.
+static vector<char> _serialise_rays(los_cache_header &hdr)
+{
+    vector<char> buf;
+
+    hdr.n_fullrays = fullrays.size();
+    for (const los_ray &ray : fullrays)
+    {
+        los_cache_ray rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.start_x = ray.r.start.x;
+        rec.start_y = ray.r.start.y;
+        rec.dir_x   = ray.r.dir.x;
+        rec.dir_y   = ray.r.dir.y;
+        rec.start   = ray.start;
+        rec.length  = ray.length;
+        _cache_append(buf, rec);
+    }
+    _cache_pad(buf);
+
+    hdr.n_ray_coords = ray_coords.size();
+    for (const coord_def &c : ray_coords)
+        _cache_append(buf, los_cache_coord { c.x, c.y });
+    _cache_pad(buf);
+
+    hdr.n_cellrays = cellray_ends.size();
+    for (const coord_def &c : cellray_ends)
+        _cache_append(buf, los_cache_coord { c.x, c.y });
+    _cache_pad(buf);
+
+    // Fullrays are registered in order of their start index, so the
+    // fullray a cellray belongs to can be found by bisection.
+    vector<unsigned int> starts;
+    for (const los_ray &ray : fullrays)
+        starts.push_back(ray.start);
+
+    uint32_t n_min = 0;
+    for (quadrant_iterator qi; qi; ++qi)
+    {
+        _cache_append(buf, n_min);
+        n_min += min_cellrays(*qi).size();
+    }
+    _cache_append(buf, n_min);
+    _cache_pad(buf);
+
+    hdr.n_min_cellrays = n_min;
+    for (quadrant_iterator qi; qi; ++qi)
+        for (const cellray &c : min_cellrays(*qi))
+        {
+            auto it = lower_bound(starts.begin(), starts.end(), c.ray.start);
+            ASSERT(it != starts.end() && *it == c.ray.start);
+            los_cache_cellray rec;
+            rec.fullray    = it - starts.begin();
+            rec.end        = c.end;
+            rec.imbalance  = c.imbalance;
+            rec.first_diag = c.first_diag;
+            _cache_append(buf, rec);
+        }
+    _cache_pad(buf);
+
+    hdr.row_words = blockray_words;
+    const char *table = reinterpret_cast<const char *>(blockray_table);
+    buf.insert(buf.end(), table,
+               table + los_cache_cells * blockray_words * sizeof(uint64_t));
+
+    hdr.payload_size = buf.size();
+    ASSERT(hdr.payload_size == _cache_payload_size(hdr));
+    hdr.checksum = hash32(buf.data(), buf.size());
+    return buf;
+}
+
+static string _ray_cache_file()
+{
+    return savedir_versioned_path("los.cache");
+}
+
+// Map the cache file and check that it can be used. Returns the header
+// of the mapping, or nullptr.
+static const los_cache_header *_map_ray_cache(const string &file)
+{
+    size_t size;
+    const void *map = map_file_u(file.c_str(), &size);
+    if (!map)
+        return nullptr;
+
+    const los_cache_header *hdr = static_cast<const los_cache_header *>(map);
+    const char *payload = static_cast<const char *>(map) + sizeof(*hdr);
+    if (size < sizeof(*hdr)
+        || !_cache_header_matches(*hdr)
+        || size - sizeof(*hdr) != hdr->payload_size
+        || hdr->payload_size != _cache_payload_size(*hdr)
+        || hash32(payload, hdr->payload_size) != hdr->checksum)
+    {
+        dprf("Discarding stale or damaged LOS cache %s", file.c_str());
+        unmap_file_u(map, size);
+        return nullptr;
+    }
+
+    ray_cache = map;
+    ray_cache_size = size;
+    return hdr;
+}
+
+static void _unmap_ray_cache()
+{
+    unmap_file_u(ray_cache, ray_cache_size);
+    ray_cache = nullptr;
+    ray_cache_size = 0;
+}
+
+// Fill in the precomputed tables from a mapped cache file. The blockrays
+// table keeps pointing into the mapping.
+static bool _load_ray_cache(const string &file)
+{
+    const los_cache_header *hdr = _map_ray_cache(file);
+    if (!hdr)
+        return false;
+
+    const char *pos = reinterpret_cast<const char *>(hdr + 1);
+    const los_cache_ray *rays =
+        _cache_section<los_cache_ray>(pos, hdr->n_fullrays);
+    const los_cache_coord *coords =
+        _cache_section<los_cache_coord>(pos, hdr->n_ray_coords);
+    const los_cache_coord *ends =
+        _cache_section<los_cache_coord>(pos, hdr->n_cellrays);
+    const uint32_t *min_index =
+        _cache_section<uint32_t>(pos, los_cache_cells + 1);
+    const los_cache_cellray *mins =
+        _cache_section<los_cache_cellray>(pos, hdr->n_min_cellrays);
+    const uint64_t *table = reinterpret_cast<const uint64_t *>(pos);
+
+    // The checksum guards against damage, but not against a cache that
+    // was written by buggy code; don't index out of bounds on one.
+    bool valid = min_index[los_cache_cells] == hdr->n_min_cellrays;
+    for (uint32_t i = 0; valid && i < hdr->n_fullrays; ++i)
+        valid = rays[i].start + rays[i].length <= hdr->n_ray_coords;
+    for (uint32_t i = 0; valid && i < hdr->n_min_cellrays; ++i)
+    {
+        valid = mins[i].fullray < hdr->n_fullrays
+                && mins[i].end < rays[mins[i].fullray].length;
+    }
+    for (int i = 0; valid && i < los_cache_cells; ++i)
+        valid = min_index[i] <= min_index[i + 1];
+    if (!valid)
+    {
+        _unmap_ray_cache();
+        return false;
+    }
+
+    fullrays.clear();
+    for (uint32_t i = 0; i < hdr->n_fullrays; ++i)
+    {
+        los_ray ray(geom::ray(rays[i].start_x, rays[i].start_y,
+                              rays[i].dir_x, rays[i].dir_y));
+        ray.start  = rays[i].start;
+        ray.length = rays[i].length;
+        fullrays.push_back(ray);
+    }
+
+    ray_coords.clear();
+    for (uint32_t i = 0; i < hdr->n_ray_coords; ++i)
+        ray_coords.emplace_back(coords[i].x, coords[i].y);
+
+    cellray_ends.clear();
+    for (uint32_t i = 0; i < hdr->n_cellrays; ++i)
+        cellray_ends.emplace_back(ends[i].x, ends[i].y);
+
+    int cell = 0;
+    for (quadrant_iterator qi; qi; ++qi, ++cell)
+    {
+        vector<cellray> &min = min_cellrays(*qi);
+        min.clear();
+        for (uint32_t i = min_index[cell]; i < min_index[cell + 1]; ++i)
+        {
+            cellray c(fullrays[mins[i].fullray], mins[i].end);
+            c.imbalance  = mins[i].imbalance;
+            c.first_diag = mins[i].first_diag;
+            min.push_back(c);
+        }
+    }
+
+    blockray_words = hdr->row_words;
+    blockray_table = table;
+    _init_ray_rows(hdr->n_cellrays);
+
+    dprf("Loaded LOS precomputation from %s", file.c_str());
+    return true;
+}
+
+static void _write_ray_cache(const string &file)
+{
+    los_cache_header hdr = _cache_header();
+    const vector<char> payload = _serialise_rays(hdr);
+
+    // Write to a temporary file of our own and rename it into place, so
+    // that other processes either see a complete cache or none at all.
+    // Several may race to write it; whichever renames last wins, and all
+    // of them write the same thing.
+    const string tmp = make_stringf("%s.%d.tmp", file.c_str(), getpid());
+    FILE *fp = fopen_replace(tmp.c_str());
+    if (!fp)
+        return;
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1
+              && fwrite(payload.data(), payload.size(), 1, fp) == 1;
+    ok = !fclose(fp) && ok;
+
+    if (!ok || rename_u(tmp.c_str(), file.c_str()))
+        unlink_u(tmp.c_str());
+}
+
+#ifdef DEBUG
+// Compare a freshly cast set of rays with the cache file, replacing
+// the latter if it's stale or missing.
+static void _check_ray_cache(const string &file)
+{
+    los_cache_header hdr = _cache_header();
+    const vector<char> payload = _serialise_rays(hdr);
+
+    const los_cache_header *cached = _map_ray_cache(file);
+    if (!cached)
+    {
+        _write_ray_cache(file);
+        return;
+    }
+
+    const bool same = cached->n_fullrays == hdr.n_fullrays
+                      && cached->n_ray_coords == hdr.n_ray_coords
+                      && cached->n_cellrays == hdr.n_cellrays
+                      && cached->n_min_cellrays == hdr.n_min_cellrays
+                      && cached->payload_size == hdr.payload_size
+                      && !memcmp(cached + 1, payload.data(), payload.size());
+    _unmap_ray_cache();
+
+    if (!same)
+    {
+        die("LOS cache %s doesn't match the ray precomputation; "
+            "LOS_CACHE_VERSION needs to be bumped", file.c_str());
+    }
+}
+#endif
+
+static void _find_blocked_targets()
+{
+    for (quadrant_iterator qi; qi; ++qi)
+    {
+        const uint64_t *row = blockrays(*qi);
+        quadrant_mask &targets = blocked_targets(*qi);
+        targets.reset();
+        for (int w = 0; w < blockray_words; ++w)
+            for (uint64_t bits = row[w]; bits; bits &= bits - 1)
+                targets.set(cellray_ends[w * 64 + bit_lowest_set(bits)]);
+    }
+}
+
+static void raycast()
+{
+    static bool done_raycast = false;
+    if (done_raycast)
+        return;
+    done_raycast = true;
+
+    const string file = _ray_cache_file();
+#ifdef DEBUG
+    // Debug builds always cast the rays, to check the cache against them.
+    _cast_rays();
+    _check_ray_cache(file);
+#else
+    if (!_load_ray_cache(file))
+    {
+        _cast_rays();
+        _write_ray_cache(file);
+    }
+#endif
+    _find_blocked_targets();
+}
+
+/**
+ * Can changing the opacity of one cell change whether a viewer sees
+ * another? This is the case iff some minimal cellray from the viewer to
+ * the target passes through the cell.
+ *
+ * @param blocker The changed cell, relative to the viewer.
+ * @param target  The target cell, relative to the viewer.
+ */
+bool los_cell_affects(const coord_def& blocker, const coord_def& target)
+{
+    if (blocker.rdist() > LOS_MAX_RANGE || target.rdist() > LOS_MAX_RANGE)
+        return false;
+
+    // Both have to lie in a common quadrant; cells on the axes belong
+    // to two of them.
+    if (blocker.x * target.x < 0 || blocker.y * target.y < 0)
+        return false;
+
+    raycast();
+    const coord_def b(abs(blocker.x), abs(blocker.y));
+    const coord_def t(abs(target.x), abs(target.y));
+    return blocked_targets(b).get(t);
+}
+
 static int _imbalance(ray_def ray, const coord_def& target)
 {
     int imb = 0;
@@ -781,16 +1244,22 @@ bool cell_see_cell_nocache(const coord_def& p1, const coord_def& p2)
 // after removing duplicates. That means that we need to do
 // around 22*100*4 ~ 9,000 memory reads + writes per LOS call on a
 // 32-bit system. Not too bad.
+// The blockrays rows are packed into 64-bit words and combined with
+// 256-bit operations where the CPU has them, so each opaque cell
+// costs only a few wide ORs.
 // IMPROVEMENTS:
 // Smoke will now only block LOS after two cells of smoke. This is
 // done by updating with a second array.
 
 static void _losight_quadrant(los_grid& sh, const los_param& dat, int sx, int sy)
 {
-    const unsigned int num_cellrays = cellray_ends.size();
+    const int nwords = blockray_words;
+    uint64_t *dead  = dead_rays.data();
+    uint64_t *smoke = smoke_rays.data();
+    uint64_t *alive = alive_rays.data();
 
-    dead_rays->reset();
-    smoke_rays->reset();
+    memset(dead, 0, nwords * sizeof(uint64_t));
+    memset(smoke, 0, nwords * sizeof(uint64_t));
 
     for (quadrant_iterator qi; qi; ++qi)
     {
@@ -802,12 +1271,12 @@ static void _losight_quadrant(los_grid& sh, const los_param& dat, int sx, int sy
         {
         case OPC_OPAQUE:
             // Block the appropriate rays.
-            *dead_rays |= *blockrays(*qi);
+            bit_row_or(dead, blockrays(*qi), nwords);
             break;
         case OPC_HALF:
             // Block rays which have already seen a cloud.
-            *dead_rays  |= (*smoke_rays & *blockrays(*qi));
-            *smoke_rays |= *blockrays(*qi);
+            bit_row_or_and(dead, smoke, blockrays(*qi), nwords);
+            bit_row_or(smoke, blockrays(*qi), nwords);
             break;
         default:
             break;
@@ -816,12 +1285,13 @@ static void _losight_quadrant(los_grid& sh, const los_param& dat, int sx, int sy
 
     // Ray calculation done. Now work out which cells in this
     // quadrant are visible.
-    for (unsigned int rayidx = 0; rayidx < num_cellrays; ++rayidx)
+    bit_row_andnot(alive, all_rays.data(), dead, nwords);
+    for (int w = 0; w < nwords; ++w)
     {
-        // make the cells seen by this ray at this point visible
-        if (!dead_rays->get(rayidx))
+        for (uint64_t bits = alive[w]; bits; bits &= bits - 1)
         {
             // This ray is alive, thus the end cell is visible.
+            const int rayidx = w * 64 + bit_lowest_set(bits);
             const coord_def p = coord_def(sx * cellray_ends[rayidx].x,
                                           sy * cellray_ends[rayidx].y);
             if (dat.los_bounds(p))
@@ -893,6 +1363,7 @@ opacity_type mons_opacity(const monster* mon, los_type how)
 static void _handle_los_change()
 {
     invalidate_agrid();
+    invalidate_shared_pathfind();
 }
 
 static bool _mons_block_sight(const monster* mons)
@@ -38,6 +38,7 @@ int num_feats_between(const coord_def& source, const coord_def& target,
                       bool exclude_endpoints = true,
                       bool just_check = false);
 bool cell_see_cell_nocache(const coord_def& p1, const coord_def& p2);
+bool los_cell_affects(const coord_def& blocker, const coord_def& target);
 
 typedef SquareArray<bool, LOS_MAX_RANGE> los_grid;
 
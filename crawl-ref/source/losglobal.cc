@@ -5,32 +5,207 @@
 #include "coord.h"
 #include "coordit.h"
 #include "libutil.h"
+#include "los.h"
 #include "los_def.h"
 
 #define LOS_KNOWN 4
 
+// For each pair of cells in range of each other, we remember for each
+// los_type whether it's known and whether the cells see each other.
+// The pair (p, q) with p < q is stored at p, in the slot for q - p.
 typedef uint8_t losfield_t;
-typedef losfield_t halflos_t[LOS_MAX_RANGE+1][2*LOS_MAX_RANGE+1];
 static const int o_half_x = 0;
 static const int o_half_y = LOS_MAX_RANGE;
+static const int half_height = 2 * LOS_MAX_RANGE + 1;
+static const int pairs_per_cell = (LOS_MAX_RANGE + 1) * half_height;
+
+static coord_def _slot_offset(int slot)
+{
+    return coord_def(slot / half_height - o_half_x,
+                     slot % half_height - o_half_y);
+}
+
+#ifdef COMPACT_GLOBALLOS
+// Only cells that have been looked at get a block, and all blocks are
+// freed by invalidate_los(), so a process only pays for the part of the
+// level that it actually uses. A block has a plane holding two bits per
+// pair (known, then visible) for each los_type that has been asked about
+// at that cell; word 0 of the block is the mask of those types, and the
+// planes follow in order of type.
+static const int n_los_types = LOS_KNOWN; // LOS_DEFAULT .. LOS_SOLID_SEE
+static const int plane_words = (2 * pairs_per_cell + 63) / 64;
+
+static uint64_t *globallos[GXM][GYM];
+static size_t globallos_words = 0;
+
+static bool _has_pairs(const coord_def& p)
+{
+    return globallos[p.x][p.y];
+}
+
+static int _count_types(uint64_t mask)
+{
+    int n = 0;
+    for (; mask; mask &= mask - 1)
+        ++n;
+    return n;
+}
+
+static uint64_t *_plane(uint64_t *block, int type)
+{
+    return block + 1 + _count_types(block[0] & ((1 << type) - 1))
+                       * plane_words;
+}
+
+static losfield_t _get_flags(const coord_def& p, int slot)
+{
+    uint64_t *block = globallos[p.x][p.y];
+    if (!block)
+        return 0;
+
+    const int word = 2 * slot / 64;
+    const int shift = 2 * slot % 64;
+    losfield_t flags = 0;
+    for (int t = 0; t < n_los_types; ++t)
+    {
+        if (!(block[0] & (1 << t)))
+            continue;
+        const uint64_t bits = _plane(block, t)[word] >> shift;
+        if (bits & 1)
+            flags |= (1 << t) << LOS_KNOWN;
+        if (bits & 2)
+            flags |= 1 << t;
+    }
+    return flags;
+}
+
+// Add a plane for type t to the block of cell p.
+static uint64_t *_add_plane(const coord_def& p, int t)
+{
+    uint64_t *old = globallos[p.x][p.y];
+    const int nold = old ? _count_types(old[0]) : 0;
+    uint64_t *block = new uint64_t[1 + (nold + 1) * plane_words]();
+    block[0] = (old ? old[0] : 0) | (1 << t);
+    for (int u = 0; u < n_los_types; ++u)
+    {
+        if (u != t && (block[0] & (1 << u)))
+        {
+            memcpy(_plane(block, u), _plane(old, u),
+                   plane_words * sizeof(uint64_t));
+        }
+    }
+
+    delete[] old;
+    globallos[p.x][p.y] = block;
+    globallos_words += plane_words + (old ? 0 : 1);
+    return block;
+}
+
+static void _set_flags(const coord_def& p, int slot, losfield_t flags)
+{
+    uint64_t *block = globallos[p.x][p.y];
+
+    const int word = 2 * slot / 64;
+    const int shift = 2 * slot % 64;
+    for (int t = 0; t < n_los_types; ++t)
+    {
+        uint64_t bits = 0;
+        if (flags & ((1 << t) << LOS_KNOWN))
+            bits |= 1;
+        if (flags & (1 << t))
+            bits |= 2;
+        if (!block || !(block[0] & (1 << t)))
+        {
+            if (!bits)
+                continue;
+            block = _add_plane(p, t);
+        }
+        uint64_t &w = _plane(block, t)[word];
+        w = (w & ~(3ULL << shift)) | bits << shift;
+    }
+}
+
+static void _clear_pairs(const coord_def& p)
+{
+    uint64_t *&block = globallos[p.x][p.y];
+    if (block)
+    {
+        globallos_words -= 1 + _count_types(block[0]) * plane_words;
+        delete[] block;
+        block = nullptr;
+    }
+}
+
+size_t globallos_memory_use()
+{
+    return sizeof(globallos) + globallos_words * sizeof(uint64_t);
+}
+#else
+typedef losfield_t halflos_t[pairs_per_cell];
 typedef halflos_t globallos_t[GXM][GYM];
 
 static globallos_t globallos;
 
-static losfield_t* _lookup_globallos(const coord_def& p, const coord_def& q)
+static bool _has_pairs(const coord_def& p)
+{
+    return true;
+}
+
+static losfield_t _get_flags(const coord_def& p, int slot)
+{
+    return globallos[p.x][p.y][slot];
+}
+
+static void _set_flags(const coord_def& p, int slot, losfield_t flags)
+{
+    globallos[p.x][p.y][slot] = flags;
+}
+
+static void _clear_pairs(const coord_def& p)
+{
+    memset(globallos[p.x][p.y], 0, sizeof(halflos_t));
+}
+
+size_t globallos_memory_use()
+{
+    return sizeof(globallos);
+}
+#endif
+
+static globallos_stats stats;
+
+const globallos_stats &get_globallos_stats()
+{
+    return stats;
+}
+
+void reset_globallos_stats()
+{
+    stats = globallos_stats();
+}
+
+// Find where the pair (p, q) is stored. Returns false if the cells are
+// out of range.
+static bool _lookup_globallos(const coord_def& p, const coord_def& q,
+                              coord_def& base, int& slot)
 {
     COMPILE_CHECK(LOS_KNOWN * 2 <= sizeof(losfield_t) * 8);
 
     if (!map_bounds(p) || !map_bounds(q))
-        return nullptr;
+        return false;
     coord_def diff = q - p;
     if (diff.rdist() > LOS_RADIUS)
-        return nullptr;
+        return false;
     // p < q iff p.x < q.x || p.x == q.x && p.y < q.y
     if (diff < coord_def(0, 0))
-        return &globallos[q.x][q.y][-diff.x + o_half_x][-diff.y + o_half_y];
+    {
+        base = q;
+        diff = -diff;
+    }
     else
-        return &globallos[p.x][p.y][ diff.x + o_half_x][ diff.y + o_half_y];
+        base = p;
+    slot = (diff.x + o_half_x) * half_height + diff.y + o_half_y;
+    return true;
 }
 
 static void _save_los(los_def* los, los_type l)
@@ -47,33 +222,63 @@ static void _save_los(los_def* los, los_type l)
                 continue;
 
             coord_def ri(x, y);
-            losfield_t* flags = _lookup_globallos(o, ri);
-            if (!flags)
+            coord_def base;
+            int slot;
+            if (!_lookup_globallos(o, ri, base, slot))
                 continue;
-            *flags |= l << LOS_KNOWN;
+            losfield_t flags = _get_flags(base, slot);
+            flags |= l << LOS_KNOWN;
             if (los->see_cell(ri))
-                *flags |= l;
+                flags |= l;
             else
-                *flags &= ~l;
+                flags &= ~l;
+            _set_flags(base, slot, flags);
         }
 }
 
-// Opacity at p has changed.
+// Opacity at p has changed. Forget only those pairs that have a
+// cellray passing through p; all others are still valid.
 void invalidate_los_around(const coord_def& p)
 {
+    ++stats.local_invalidations;
+
+    // The pair (o, o + d) is stored at o, with o < o + d; p can only
+    // lie between the two if o.x <= p.x <= o.x + d.x.
     int x1 = max(p.x - LOS_MAX_RANGE, 0);
     int y1 = max(p.y - LOS_MAX_RANGE, 0);
     int x2 = min(p.x, GXM - 1);
     int y2 = min(p.y + LOS_MAX_RANGE, GYM - 1);
     for (int y = y1; y <= y2; y++)
         for (int x = x1; x <= x2; x++)
-            memset(globallos[x][y], 0, sizeof(halflos_t));
+        {
+            const coord_def base(x, y);
+            if (!_has_pairs(base))
+                continue;
+
+            const coord_def blocker = p - base;
+            for (int slot = 0; slot < pairs_per_cell; slot++)
+            {
+                if (!_get_flags(base, slot))
+                    continue;
+                // The pair may have been computed from either end.
+                const coord_def target = _slot_offset(slot);
+                if (los_cell_affects(blocker, target)
+                    || los_cell_affects(blocker - target, -target))
+                {
+                    _set_flags(base, slot, 0);
+                    ++stats.pairs_dropped;
+                }
+                else
+                    ++stats.pairs_kept;
+            }
+        }
 }
 
 void invalidate_los()
 {
+    ++stats.full_invalidations;
     for (rectangle_iterator ri(0); ri; ++ri)
-        memset(globallos[ri->x][ri->y], 0, sizeof(halflos_t));
+        _clear_pairs(*ri);
 }
 
 static void _update_globallos_at(const coord_def& p, los_type l)
@@ -118,17 +323,24 @@ bool cell_see_cell(const coord_def& p, const coord_def& q, los_type l)
     if (l == LOS_NONE)
         return true;
 
-    losfield_t* flags = _lookup_globallos(p, q);
-
-    if (!flags)
+    coord_def base;
+    int slot;
+    if (!_lookup_globallos(p, q, base, slot))
         return false; // outside range
 
-    if (!(*flags & (l << LOS_KNOWN)))
+    losfield_t flags = _get_flags(base, slot);
+    if (!(flags & (l << LOS_KNOWN)))
+    {
+        ++stats.misses;
         _update_globallos_at(p, l);
+        flags = _get_flags(base, slot);
+    }
+    else
+        ++stats.hits;
 
-    //if (!(*flags & (l << LOS_KNOWN)))
+    //if (!(flags & (l << LOS_KNOWN)))
     //    die("cell_see_cell %d,%d %d,%d", p.x,p.y,q.x,q.y);
-    ASSERT(*flags & (l << LOS_KNOWN));
+    ASSERT(flags & (l << LOS_KNOWN));
 
-    return *flags & l;
+    return flags & l;
 }
@@ -6,4 +6,18 @@ void invalidate_los();
 
 bool cell_see_cell(const coord_def& p, const coord_def& q, los_type l);
 
+struct globallos_stats
+{
+    uint64_t hits;              // cell_see_cell() answered from the table
+    uint64_t misses;            // ... that had to compute a los_def
+    uint64_t local_invalidations;
+    uint64_t pairs_kept;        // known pairs not affected by those
+    uint64_t pairs_dropped;     // known pairs that were
+    uint64_t full_invalidations;
+};
+
+const globallos_stats &get_globallos_stats();
+void reset_globallos_stats();
+size_t globallos_memory_use();
+
 #endif
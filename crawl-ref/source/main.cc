@@ -499,6 +499,7 @@ static void _show_commandline_options_help()
     puts("  -macro <dir>          directory to save/find macro.txt");
     puts("  -version              Crawl version (and compilation info)");
     puts("  -save-version <name>  Save file version for the given player");
+    puts("  -compact-saves [N]    rewrite saves with N% or more unused space");
     puts("  -sprint               select Sprint");
     puts("  -sprint-map <name>    preselect a Sprint map");
     puts("  -tutorial             select the Tutorial");
@@ -554,6 +555,11 @@ static void _show_commandline_options_help()
     puts("      Defaults to entire dungeon; same level syntax as -mapstat.");
     puts("  -iters <num>        For -mapstat and -objstat, set the number of "
          "iterations");
+#ifdef UNIX
+    puts("  -jobs <num>         For -mapstat and -objstat, share the "
+         "iterations between");
+    puts("      <num> processes");
+#endif
 #endif
     puts("");
     puts("Miscellaneous options:");
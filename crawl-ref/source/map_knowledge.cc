@@ -10,6 +10,7 @@
 #include "notes.h"
 #include "religion.h"
 #include "terrain.h"
+#include "travel.h"
 #ifdef USE_TILE
  #include "tilepick.h"
  #include "tileview.h"
@@ -21,6 +22,7 @@ void set_terrain_mapped(const coord_def gc)
     map_cell* cell = &env.map_knowledge(gc);
     cell->flags &= (~MAP_CHANGED_FLAG);
     cell->flags |= MAP_MAGIC_MAPPED_FLAG;
+    travel_cell_changed(gc);
 #ifdef USE_TILE
     tiles.update_minimap(gc);
 #endif
@@ -66,6 +68,7 @@ void clear_map(bool clear_items, bool clear_mons)
         tile_reset_fg(p);
 #endif
     }
+    travel_forget_routes();
 }
 
 static void _automap_from(int x, int y, int mutated)
@@ -231,6 +234,7 @@ void update_cloud_knowledge()
         {
             if (env.map_knowledge[x][y].update_cloud_state())
             {
+                travel_cell_changed({x, y});
 #ifdef USE_TILE
                 tile_draw_map_cell({x, y}, true);
 #endif
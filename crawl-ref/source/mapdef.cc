@@ -2146,6 +2146,14 @@ bool depth_ranges::is_usable_in(const level_id &lid) const
     return any_matched;
 }
 
+bool depth_ranges::may_include(branch_type br) const
+{
+    for (const level_range &lr : depths)
+        if (!lr.deny && (lr.branch == br || lr.branch == NUM_BRANCHES))
+            return true;
+    return false;
+}
+
 void depth_ranges::add_depths(const depth_ranges &other_depths)
 {
     depths.insert(depths.end(),
@@ -2405,6 +2413,22 @@ void map_def::load()
     if (!index_only)
         return;
 
+    // Usually the definitions were mapped along with the index.
+    size_t size;
+    if (const unsigned char *dsc = mapped_des_cache(cache_name, &size))
+    {
+        if (cache_offset <= 0 || (size_t) cache_offset >= size)
+        {
+            throw map_load_exception(
+                    make_stringf("Map offset is invalid: %s", name.c_str()));
+        }
+        reader inf(dsc + cache_offset, size - cache_offset,
+                   TAG_MINOR_VERSION);
+        read_full(inf, true);
+        index_only = false;
+        return;
+    }
+
     const string descache_base = get_descache_path(cache_name, "");
     file_lock deslock(descache_base + ".lk", "rb", false);
     const string loadfile = descache_base + ".dsc";
@@ -2516,7 +2540,7 @@ string map_def::run_lua(bool run_main)
 {
     dlua_set_map mset(this);
 
-    int err = prelude.load(dlua);
+    int err = prelude.load(dlua, true);
     if (err == E_CHUNK_LOAD_FAILURE)
         lua_pushnil(dlua);
     else if (err)
@@ -2527,7 +2551,7 @@ string map_def::run_lua(bool run_main)
     if (run_main)
     {
         // Run the map chunk to set up the vault's map grid.
-        err = mapchunk.load(dlua);
+        err = mapchunk.load(dlua, true);
         if (err == E_CHUNK_LOAD_FAILURE)
             lua_pushnil(dlua);
         else if (err)
@@ -2542,7 +2566,7 @@ string map_def::run_lua(bool run_main)
 
         // Run the main Lua chunk to set up the rest of the vault
         run_hook("pre_main");
-        err = main.load(dlua);
+        err = main.load(dlua, true);
         if (err == E_CHUNK_LOAD_FAILURE)
             lua_pushnil(dlua);
         else if (err)
@@ -2600,7 +2624,7 @@ bool map_def::test_lua_boolchunk(dlua_chunk &chunk, bool defval,
     bool result = defval;
     dlua_set_map mset(this);
 
-    int err = chunk.load(dlua);
+    int err = chunk.load(dlua, true);
     if (err == E_CHUNK_LOAD_FAILURE)
         return result;
     else if (err)
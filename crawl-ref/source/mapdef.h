@@ -970,6 +970,8 @@ public:
     void clear() { depths.clear(); }
     bool empty() const { return depths.empty(); }
     bool is_usable_in(const level_id &lid) const;
+    // Whether is_usable_in() could be true for some level in the branch.
+    bool may_include(branch_type br) const;
     void add_depth(const level_range &range) { depths.push_back(range); }
     void add_depths(const depth_ranges &other_ranges);
     string describe() const;
@@ -1215,6 +1217,8 @@ public:
     string validate_temple_map();
     // Returns true if this map is in the middle of validation.
     bool is_validating() const { return validating_map_flag; }
+    // Returns true if the full definition is in memory, not just the index.
+    bool is_loaded() const { return !index_only; }
 
     void add_prelude_line(int line,  const string &s);
     void add_main_line(int line, const string &s);
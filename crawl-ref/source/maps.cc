@@ -8,6 +8,7 @@
 #include "maps.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <sys/param.h>
@@ -16,6 +17,7 @@
 #include <unistd.h>
 #endif
 
+#include "bitary.h"
 #include "branch.h"
 #include "coord.h"
 #include "coordit.h"
@@ -687,6 +689,151 @@ static bool _map_matches_species(const map_def &map)
            + lowercase_string(get_species_abbrev(you.species)));
 }
 
+// Some tagged maps cannot be selected as random maps in a specific depth.
+static bool _map_randomly_selectable(const map_def &mapdef)
+{
+    return !mapdef.has_tag_suffix("entry")
+           && !mapdef.has_tag("unrand")
+           && !mapdef.has_tag("place_unique")
+           && !mapdef.has_tag("tutorial")
+           && (!mapdef.has_tag_prefix("temple_")
+               || mapdef.has_tag_prefix("uniq_altar_"));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Map index
+//
+// Looking maps up by tag or depth means testing every map with
+// map_selector::accept(), which matches tags by searching strings. The
+// index keeps masks of the maps with each tag, and of the maps that can be
+// used in each branch, so that lookups can intersect those first and test
+// only the maps that are left. accept() still has the final word, so a mask
+// may include maps it would reject, but must never leave one out.
+
+// A bit for each map in vdefs.
+typedef vector<uint64_t> vault_mask;
+
+struct vault_index
+{
+    vault_index() : nmaps(0) { }
+
+    size_t nmaps;
+    vault_mask none;
+    map<string, vault_mask> tags;
+    // Maps with a PLACE.
+    vault_mask placed;
+    // Maps that _map_randomly_selectable() allows.
+    vault_mask random;
+    // Maps with a DEPTH in each branch, or in any branch.
+    vault_mask branches[NUM_BRANCHES];
+};
+
+static vault_index vindex;
+
+static void _build_map_index()
+{
+    vindex = vault_index();
+    vindex.nmaps = vdefs.size();
+    vindex.none.assign((vdefs.size() + 63) / 64, 0);
+    vindex.placed = vindex.random = vindex.none;
+    for (vault_mask &mask : vindex.branches)
+        mask = vindex.none;
+
+    for (unsigned i = 0, size = vdefs.size(); i < size; ++i)
+    {
+        const map_def &mapdef = vdefs[i];
+        const unsigned word = i / 64;
+        const uint64_t bit = 1ULL << (i % 64);
+
+        for (const string &tag : mapdef.get_tags())
+        {
+            vault_mask &mask = vindex.tags[tag];
+            if (mask.empty())
+                mask = vindex.none;
+            mask[word] |= bit;
+        }
+
+        if (!mapdef.place.empty())
+            vindex.placed[word] |= bit;
+        if (_map_randomly_selectable(mapdef))
+            vindex.random[word] |= bit;
+        for (int br = 0; br < NUM_BRANCHES; ++br)
+            if (mapdef.depths.may_include(static_cast<branch_type>(br)))
+                vindex.branches[br][word] |= bit;
+    }
+}
+
+// Maps added since the index was built (by read_map() in the middle of a
+// game, say) bring it up to date.
+static const vault_index &_map_index()
+{
+    if (vindex.nmaps != vdefs.size())
+        _build_map_index();
+    return vindex;
+}
+
+static const vault_mask &_maps_with_tag(const string &tag)
+{
+    const vault_index &index = _map_index();
+    const vault_mask *mask = map_find(index.tags, tag);
+    return mask ? *mask : index.none;
+}
+
+static void _mask_and(vault_mask &mask, const vault_mask &other,
+                      bool invert = false)
+{
+    const uint64_t flip = invert ? ~0ULL : 0;
+    for (unsigned i = 0, size = mask.size(); i < size; ++i)
+        mask[i] &= other[i] ^ flip;
+}
+
+// The maps with all of the space-separated tags, as map_def::has_tag()
+// would find them.
+static vault_mask _maps_with_tags(const string &tags)
+{
+    const vector<string> wanted = split_string(" ", tags);
+    if (wanted.empty())
+        return _map_index().none;
+
+    vault_mask mask = _maps_with_tag(wanted[0]);
+    for (unsigned i = 1, size = wanted.size(); i < size; ++i)
+        _mask_and(mask, _maps_with_tag(wanted[i]));
+    return mask;
+}
+
+typedef vector<unsigned> vault_indices;
+
+// The indices of the maps in a mask, in order.
+static vault_indices _masked_maps(const vault_mask &mask)
+{
+    vault_indices maps;
+    for (unsigned word = 0, size = mask.size(); word < size; ++word)
+        for (uint64_t bits = mask[word]; bits; bits &= bits - 1)
+            maps.push_back(word * 64 + bit_lowest_set(bits));
+    return maps;
+}
+
+#ifdef DEBUG_STATISTICS
+// Times a map lookup for mapstat.
+class map_lookup_timer
+{
+public:
+    map_lookup_timer() : start(chrono::steady_clock::now()) { }
+    ~map_lookup_timer()
+    {
+        if (crawl_state.map_stat_gen)
+        {
+            const chrono::nanoseconds elapsed =
+                chrono::steady_clock::now() - start;
+            mapstat_report_map_lookup(elapsed.count());
+        }
+    }
+
+private:
+    chrono::steady_clock::time_point start;
+};
+#endif
+
 const map_def *find_map_by_name(const string &name)
 {
     for (const map_def &mapdef : vdefs)
@@ -697,11 +844,13 @@ const map_def *find_map_by_name(const string &name)
 }
 
 // Discards Lua code loaded by all maps to reduce memory use. If any stripped
-// map is reused, its data will be reloaded from the .dsc
+// map is reused, its data will be reloaded from the .dsc, and its functions
+// loaded again.
 void strip_all_maps()
 {
     for (map_def &mapdef : vdefs)
         mapdef.strip();
+    dlua_chunk::forget_loaded(dlua);
 }
 
 vector<string> find_map_matches(const string &name)
@@ -718,11 +867,15 @@ mapref_vector find_maps_for_tag(const string &tag,
                                 bool check_depth,
                                 bool check_used)
 {
+#ifdef DEBUG_STATISTICS
+    map_lookup_timer timer;
+#endif
     mapref_vector maps;
     level_id place = level_id::current();
 
-    for (const map_def &mapdef : vdefs)
+    for (unsigned i : _masked_maps(_maps_with_tags(tag)))
     {
+        const map_def &mapdef = vdefs[i];
         if (mapdef.has_tag(tag)
             && !mapdef.has_tag("dummy")
             && (!check_depth || !mapdef.has_depth()
@@ -748,6 +901,7 @@ private:
 
 public:
     bool accept(const map_def &md) const;
+    vault_mask candidates() const;
     void announce(const map_def *map) const;
 
     bool valid() const
@@ -819,14 +973,7 @@ public:
 bool map_selector::depth_selectable(const map_def &mapdef) const
 {
     return mapdef.is_usable_in(place)
-           // Some tagged levels cannot be selected as random
-           // maps in a specific depth:
-           && !mapdef.has_tag_suffix("entry")
-           && !mapdef.has_tag("unrand")
-           && !mapdef.has_tag("place_unique")
-           && !mapdef.has_tag("tutorial")
-           && (!mapdef.has_tag_prefix("temple_")
-               || mapdef.has_tag_prefix("uniq_altar_"))
+           && _map_randomly_selectable(mapdef)
            && _map_matches_species(mapdef)
            && (!check_layout || _map_matches_layout_type(mapdef));
 }
@@ -890,6 +1037,33 @@ bool map_selector::accept(const map_def &mapdef) const
     }
 }
 
+// The maps that accept() might take, from the index.
+vault_mask map_selector::candidates() const
+{
+    const vault_index &index = _map_index();
+    vault_mask mask;
+
+    switch (sel)
+    {
+    case PLACE:
+        mask = index.placed;
+        break;
+
+    case DEPTH:
+    case DEPTH_AND_CHANCE:
+        mask = index.random;
+        _mask_and(mask, index.branches[place.branch]);
+        break;
+
+    case TAG:
+        return _maps_with_tags(tag);
+    }
+
+    if (sel != DEPTH_AND_CHANCE)
+        _mask_and(mask, _maps_with_tag("minivault"), !mini);
+    return mask;
+}
+
 void map_selector::announce(const map_def *vault) const
 {
 #ifdef DEBUG_DIAGNOSTICS
@@ -928,15 +1102,16 @@ string vault_chance_tag(const map_def &map)
     return "";
 }
 
-typedef vector<unsigned> vault_indices;
-
 static vault_indices _eligible_maps_for_selector(const map_selector &sel)
 {
+#ifdef DEBUG_STATISTICS
+    map_lookup_timer timer;
+#endif
     vault_indices eligible;
 
     if (sel.valid())
     {
-        for (unsigned i = 0, size = vdefs.size(); i < size; ++i)
+        for (unsigned i : _masked_maps(sel.candidates()))
             if (sel.accept(vdefs[i]))
                 eligible.push_back(i);
     }
@@ -1250,34 +1425,64 @@ static bool _verify_map_full(const string &base, time_t mtime)
     return verify_file_version(base + ".dsc", mtime);
 }
 
-static bool _load_map_index(const string& cache, const string &base,
-                            time_t mtime)
+// The compiled definitions (.dsc) of every des file whose cache is in use,
+// mapped read-only. Games sharing a cache directory share these pages, and
+// only the definitions of maps that are actually placed get paged in. The
+// cache files are replaced by renaming, never rewritten in place, so a
+// mapping goes on seeing the file it was made from even if another process
+// regenerates it. Windows won't rename over a file that is mapped, so there
+// the definitions are read from the file as they are needed instead.
+struct des_cache_map
 {
-    // If there's a global prelude, load that first.
-    if (FILE *fp = fopen_u((base + ".lux").c_str(), "rb"))
-    {
-        reader inf(fp, TAG_MINOR_VERSION);
-        uint8_t major = unmarshallUByte(inf);
-        uint8_t minor = unmarshallUByte(inf);
-        int8_t word = unmarshallByte(inf);
-        int64_t t = unmarshallSigned(inf);
-        if (major != TAG_MAJOR_VERSION || minor > TAG_MINOR_VERSION
-            || word != WORD_LEN || t != mtime)
-        {
-            return false;
-        }
+    const void *addr;
+    size_t size;
+};
+static map<string, des_cache_map> des_cache_maps;
 
-        lc_global_prelude.read(inf);
-        fclose(fp);
+static void _unmap_des_cache(const string &cache)
+{
+    auto it = des_cache_maps.find(cache);
+    if (it == des_cache_maps.end())
+        return;
+    unmap_file_u(it->second.addr, it->second.size);
+    des_cache_maps.erase(it);
+}
 
-        global_preludes.push_back(lc_global_prelude);
-    }
+// Must be called with the cache lock held, so that the definitions match
+// the index they were loaded with. If the file can't be mapped,
+// map_def::load() reads it instead.
+static void _map_des_cache(const string &cache, const string &base)
+{
+    _unmap_des_cache(cache);
 
-    FILE* fp = fopen_u((base + ".idx").c_str(), "rb");
-    if (!fp)
-        end(1, true, "Unable to read %s", (base + ".idx").c_str());
+#ifndef TARGET_OS_WINDOWS
+    des_cache_map dsc;
+    dsc.addr = map_file_u((base + ".dsc").c_str(), &dsc.size);
+    if (dsc.addr)
+        des_cache_maps[cache] = dsc;
+#else
+    UNUSED(base);
+#endif
+}
+
+static void _unmap_des_caches()
+{
+    for (const auto &entry : des_cache_maps)
+        unmap_file_u(entry.second.addr, entry.second.size);
+    des_cache_maps.clear();
+}
+
+const unsigned char *mapped_des_cache(const string &cache, size_t *size)
+{
+    const des_cache_map *dsc = map_find(des_cache_maps, cache);
+    if (!dsc)
+        return nullptr;
+    *size = dsc->size;
+    return static_cast<const unsigned char *>(dsc->addr);
+}
 
-    reader inf(fp, TAG_MINOR_VERSION);
+static bool _read_map_index(reader &inf, const string &cache, time_t mtime)
+{
     // Re-check version, might have been modified in the meantime.
     uint8_t major = unmarshallUByte(inf);
     uint8_t minor = unmarshallUByte(inf);
@@ -1309,11 +1514,61 @@ static bool _load_map_index(const string& cache, const string &base,
         lc_loaded_maps[vdef.name] = vdef.place_loaded_from;
         vdef.place_loaded_from.clear();
     }
-    fclose(fp);
 
     return true;
 }
 
+static bool _load_map_index(const string& cache, const string &base,
+                            time_t mtime)
+{
+    // If there's a global prelude, load that first.
+    if (FILE *fp = fopen_u((base + ".lux").c_str(), "rb"))
+    {
+        reader inf(fp, TAG_MINOR_VERSION);
+        uint8_t major = unmarshallUByte(inf);
+        uint8_t minor = unmarshallUByte(inf);
+        int8_t word = unmarshallByte(inf);
+        int64_t t = unmarshallSigned(inf);
+        if (major != TAG_MAJOR_VERSION || minor > TAG_MINOR_VERSION
+            || word != WORD_LEN || t != mtime)
+        {
+            return false;
+        }
+
+        lc_global_prelude.read(inf);
+        fclose(fp);
+
+        global_preludes.push_back(lc_global_prelude);
+    }
+
+    // The index is read in full at startup; reading it from a mapping
+    // spares a stdio call per byte.
+    const string idxfile = base + ".idx";
+    bool loaded;
+    size_t size;
+    if (const void *idx = map_file_u(idxfile.c_str(), &size))
+    {
+        reader inf(static_cast<const unsigned char *>(idx), size,
+                   TAG_MINOR_VERSION);
+        loaded = _read_map_index(inf, cache, mtime);
+        unmap_file_u(idx, size);
+    }
+    else
+    {
+        FILE* fp = fopen_u(idxfile.c_str(), "rb");
+        if (!fp)
+            end(1, true, "Unable to read %s", idxfile.c_str());
+
+        reader inf(fp, TAG_MINOR_VERSION);
+        loaded = _read_map_index(inf, cache, mtime);
+        fclose(fp);
+    }
+
+    if (loaded)
+        _map_des_cache(cache, base);
+    return loaded;
+}
+
 static bool _load_map_cache(const string &filename, const string &cachename)
 {
     _check_des_index_dir();
@@ -1354,13 +1609,29 @@ static void _write_map_prelude(const string &filebase, time_t mtime)
     fclose(fp);
 }
 
-static void _write_map_full(const string &filebase, size_t vs, size_t ve,
+// Other games may have the old file mapped; renaming leaves their mapping
+// intact, where rewriting it would pull it out from under them. If the file
+// can't be replaced, the old one is left alone: its timestamp no longer
+// matches the des file, so it won't be used, and this game keeps its maps
+// in memory instead.
+static bool _replace_cache_file(const string &tmpfile, const string &file)
+{
+    if (!rename_u(tmpfile.c_str(), file.c_str()))
+        return true;
+
+    dprf("Unable to replace %s", file.c_str());
+    unlink_u(tmpfile.c_str());
+    return false;
+}
+
+static bool _write_map_full(const string &filebase, size_t vs, size_t ve,
                             time_t mtime)
 {
     const string cfile = filebase + ".dsc";
-    FILE *fp = fopen_u(cfile.c_str(), "wb");
+    const string tmpfile = cfile + ".tmp";
+    FILE *fp = fopen_u(tmpfile.c_str(), "wb");
     if (!fp)
-        end(1, true, "Unable to open %s for writing", cfile.c_str());
+        end(1, true, "Unable to open %s for writing", tmpfile.c_str());
 
     writer outf(cfile, fp);
     marshallUByte(outf, TAG_MAJOR_VERSION);
@@ -1370,15 +1641,17 @@ static void _write_map_full(const string &filebase, size_t vs, size_t ve,
     for (size_t i = vs; i < ve; ++i)
         vdefs[i].write_full(outf);
     fclose(fp);
+    return _replace_cache_file(tmpfile, cfile);
 }
 
-static void _write_map_index(const string &filebase, size_t vs, size_t ve,
+static bool _write_map_index(const string &filebase, size_t vs, size_t ve,
                              time_t mtime)
 {
     const string cfile = filebase + ".idx";
-    FILE *fp = fopen_u(cfile.c_str(), "wb");
+    const string tmpfile = cfile + ".tmp";
+    FILE *fp = fopen_u(tmpfile.c_str(), "wb");
     if (!fp)
-        end(1, true, "Unable to open %s for writing", cfile.c_str());
+        end(1, true, "Unable to open %s for writing", tmpfile.c_str());
 
     writer outf(cfile, fp);
     marshallUByte(outf, TAG_MAJOR_VERSION);
@@ -1392,9 +1665,9 @@ static void _write_map_index(const string &filebase, size_t vs, size_t ve,
         marshallString(outf, vdefs[i].description);
         marshallInt(outf, vdefs[i].order);
         vdefs[i].place_loaded_from.clear();
-        vdefs[i].strip();
     }
     fclose(fp);
+    return _replace_cache_file(tmpfile, cfile);
 }
 
 static void _write_map_cache(const string &filename, size_t vs, size_t ve,
@@ -1407,8 +1680,15 @@ static void _write_map_cache(const string &filename, size_t vs, size_t ve,
     file_lock deslock(descache_base + ".lk", "wb");
 
     _write_map_prelude(descache_base, mtime);
-    _write_map_full(descache_base, vs, ve, mtime);
-    _write_map_index(descache_base, vs, ve, mtime);
+    if (!_write_map_full(descache_base, vs, ve, mtime)
+        || !_write_map_index(descache_base, vs, ve, mtime))
+    {
+        return;
+    }
+
+    for (size_t i = vs; i < ve; ++i)
+        vdefs[i].strip();
+    _map_des_cache(filename, descache_base);
 }
 
 static void _parse_maps(const string &s)
@@ -1458,6 +1738,7 @@ void read_maps()
 {
     if (dlua.execfile("dlua/loadmaps.lua", true, true, true))
         end(1, false, "Lua error: %s", dlua.error.c_str());
+    _build_map_index();
 
     lc_loaded_maps.clear();
 
@@ -1483,6 +1764,7 @@ void reread_maps()
     // BOOM!
     vdefs.clear();
     map_files_read.clear();
+    _unmap_des_caches();
     read_maps();
 }
 
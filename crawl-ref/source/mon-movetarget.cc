@@ -220,21 +220,34 @@ bool try_pathfind(monster* mon)
          mon->name(DESC_PLAIN).c_str(), mon->pos().x, mon->pos().y,
          targpos.x, targpos.y, range);
 #endif
-    monster_pathfind mp;
-    if (range > 0)
-        mp.set_range(range);
-
-    if (mp.init_pathfind(mon, targpos))
+    // Other monsters chasing the same target may have done the work.
+    if (shared_pathfind(mon, targpos, range, mon->travel_path))
     {
-        mon->travel_path = mp.calc_waypoints();
         if (!mon->travel_path.empty())
         {
-            // Okay then, we found a path. Let's use it!
             mon->target = mon->travel_path[0];
             mon->travel_target = MTRAV_FOE;
             return true;
         }
     }
+    else
+    {
+        monster_pathfind mp;
+        if (range > 0)
+            mp.set_range(range);
+
+        if (mp.init_pathfind(mon, targpos))
+        {
+            mon->travel_path = mp.calc_waypoints();
+            if (!mon->travel_path.empty())
+            {
+                // Okay then, we found a path. Let's use it!
+                mon->target = mon->travel_path[0];
+                mon->travel_target = MTRAV_FOE;
+                return true;
+            }
+        }
+    }
 
     // We didn't find a path.
     _set_no_path_found(mon);
@@ -5,6 +5,7 @@
 #include "directn.h"
 #include "env.h"
 #include "los.h"
+#include "mon-tentacle.h"
 #include "mon-movetarget.h"
 #include "mon-place.h"
 #include "religion.h"
@@ -18,13 +19,13 @@
 // The pathfinding is an implementation of the A* algorithm. Beginning at the
 // monster position we check all neighbours of a given grid, estimate the
 // distance needed for any shortest path including this grid and push the
-// result into a hash. We can then easily access all points with the shortest
-// distance estimates and then check _their_ neighbours and so on.
+// result into a priority queue. We can then easily access all points with the
+// shortest distance estimates and then check _their_ neighbours and so on.
 // The algorithm terminates once we reach the destination since - because
-// of the sorting of grids by shortest distance in the hash - there can be no
+// of the sorting of grids by shortest distance in the queue - there can be no
 // path between start and target that is shorter than the current one. There
 // could be other paths that have the same length but that has no real impact.
-// If the hash has been cleared and the start grid has not been encountered,
+// If the queue has been emptied and the start grid has not been encountered,
 // then there's no path that matches the requirements fed into monster_pathfind.
 // (These requirements are usually preference of habitat of a specific monster
 // or a limit of the distance between start and any grid on the path.)
@@ -64,16 +65,57 @@ int mons_tracking_range(const monster* mon)
     return range;
 }
 
+// A point waiting to be looked at, along with its distance from start at
+// the time it was queued. If the distance has improved since, there's a
+// newer entry for the same point and this one is skipped.
+struct pathfind_node
+{
+    coord_def pos;
+    int dist;
+};
+
+// Scratch space for monster_pathfind. Rather than clearing the arrays for
+// every search, each search gets a new generation, and a cell's entries
+// only count if its stamp matches the current one.
+//
+// The queue is a bucket per total distance estimate. Estimates never
+// decrease as the search goes on, so popping just walks lowest upwards.
+// The buckets keep their storage from one search to the next.
+struct pathfind_buffers
+{
+    unsigned int generation;
+    unsigned int stamp[GXM][GYM];
+    int dist[GXM][GYM];
+    int prev[GXM][GYM];
+    vector<vector<pathfind_node>> queue;
+    int lowest;
+    int highest;
+};
+
+// Buffers not in use by any monster_pathfind, kept for the next one.
+static vector<unique_ptr<pathfind_buffers>> pathfind_pool;
+
 //#define DEBUG_PATHFIND
 monster_pathfind::monster_pathfind()
     : mons(nullptr), start(), target(), pos(), allow_diagonals(true),
-      traverse_unmapped(false), range(0), min_length(0), max_length(0),
-      dist(), prev(), hash()
+      traverse_unmapped(false), range(0), buf(nullptr)
 {
+    if (pathfind_pool.empty())
+    {
+        buf = new pathfind_buffers();
+        buf->lowest = INT_MAX;
+        buf->highest = -1;
+    }
+    else
+    {
+        buf = pathfind_pool.back().release();
+        pathfind_pool.pop_back();
+    }
 }
 
 monster_pathfind::~monster_pathfind()
 {
+    pathfind_pool.emplace_back(buf);
 }
 
 void monster_pathfind::set_range(int r)
@@ -84,7 +126,7 @@ void monster_pathfind::set_range(int r)
 
 coord_def monster_pathfind::next_pos(const coord_def &c) const
 {
-    return c + Compass[prev[c.x][c.y]];
+    return c + Compass[buf->prev[c.x][c.y]];
 }
 
 // The main method in the monster_pathfind class.
@@ -139,18 +181,14 @@ bool monster_pathfind::start_pathfind(bool msg)
     //       surrounded by shallow water or floor, or if a foe is hiding in
     //       a wall.
 
-    max_length = min_length = grid_distance(pos, target);
-    for (int i = 0; i < GXM; i++)
-        for (int j = 0; j < GYM; j++)
-            dist[i][j] = INFINITE_DISTANCE;
-
-    dist[pos.x][pos.y] = 0;
+    new_search();
+    set_dist(pos, 0);
 
     bool success = false;
     do
     {
         // Calculate the distance to all neighbours of the current position,
-        // and add them to the hash, if they haven't already been looked at.
+        // and queue them, if they haven't already been looked at.
         success = calc_path_to_neighbours();
         if (success)
             return true;
@@ -214,8 +252,8 @@ bool monster_pathfind::calc_path_to_neighbours()
         if (range && estimated_cost(npos) > range)
             continue;
 
-        distance = dist[pos.x][pos.y] + travel_cost(npos);
-        old_dist = dist[npos.x][npos.y];
+        distance = dist_at(pos) + travel_cost(npos);
+        old_dist = dist_at(npos);
 
         // Also bail out if this would make the path longer than twice the
         // allowed distance from the target. (This factor may need tuning.)
@@ -240,28 +278,22 @@ bool monster_pathfind::calc_path_to_neighbours()
         {
             // Calculate new total path length.
             total = distance + estimated_cost(npos);
+#ifdef DEBUG_PATHFIND
             if (old_dist == INFINITE_DISTANCE)
             {
-#ifdef DEBUG_PATHFIND
-                mprf("Adding (%d,%d) to hash (total dist = %d)",
+                mprf("Adding (%d,%d) to queue (total dist = %d)",
                      npos.x, npos.y, total);
-#endif
-                add_new_pos(npos, total);
-                if (total > max_length)
-                    max_length = total;
             }
             else
             {
-#ifdef DEBUG_PATHFIND
                 mprf("Improving (%d,%d) to total dist %d",
                      npos.x, npos.y, total);
-#endif
-
-                update_pos(npos, total);
             }
+#endif
 
             // Update distance start->pos.
-            dist[npos.x][npos.y] = distance;
+            set_dist(npos, distance);
+            add_new_pos(npos, total);
 
             // Set backtracking information.
             // Converts the Compass direction to its counterpart.
@@ -269,7 +301,7 @@ bool monster_pathfind::calc_path_to_neighbours()
             //      7  .  3   ==>   3  .  7       e.g. (3 + 4) % 8          = 7
             //      6  5  4         2  1  0            (7 + 4) % 8 = 11 % 8 = 3
 
-            prev[npos.x][npos.y] = (dir + 4) % 8;
+            buf->prev[npos.x][npos.y] = (dir + 4) % 8;
 
             // Are we finished?
             if (npos == target)
@@ -284,33 +316,32 @@ bool monster_pathfind::calc_path_to_neighbours()
     return false;
 }
 
-// Starting at known min_length (minimum total estimated path distance), check
-// the hash for existing vectors, then pick the last entry of the first vector
-// that matches. Update min_length, if necessary.
+// Pull the queued position with the shortest total distance estimate,
+// skipping entries for positions that have been improved since. Among
+// equals, pick the last position queued, as it's most likely to be close
+// to the target.
 bool monster_pathfind::get_best_position()
 {
-    for (int i = min_length; i <= max_length; i++)
+    for (; buf->lowest <= buf->highest; buf->lowest++)
     {
-        if (!hash[i].empty())
+        vector<pathfind_node> &bucket = buf->queue[buf->lowest];
+        while (!bucket.empty())
         {
-            if (i > min_length)
-                min_length = i;
+            const pathfind_node node = bucket.back();
+            bucket.pop_back();
 
-            vector<coord_def> &vec = hash[i];
-            // Pick the last position pushed into the vector as it's most
-            // likely to be close to the target.
-            pos = vec[vec.size()-1];
-            vec.pop_back();
+            if (node.dist != dist_at(node.pos))
+                continue;
 
+            pos = node.pos;
 #ifdef DEBUG_PATHFIND
             mprf("Returning (%d, %d) as best pos with total dist %d.",
-                 pos.x, pos.y, min_length);
+                 pos.x, pos.y, buf->lowest);
 #endif
-
             return true;
         }
 #ifdef DEBUG_PATHFIND
-        mprf("No positions for path length %d.", i);
+        mprf("No positions for path length %d.", buf->lowest);
 #endif
     }
 
@@ -335,7 +366,7 @@ vector<coord_def> monster_pathfind::backtrack()
     int dir;
     do
     {
-        dir = prev[pos.x][pos.y];
+        dir = buf->prev[pos.x][pos.y];
         pos = pos + Compass[dir];
         ASSERT_IN_BOUNDS(pos);
 #ifdef DEBUG_PATHFIND
@@ -362,8 +393,12 @@ vector<coord_def> monster_pathfind::backtrack()
 // avoid plants and other monsters in the way.
 vector<coord_def> monster_pathfind::calc_waypoints()
 {
-    vector<coord_def> path = backtrack();
+    return calc_waypoints(backtrack());
+}
 
+vector<coord_def> monster_pathfind::calc_waypoints(
+    const vector<coord_def> &path)
+{
     // If no path found, nothing to be done.
     if (path.empty())
         return path;
@@ -499,26 +534,283 @@ int monster_pathfind::estimated_cost(coord_def p)
     return grid_distance(p, target);
 }
 
+// Start a search that ignores everything left over from earlier ones.
+void monster_pathfind::new_search()
+{
+    if (++buf->generation == 0)
+    {
+        // Wrapped around, so old stamps could look current.
+        memset(buf->stamp, 0, sizeof(buf->stamp));
+        buf->generation = 1;
+    }
+    for (int i = buf->lowest; i <= buf->highest; i++)
+        buf->queue[i].clear();
+    buf->lowest = INT_MAX;
+    buf->highest = -1;
+}
+
+int monster_pathfind::dist_at(const coord_def& p) const
+{
+    if (buf->stamp[p.x][p.y] != buf->generation)
+        return INFINITE_DISTANCE;
+    return buf->dist[p.x][p.y];
+}
+
+void monster_pathfind::set_dist(const coord_def& p, int dist)
+{
+    buf->stamp[p.x][p.y] = buf->generation;
+    buf->dist[p.x][p.y] = dist;
+}
+
 void monster_pathfind::add_new_pos(coord_def npos, int total)
 {
-    hash[total].push_back(npos);
+    if (total >= (int) buf->queue.size())
+        buf->queue.resize(total + 1);
+    buf->queue[total].push_back({npos, dist_at(npos)});
+    buf->lowest = min(buf->lowest, total);
+    buf->highest = max(buf->highest, total);
 }
 
-void monster_pathfind::update_pos(coord_def npos, int total)
+// Fill dist with the cost for mon to travel from each cell to dest, and
+// prev with the first step to take from there. This is a plain Dijkstra
+// search run backwards from dest, so that a single flood serves every
+// monster that moves like mon, wherever it stands.
+void monster_pathfind::flood_from_target(const monster* mon, coord_def dest)
 {
-    // Find hash position of old distance and delete it,
-    // then call_add_new_pos.
-    int old_total = dist[npos.x][npos.y] + estimated_cost(npos);
+    mons   = mon;
+    start  = dest;
+    target = dest;
+    allow_diagonals   = true;
+    traverse_unmapped = false;
+    traverse_in_sight = false;
+    range = 0;
 
-    vector<coord_def> &vec = hash[old_total];
-    for (unsigned int i = 0; i < vec.size(); i++)
+    new_search();
+    set_dist(dest, 0);
+    add_new_pos(dest, 0);
+
+    while (get_best_position())
     {
-        if (vec[i] == npos)
+        // A monster may stand anywhere, but it can only step onto pos if
+        // pos is traversable, or the target itself.
+        if (pos != target && !traversable(pos))
+            continue;
+
+        const int distance = dist_at(pos) + travel_cost(pos);
+        for (int dir = 0; dir < 8; dir++)
         {
-            vec.erase(vec.begin() + i);
-            break;
+            const coord_def npos = pos + Compass[dir];
+            if (!in_bounds(npos) || distance >= dist_at(npos))
+                continue;
+
+            set_dist(npos, distance);
+            // From npos, step back the way we came.
+            buf->prev[npos.x][npos.y] = (dir + 4) % 8;
+            add_new_pos(npos, distance);
+        }
+    }
+}
+
+// After flood_from_target(), fill path with the steps from mon's position
+// to the target and return their cost, or INFINITE_DISTANCE if there's no
+// path. mon must move like the monster the flood was made for; it is used
+// for any later calc_waypoints().
+int monster_pathfind::path_from(const monster* mon, vector<coord_def> &path)
+{
+    mons = mon;
+    const coord_def src = mon->pos();
+    path.clear();
+    if (dist_at(src) == INFINITE_DISTANCE)
+        return INFINITE_DISTANCE;
+
+    for (coord_def p = src; p != target; p = next_pos(p))
+        path.push_back(p);
+    path.push_back(target);
+
+    return dist_at(src);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Shared distance fields
+//
+// In a crowded level most monsters that travel are chasing the same few
+// targets, usually the player. Rather than run one monster_pathfind per
+// monster, we flood the level once from each popular target for each way
+// of moving, and let every monster that moves that way read its path off
+// the result. The fields are dropped whenever the player takes a turn or
+// terrain changes.
+
+enum field_habitat
+{
+    FH_WALKER,
+    FH_AMPHIBIOUS,
+    FH_SWIMMER,
+    FH_FLIER,
+};
+
+// A target only gets a field once this many monsters have asked for it
+// in one turn; a single A* search is cheaper than a flood of the level.
+static const int SHARED_FIELD_MIN_REQUESTS = 2;
+static const int MAX_SHARED_FIELDS = 8;
+
+struct shared_field
+{
+    coord_def target;
+    int key;
+    int requests;
+    unique_ptr<monster_pathfind> field;
+};
+
+static vector<shared_field> shared_fields;
+static vector<unique_ptr<monster_pathfind>> spare_fields;
+static int shared_fields_time = -1;
+
+// Sum up everything that monster_pathfind's traversable() and
+// travel_cost() depend on, so that two monsters with the same key see
+// the same costs everywhere. Returns -1 for monsters that are too odd
+// to share a field with anyone.
+static int _shared_field_key(const monster* mon)
+{
+    // Allies avoid traps and stay in sight, thorn hunters and wandering
+    // mushrooms get special treatment of their plants, and clinging is
+    // relative to the previous step.
+    if (mon->wont_attack()
+        || mon->can_cling_to_walls()
+        || mon->type == MONS_THORN_HUNTER
+        || mon->type == MONS_WANDERING_MUSHROOM
+        || mons_is_tentacle_or_tentacle_segment(mon->type))
+    {
+        return -1;
+    }
+
+    // As in monster_habitable_grid().
+    const monster_type mt = fixup_zombie_type(mon->type,
+                                              mons_base_type(*mon));
+    if (mt == MONS_KRAKEN)
+        return -1;
+
+    const bool flies = mon->airborne();
+    if (mons_class_flag(mt, M_FLIES) && !flies)
+        return -1;
+
+    const habitat_type primary = mons_class_primary_habitat(mt);
+    const habitat_type secondary = mons_class_secondary_habitat(mt);
+    field_habitat habitat;
+    if (primary == HT_LAND && (secondary == HT_LAND
+                               || secondary == HT_WATER))
+    {
+        // Fliers can cross deep water anyway.
+        habitat = flies ? FH_FLIER
+                        : secondary == HT_WATER ? FH_AMPHIBIOUS
+                                                : FH_WALKER;
+    }
+    else if (primary == HT_WATER && secondary == HT_WATER && !flies)
+        habitat = FH_SWIMMER;
+    else
+        return -1;
+
+    int key = habitat;
+    if (mons_can_pass_doors(*mon))
+        key |= 1 << 2;
+    // Fliers never flounder.
+    if (!flies && mon->floundering_in(DNGN_SHALLOW_WATER))
+        key |= 1 << 3;
+    if (!flies && mon->floundering_in(DNGN_DEEP_WATER))
+        key |= 1 << 4;
+
+    // As in trap_def::is_known(), for monsters that aren't allies.
+    if (mons_is_native_in_branch(*mon))
+    {
+        if (mons_intel(*mon) > I_BRAINLESS)
+            key |= 1 << 5;
+        if (mons_intel(*mon) >= I_HUMAN)
+            key |= 1 << 6;
+    }
+
+    return key;
+}
+
+void invalidate_shared_pathfind()
+{
+    for (shared_field &sf : shared_fields)
+        if (sf.field)
+            spare_fields.push_back(move(sf.field));
+    shared_fields.clear();
+}
+
+static shared_field *_find_shared_field(coord_def dest, int key)
+{
+    for (shared_field &sf : shared_fields)
+        if (sf.target == dest && sf.key == key)
+            return &sf;
+
+    if ((int) shared_fields.size() >= MAX_SHARED_FIELDS)
+        return nullptr;
+
+    shared_fields.push_back({dest, key, 0, nullptr});
+    return &shared_fields.back();
+}
+
+/**
+ * Find a path for a monster from a distance field it shares with others.
+ *
+ * @param mon       The monster looking for a path.
+ * @param dest      Where it wants to go.
+ * @param range     As for monster_pathfind::set_range(); 0 for no limit.
+ * @param waypoints Set to the waypoints toward dest, or emptied if there
+ *                  is no way there.
+ * @return false if the monster should run its own monster_pathfind.
+ */
+bool shared_pathfind(const monster* mon, coord_def dest, int range,
+                     vector<coord_def> &waypoints)
+{
+    if (mon->pos() == dest)
+        return false;
+
+    if (shared_fields_time != you.elapsed_time)
+    {
+        invalidate_shared_pathfind();
+        shared_fields_time = you.elapsed_time;
+    }
+
+    const int key = _shared_field_key(mon);
+    if (key < 0)
+        return false;
+
+    shared_field *sf = _find_shared_field(dest, key);
+    if (!sf || ++sf->requests < SHARED_FIELD_MIN_REQUESTS)
+        return false;
+
+    if (!sf->field)
+    {
+        if (spare_fields.empty())
+            sf->field.reset(new monster_pathfind());
+        else
+        {
+            sf->field = move(spare_fields.back());
+            spare_fields.pop_back();
         }
+        // Any monster with this key will do to measure the costs.
+        sf->field->flood_from_target(mon, dest);
+    }
+
+    vector<coord_def> path;
+    const int cost = sf->field->path_from(mon, path);
+
+    // A path within range is what the monster's own search would find;
+    // if the shortest one strays too far, a longer one that doesn't may
+    // still exist, so leave that to monster_pathfind.
+    if (range && cost <= range * 2)
+    {
+        for (const coord_def &p : path)
+            if (p != mon->pos() && grid_distance(p, dest) > range)
+                return false;
     }
 
-    add_new_pos(npos, total);
+    waypoints.clear();
+    if (cost == INFINITE_DISTANCE || range && cost > range * 2)
+        return true;
+
+    waypoints = sf->field->calc_waypoints(path);
+    return true;
 }
@@ -2,14 +2,19 @@
 #define MON_PATHFIND_H
 
 class monster;
+struct pathfind_buffers;
 
 int mons_tracking_range(const monster* mon);
+bool shared_pathfind(const monster* mon, coord_def dest, int range,
+                     vector<coord_def> &waypoints);
+void invalidate_shared_pathfind();
 
 class monster_pathfind
 {
 public:
     monster_pathfind();
     virtual ~monster_pathfind();
+    DISALLOW_COPY_AND_ASSIGN(monster_pathfind);
 
     // public methods
     void set_range(int r);
@@ -22,6 +27,10 @@ public:
     bool start_pathfind(bool msg = false);
     vector<coord_def> backtrack();
     vector<coord_def> calc_waypoints();
+    vector<coord_def> calc_waypoints(const vector<coord_def> &path);
+
+    void flood_from_target(const monster* mon, coord_def dest);
+    int  path_from(const monster* mon, vector<coord_def> &path);
 
 protected:
     // protected methods
@@ -31,8 +40,10 @@ protected:
     bool mons_traversable(const coord_def& p);
     int  mons_travel_cost(coord_def npos);
     int  estimated_cost(coord_def npos);
-    void add_new_pos(coord_def pos, int total);
-    void update_pos(coord_def pos, int total);
+    void new_search();
+    int  dist_at(const coord_def& p) const;
+    void set_dist(const coord_def& p, int dist);
+    void add_new_pos(coord_def npos, int total);
     bool get_best_position();
 
     // The monster trying to find a path.
@@ -56,16 +67,11 @@ protected:
     // Maximum range to search between start and target. None, if zero.
     int range;
 
-    // Currently shortest and longest possible total length of the path.
-    int min_length;
-    int max_length;
-
-    // The array of distances from start to any already tried point.
-    int dist[GXM][GYM];
-    // An array to store where we came from on a given shortest path.
-    int prev[GXM][GYM];
-
-    FixedVector<vector<coord_def>, GXM * GYM> hash;
+    // The distances from start to any already tried point, the steps
+    // back along the shortest paths and the queue of points to try next.
+    // After flood_from_target(), the distances to target and the steps
+    // toward it instead.
+    pathfind_buffers *buf;
 };
 
 #endif
@@ -258,7 +258,11 @@ bool monster::submerged() const
 
 bool monster::extra_balanced_at(const coord_def p) const
 {
-    const dungeon_feature_type grid = grd(p);
+    return extra_balanced_in(grd(p));
+}
+
+bool monster::extra_balanced_in(dungeon_feature_type grid) const
+{
     return (mons_genus(type) == MONS_DRACONIAN
             && draco_or_demonspawn_subspecies(*this) == MONS_GREY_DRACONIAN)
                 || grid == DNGN_SHALLOW_WATER
@@ -283,17 +287,25 @@ bool monster::extra_balanced() const
  */
 bool monster::floundering_at(const coord_def p) const
 {
-    const dungeon_feature_type grid = grd(p);
-    return (liquefied(p)
-            || (feat_is_water(grid)
-                // Can't use monster_habitable_grid() because that'll return
-                // true for non-water monsters in shallow water.
-                && mons_primary_habitat(*this) != HT_WATER
-                // Use real_amphibious to detect giant non-water monsters in
-                // deep water, who flounder despite being treated as amphibious.
-                && mons_habitat(*this, true) != HT_AMPHIBIOUS
-                && !extra_balanced_at(p)))
-           && ground_level();
+    return (liquefied(p) || floundering_in(grd(p))) && ground_level();
+}
+
+/**
+ * Would the monster flounder in this terrain, if it stood on the ground?
+ *
+ * @param grid The terrain to check; liquefaction is not considered.
+ * @return Whether the terrain makes the monster flounder.
+ */
+bool monster::floundering_in(dungeon_feature_type grid) const
+{
+    return feat_is_water(grid)
+           // Can't use monster_habitable_grid() because that'll return
+           // true for non-water monsters in shallow water.
+           && mons_primary_habitat(*this) != HT_WATER
+           // Use real_amphibious to detect giant non-water monsters in
+           // deep water, who flounder despite being treated as amphibious.
+           && mons_habitat(*this, true) != HT_AMPHIBIOUS
+           && !extra_balanced_in(grid);
 }
 
 bool monster::floundering() const
@@ -250,8 +250,10 @@ public:
     bool     submerged() const override;
     bool     can_drown() const;
     bool     floundering_at(const coord_def p) const;
+    bool     floundering_in(dungeon_feature_type grid) const;
     bool     floundering() const override;
     bool     extra_balanced_at(const coord_def p) const;
+    bool     extra_balanced_in(dungeon_feature_type grid) const;
     bool     extra_balanced() const override;
     bool     can_pass_through_feat(dungeon_feature_type grid) const override;
     bool     is_habitable_feat(dungeon_feature_type actual_grid) const override;
@@ -5,6 +5,7 @@
 
 #include "feature.h"
 #include "newgame_def.h"
+#include "package.h"
 #include "pattern.h"
 
 enum autosac_type
@@ -360,6 +361,10 @@ public:
     vector<menu_sort_condition> sort_menus;
 
     bool        dump_on_save;       // Automatically dump character when saving.
+    bool        background_save;    // Write levels and commit in a thread.
+    bool        pregen_levels;      // Build the next levels in children.
+    package_codec save_compression; // How to compress chunks of the save.
+    int         save_compact_slack; // Rewrite saves this % unused on exit.
     int         dump_kill_places;   // How to dump place information for kills.
     int         dump_message_count; // How many old messages to dump
 
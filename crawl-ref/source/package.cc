@@ -16,6 +16,9 @@ Notes:
 * Readers always get the last complete (but not necessarily committed) write
   (ie, READ_UNCOMMITTED) at the time they started; it is safe to continue
   reading even if the chunk has been changed since.
+* One chunk write or commit at a time may run on a background thread. Reads
+  can go on alongside it; anything else waits for it to finish first. A
+  read of the chunk being written waits too.
 */
 
 #include "AppHdr.h"
@@ -35,6 +38,7 @@ Notes:
 #include "errors.h"
 #include "syscalls.h"
 #include "libutil.h" // map_find
+#include "threads.h"
 
 // debugging defines
 #undef  FSCK_VERBOSE
@@ -56,7 +60,10 @@ static plen_t htole(plen_t x)
 #define dprintf(...) do {} while (0)
 #endif
 
-#define PACKAGE_VERSION 1
+// Version 2 records the codec of each chunk, and is only written when some
+// chunk isn't zlib, so saves that don't need it can still be read by older
+// versions.
+#define PACKAGE_VERSION 2
 #define PACKAGE_MAGIC   0x53534344 /* "DCSS" */
 
 struct file_header
@@ -78,11 +85,38 @@ typedef pair<plen_t, plen_t> bm_p;
 typedef map<plen_t, bm_p> bm_t;
 typedef map<plen_t, plen_t> fb_t;
 
+struct package_async
+{
+    package_async() : running(false) { mutex_init(lock); }
+    ~package_async() { mutex_destroy(lock); }
+
+    // Guards the package's state and file offset between threads.
+    mutex_t lock;
+    bool running;
+    thread_t thread;
+    // The chunk being written, or empty for a commit.
+    string chunk;
+    vector<unsigned char> data;
+    exception_ptr error;
+
+    static void *run(void *arg);
+};
+
+class package_lock
+{
+public:
+    package_lock(package_async &async) : lock(async.lock) { mutex_lock(lock); }
+    ~package_lock() { mutex_unlock(lock); }
+private:
+    mutex_t &lock;
+};
+
 package::package(const char* file, bool writeable, bool empty)
   : n_users(0), dirty(false), aborted(false)
 #ifdef DO_FSYNC
     , tmp(false)
 #endif
+    , codec(CODEC_ZLIB), async(new package_async)
 {
     dprintf("package: initializing file=\"%s\" rw=%d\n", file, writeable);
     ASSERT(writeable || !empty);
@@ -130,6 +164,7 @@ package::package()
 #ifdef DO_FSYNC
     , tmp(true)
 #endif
+    , codec(CODEC_ZLIB), async(new package_async)
 {
     dprintf("package: initializing tmp file\n");
     filename = "[tmp]";
@@ -202,6 +237,22 @@ void package::load_traces()
 package::~package()
 {
     dprintf("package: finalizing\n");
+    if (!CrawlIsCrashing)
+    {
+        // Don't throw out of a destructor. If the background write failed,
+        // the save is left as of the last commit that made it.
+        try
+        {
+            finish_async();
+        }
+        catch (exception &e)
+        {
+            dprintf("package: background write failed: %s\n", e.what());
+            aborted = true;
+        }
+    }
+    else if (async->running)
+        thread_join(async->thread);
     ASSERT(!n_users || CrawlIsCrashing); // not merely aborted, there are
         // live pointers to us. With normal stack unwinding, destructors
         // will make sure this never happens and this assert is good for
@@ -210,7 +261,7 @@ package::~package()
 
     if (rw && !aborted)
     {
-        commit();
+        commit_now();
         if (ftruncate(fd, file_len))
             sysfail("failed to update save file");
     }
@@ -227,33 +278,49 @@ package::~package()
 
 void package::commit()
 {
-    ASSERT(rw);
-    if (!dirty)
-        return;
-    ASSERT(!aborted);
+    finish_async();
+    commit_now();
+}
+
+// The lock is let go around the syncs, so reads on the main thread can go
+// on while a background commit waits for the disk. Nothing else can change
+// the package meanwhile, as everything that would waits for the commit.
+void package::commit_now()
+{
+    file_header head;
+    {
+        package_lock lock(*async);
+        ASSERT(rw);
+        if (!dirty)
+            return;
+        ASSERT(!aborted);
 
 #ifdef COSTLY_ASSERTS
-    fsck();
+        fsck();
 #endif
 
-    file_header head;
-    head.magic = htole(PACKAGE_MAGIC);
-    head.version = PACKAGE_VERSION;
-    memset(&head.padding, 0, sizeof(head.padding));
-    head.start = htole(write_directory());
+        head.magic = htole(PACKAGE_MAGIC);
+        head.version = codecs.empty() ? 1 : PACKAGE_VERSION;
+        memset(&head.padding, 0, sizeof(head.padding));
+        head.start = htole(write_directory());
+    }
 #ifdef DO_FSYNC
     // We need a barrier before updating the link to point at the new directory.
     if (!tmp && fdatasync(fd))
         sysfail("flush error while saving");
 #endif
-    seek(0);
-    if (write(fd, &head, sizeof(head)) != sizeof(head))
-        sysfail("write error while saving");
+    {
+        package_lock lock(*async);
+        seek(0);
+        if (write(fd, &head, sizeof(head)) != sizeof(head))
+            sysfail("write error while saving");
+    }
 #ifdef DO_FSYNC
     if (!tmp && fdatasync(fd))
         sysfail("flush error while saving");
 #endif
 
+    package_lock lock(*async);
     new_chunks.clear();
     collect_blocks();
     dirty = false;
@@ -263,6 +330,59 @@ void package::commit()
 #endif
 }
 
+// Rewrite the save into a new file with every chunk in one block and no
+// unused space, then put it in place of the old one. The compressed data
+// is copied as it is. Until the new file, committed and flushed, is renamed
+// over the old one, the old one remains the save, so a crash at any moment
+// leaves one or the other. Like commit(), this makes all writes so far
+// permanent. Returns false if the save can't be rewritten; it is then left
+// as it was.
+bool package::compact()
+{
+    commit();
+    if (n_users)
+        return false;
+
+    const string tmpname = filename + ".tmp";
+    try
+    {
+        package out(tmpname.c_str(), true, true);
+        for (const auto &entry : directory)
+        {
+            if (entry.first.empty())
+                continue;
+
+            char buf[16384];
+            chunk_reader in(this, entry.second, CODEC_NONE);
+            chunk_writer ch(&out, entry.first, CODEC_NONE);
+            while (plen_t s = in.read(buf, sizeof(buf)))
+                ch.write(buf, s);
+        }
+        out.codecs = codecs;
+        out.commit();
+
+        if (rename_u(tmpname.c_str(), filename.c_str()))
+            sysfail("can't replace the save file (%s)", filename.c_str());
+
+        // Take over the new file; out is left with the old one, to close.
+        swap(fd, out.fd);
+        file_len = out.file_len;
+        directory.swap(out.directory);
+        free_blocks.swap(out.free_blocks);
+        block_map.swap(out.block_map);
+        unlinked_blocks.clear();
+        new_chunks.clear();
+        out.aborted = true;
+    }
+    catch (ext_fail_exception &fe)
+    {
+        dprintf("package: compacting failed: %s\n", fe.what());
+        ::unlink_u(tmpname.c_str());
+        return false;
+    }
+    return true;
+}
+
 void package::seek(plen_t to)
 {
     ASSERT(!aborted);
@@ -273,18 +393,138 @@ void package::seek(plen_t to)
         sysfail("failed to seek inside the save file");
 }
 
+void *package_async::run(void *arg)
+{
+    package *pkg = static_cast<package*>(arg);
+    package_async &async = *pkg->async;
+    try
+    {
+        if (async.chunk.empty())
+            pkg->commit_now();
+        else
+        {
+            chunk_writer ch(pkg, async.chunk);
+            if (!async.data.empty())
+                ch.write(&async.data[0], async.data.size());
+        }
+    }
+    catch (...)
+    {
+        async.error = current_exception();
+    }
+    return 0;
+}
+
+void package::write_chunk_async(const string &name,
+                                vector<unsigned char> &&data)
+{
+    ASSERT(!name.empty());
+    finish_async();
+    async->chunk = name;
+    async->data = move(data);
+    if (thread_create_joinable(&async->thread, package_async::run, this))
+    {
+        // No thread to be had, so write it now.
+        package_async::run(this);
+        async->chunk.clear();
+        async->data.clear();
+    }
+    else
+        async->running = true;
+    if (async->error)
+        rethrow_exception(async->error);
+}
+
+void package::commit_async()
+{
+    finish_async();
+    async->chunk.clear();
+    if (thread_create_joinable(&async->thread, package_async::run, this))
+        commit_now();
+    else
+        async->running = true;
+}
+
+// Wait for the background thread, passing on anything it threw.
+void package::finish_async()
+{
+    if (!async->running)
+        return;
+
+    thread_join(async->thread);
+    async->running = false;
+    async->chunk.clear();
+    async->data.clear();
+    if (async->error)
+    {
+        exception_ptr error = async->error;
+        async->error = nullptr;
+        rethrow_exception(error);
+    }
+}
+
 chunk_writer* package::writer(const string &name)
 {
+    finish_async();
     return new chunk_writer(this, name);
 }
 
 chunk_reader* package::reader(const string &name)
 {
+    if (async->running && async->chunk == name)
+        finish_async();
+
+    package_lock lock(*async);
     if (plen_t *ch = map_find(directory, name))
-        return new chunk_reader(this, *ch);
+        return new chunk_reader(this, *ch, lookup(codecs, name, CODEC_ZLIB));
     return 0;
 }
 
+void package::set_codec(package_codec _codec)
+{
+    ASSERT(codec_supported(_codec));
+    finish_async();
+    codec = _codec;
+}
+
+package_codec package::get_chunk_codec(const string &name)
+{
+    finish_async();
+    return lookup(codecs, name, CODEC_ZLIB);
+}
+
+static const char *codec_names[] =
+{
+    "zlib", "none", "lz4", "zstd",
+};
+
+const char *codec_name(package_codec codec)
+{
+    COMPILE_CHECK(ARRAYSZ(codec_names) == NUM_CODECS);
+    ASSERT_RANGE(codec, 0, NUM_CODECS);
+    return codec_names[codec];
+}
+
+bool codec_supported(package_codec codec)
+{
+    switch (codec)
+    {
+#ifdef USE_ZLIB
+    case CODEC_ZLIB:
+#endif
+#ifdef USE_LZ4
+    case CODEC_LZ4:
+#endif
+#ifdef USE_ZSTD
+    case CODEC_ZSTD:
+#endif
+    case CODEC_NONE:
+        return true;
+    default:
+        return false;
+    }
+}
+
 plen_t package::extend_block(plen_t at, plen_t size, plen_t by)
 {
     // the header is not counted into the block's size, yet takes space
@@ -353,10 +593,15 @@ plen_t package::alloc_block(plen_t &size)
     return at;
 }
 
-void package::finish_chunk(const string &name, plen_t at)
+void package::finish_chunk(const string &name, plen_t at,
+                           package_codec ch_codec)
 {
     free_chunk(name);
     directory[name] = at;
+    if (ch_codec == CODEC_ZLIB)
+        codecs.erase(name);
+    else
+        codecs[name] = ch_codec;
     new_chunks.insert(at);
     dirty = true;
 }
@@ -378,13 +623,17 @@ void package::free_chunk(const string &name)
 
 void package::delete_chunk(const string &name)
 {
+    finish_async();
+    package_lock lock(*async);
     free_chunk(name);
     directory.erase(name);
+    codecs.erase(name);
 }
 
 plen_t package::write_directory()
 {
-    delete_chunk("");
+    free_chunk("");
+    directory.erase("");
 
     stringstream dir;
     for (const auto &entry : directory)
@@ -394,12 +643,17 @@ plen_t package::write_directory()
         dir.write(&entry.first[0], entry.first.length());
         plen_t start = htole(entry.second);
         dir.write((const char*)&start, sizeof(plen_t));
+        if (!codecs.empty())
+        {
+            const uint8_t ch_codec = lookup(codecs, entry.first, CODEC_ZLIB);
+            dir.write((const char*)&ch_codec, sizeof(ch_codec));
+        }
     }
 
     ASSERT(dir.str().size());
     dprintf("writing directory (%u bytes)\n", (unsigned int)dir.str().size());
     {
-        chunk_writer dch(this, "");
+        chunk_writer dch(this, "", CODEC_ZLIB);
         dch.write(&dir.str()[0], dir.str().size());
     }
 
@@ -517,7 +771,7 @@ void package::read_directory(plen_t start, uint8_t version)
     directory[""] = start;
 
     dprintf("package: reading directory\n");
-    chunk_reader rd(this, start);
+    chunk_reader rd(this, start, CODEC_ZLIB);
 
     switch (version)
     {
@@ -534,8 +788,10 @@ void package::read_directory(plen_t start, uint8_t version)
         }
         break;
     case 1:
+    case 2:
         uint8_t name_len;
         plen_t bstart;
+        uint8_t ch_codec;
         while (plen_t res = rd.read(&name_len, sizeof(name_len)))
         {
             if (res != sizeof(name_len))
@@ -547,6 +803,18 @@ void package::read_directory(plen_t start, uint8_t version)
             if (rd.read(&bstart, sizeof(bstart)) != sizeof(bstart))
                 corrupted("save file corrupted -- truncated directory");
             directory[chname] = htole(bstart);
+            if (version >= 2)
+            {
+                if (rd.read(&ch_codec, sizeof(ch_codec)) != sizeof(ch_codec))
+                    corrupted("save file corrupted -- truncated directory");
+                if (ch_codec >= NUM_CODECS)
+                {
+                    corrupted("save file (%s) uses an unknown compression %u",
+                              filename.c_str(), ch_codec);
+                }
+                if (ch_codec != CODEC_ZLIB)
+                    codecs[chname] = (package_codec)ch_codec;
+            }
             dprintf("* %s\n", chname.c_str());
         }
         break;
@@ -558,11 +826,16 @@ void package::read_directory(plen_t start, uint8_t version)
 
 bool package::has_chunk(const string &name)
 {
+    if (async->running && async->chunk == name)
+        finish_async();
+
+    package_lock lock(*async);
     return !name.empty() && directory.count(name);
 }
 
 vector<string> package::list_chunks()
 {
+    finish_async();
     vector<string> list;
     list.reserve(directory.size());
     for (const auto &entry : directory)
@@ -613,6 +886,12 @@ void package::abort()
     // Disable any further operations, allow a shutdown. All errors past
     // this point are ignored (assuming we already failed). All writes since
     // the last commit() are lost.
+    if (async->running)
+    {
+        thread_join(async->thread);
+        async->running = false;
+        async->error = nullptr;
+    }
     aborted = true;
 }
 
@@ -624,9 +903,16 @@ void package::unlink()
     ::unlink_u(filename.c_str());
 }
 
+plen_t package::get_size()
+{
+    finish_async();
+    return file_len;
+}
+
 // the amount of free space not at the end of file
 plen_t package::get_slack()
 {
+    finish_async();
     load_traces();
 
     plen_t slack = 0;
@@ -637,6 +923,7 @@ plen_t package::get_slack()
 
 plen_t package::get_chunk_fragmentation(const string &name)
 {
+    finish_async();
     load_traces();
     ASSERT(directory.count(name)); // not has_chunk(), "" is valid
     plen_t frags = 0;
@@ -653,6 +940,7 @@ plen_t package::get_chunk_fragmentation(const string &name)
 
 plen_t package::get_chunk_compressed_length(const string &name)
 {
+    finish_async();
     load_traces();
     ASSERT(directory.count(name)); // not has_chunk(), "" is valid
     plen_t len = 0;
@@ -668,10 +956,18 @@ plen_t package::get_chunk_compressed_length(const string &name)
 }
 
 chunk_writer::chunk_writer(package *parent, const string &_name)
-    : first_block(0), cur_block(0), block_len(0)
+    : chunk_writer(parent, _name, parent->codec)
+{
+}
+
+chunk_writer::chunk_writer(package *parent, const string &_name,
+                           package_codec _codec)
+    : first_block(0), cur_block(0), block_len(0), codec(_codec),
+      z_buffer(nullptr), z_size(0), z_used(0)
 {
     ASSERT(parent);
     ASSERT(!parent->aborted);
+    ASSERT(codec_supported(codec));
 
     // If you need more, please change {read,write}_directory().
     ASSERT(MAX_CHUNK_NAME_LENGTH < 256);
@@ -679,61 +975,203 @@ chunk_writer::chunk_writer(package *parent, const string &_name)
 
     dprintf("chunk_writer(%s): starting\n", _name.c_str());
     pkg = parent;
-    pkg->n_users++;
+    {
+        package_lock lock(*pkg->async);
+        pkg->n_users++;
+    }
     name = _name;
 
-#ifdef USE_ZLIB
-    zs.data_type = Z_BINARY;
-    zs.zalloc    = 0;
-    zs.zfree     = 0;
-    zs.opaque    = Z_NULL;
-    if (deflateInit(&zs, Z_DEFAULT_COMPRESSION))
-        fail("save file compression failed during init: %s", zs.msg);
 #define ZB_SIZE 32768
-    zs.next_out  = z_buffer = (Bytef*)malloc(ZB_SIZE);
-    zs.avail_out = ZB_SIZE;
+    switch (codec)
+    {
+#ifdef USE_ZLIB
+    case CODEC_ZLIB:
+        zs.data_type = Z_BINARY;
+        zs.zalloc    = 0;
+        zs.zfree     = 0;
+        zs.opaque    = Z_NULL;
+        if (deflateInit(&zs, Z_DEFAULT_COMPRESSION))
+            fail("save file compression failed during init: %s", zs.msg);
+        z_size = ZB_SIZE;
+        break;
+#endif
+#ifdef USE_LZ4
+    case CODEC_LZ4:
+        if (LZ4F_isError(LZ4F_createCompressionContext(&lz4, LZ4F_VERSION)))
+            fail("save file compression failed during init");
+        // Room for the compressed form of any one write of up to ZB_SIZE
+        // bytes, on top of whatever the frame keeps buffered.
+        z_size = ZB_SIZE + LZ4F_compressBound(ZB_SIZE, nullptr);
+        break;
+#endif
+#ifdef USE_ZSTD
+    case CODEC_ZSTD:
+        zstd = ZSTD_createCStream();
+        if (!zstd || ZSTD_isError(ZSTD_initCStream(zstd, ZSTD_CLEVEL_DEFAULT)))
+            fail("save file compression failed during init");
+        z_size = ZB_SIZE;
+        break;
+#endif
+    default:
+        break;
+    }
+    if (z_size)
+        z_buffer = (unsigned char*)malloc(z_size);
+#ifdef USE_LZ4
+    if (codec == CODEC_LZ4)
+    {
+        const size_t res = LZ4F_compressBegin(lz4, z_buffer, z_size, nullptr);
+        if (LZ4F_isError(res))
+        {
+            fail("save file compression failed during init: %s",
+                 LZ4F_getErrorName(res));
+        }
+        z_used = res;
+    }
 #endif
 }
 
 chunk_writer::~chunk_writer()
 {
     dprintf("chunk_writer(%s): closing\n", name.c_str());
+    package_lock lock(*pkg->async);
 
     ASSERT(pkg->n_users > 0);
     pkg->n_users--;
     if (pkg->aborted)
     {
-#ifdef USE_ZLIB
         // ignore errors, they're not relevant anymore
-        deflateEnd(&zs);
-        free(z_buffer);
-#endif
+        end_codec();
         return;
     }
 
-#ifdef USE_ZLIB
-    zs.avail_in = 0;
-    int res;
-    do
+    compress(nullptr, 0, true);
+    end_codec();
+    if (cur_block)
+        finish_block(0);
+    pkg->finish_chunk(name, first_block, codec);
+}
+
+void chunk_writer::end_codec()
+{
+    switch (codec)
     {
-        res = deflate(&zs, Z_FINISH);
-        if (res != Z_STREAM_END && res != Z_OK && res != Z_BUF_ERROR)
-            fail("save file compression failed: %s", zs.msg);
-        raw_write(z_buffer, zs.next_out - z_buffer);
-        zs.next_out = z_buffer;
-        zs.avail_out = ZB_SIZE;
-    } while (res != Z_STREAM_END);
-    if (deflateEnd(&zs) != Z_OK)
-        fail("save file compression failed during clean-up: %s", zs.msg);
+#ifdef USE_ZLIB
+    case CODEC_ZLIB:
+        if (deflateEnd(&zs) != Z_OK && !pkg->aborted)
+            fail("save file compression failed during clean-up: %s", zs.msg);
+        break;
+#endif
+#ifdef USE_LZ4
+    case CODEC_LZ4:
+        LZ4F_freeCompressionContext(lz4);
+        break;
+#endif
+#ifdef USE_ZSTD
+    case CODEC_ZSTD:
+        ZSTD_freeCStream(zstd);
+        break;
+#endif
+    default:
+        break;
+    }
     free(z_buffer);
+    z_buffer = nullptr;
+}
+
+// Feed data through the codec, buffering what comes out. With finish, the
+// stream is ended and everything written.
+void chunk_writer::compress(const void *data, plen_t len, bool finish)
+{
+    switch (codec)
+    {
+#ifdef USE_ZLIB
+    case CODEC_ZLIB:
+    {
+        zs.next_in  = (Bytef*)data;
+        zs.avail_in = len;
+        int res;
+        do
+        {
+            if (z_used == z_size)
+                flush_buffer();
+            zs.next_out  = z_buffer + z_used;
+            zs.avail_out = z_size - z_used;
+            res = deflate(&zs, finish ? Z_FINISH : Z_NO_FLUSH);
+            z_used = zs.next_out - z_buffer;
+            // we don't allow Z_BUF_ERROR, so it's fatal for us
+            if (res != Z_OK && (!finish || res != Z_STREAM_END))
+                fail("save file compression failed: %s", zs.msg);
+        } while (finish ? res != Z_STREAM_END : zs.avail_in != 0);
+        break;
+    }
 #endif
-    if (cur_block)
-        finish_block(0);
-    pkg->finish_chunk(name, first_block);
+#ifdef USE_LZ4
+    case CODEC_LZ4:
+    {
+        const char *in = (const char*)data;
+        do
+        {
+            const plen_t step = min<plen_t>(len, ZB_SIZE);
+            if (z_size - z_used < LZ4F_compressBound(step, nullptr))
+                flush_buffer();
+            const size_t res = finish
+                ? LZ4F_compressEnd(lz4, z_buffer + z_used, z_size - z_used,
+                                   nullptr)
+                : LZ4F_compressUpdate(lz4, z_buffer + z_used,
+                                      z_size - z_used, in, step, nullptr);
+            if (LZ4F_isError(res))
+            {
+                fail("save file compression failed: %s",
+                     LZ4F_getErrorName(res));
+            }
+            z_used += res;
+            in += step;
+            len -= step;
+        } while (len);
+        break;
+    }
+#endif
+#ifdef USE_ZSTD
+    case CODEC_ZSTD:
+    {
+        ZSTD_inBuffer in = { data, len, 0 };
+        size_t res;
+        do
+        {
+            if (z_used == z_size)
+                flush_buffer();
+            ZSTD_outBuffer out = { z_buffer, z_size, z_used };
+            res = ZSTD_compressStream2(zstd, &out, &in,
+                                       finish ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(res))
+            {
+                fail("save file compression failed: %s",
+                     ZSTD_getErrorName(res));
+            }
+            z_used = out.pos;
+        } while (finish ? res != 0 : in.pos < in.size);
+        break;
+    }
+#endif
+    default:
+        raw_write(data, len);
+        break;
+    }
+
+    if (finish && z_used)
+        flush_buffer();
+}
+
+void chunk_writer::flush_buffer()
+{
+    raw_write(z_buffer, z_used);
+    z_used = 0;
 }
 
 void chunk_writer::raw_write(const void *data, plen_t len)
 {
+    package_lock lock(*pkg->async);
     while (len > 0)
     {
         plen_t space = pkg->extend_block(cur_block, block_len, len);
@@ -760,6 +1198,7 @@ void chunk_writer::raw_write(const void *data, plen_t len)
 
 void chunk_writer::finish_block(plen_t next)
 {
+    package_lock lock(*pkg->async);
     block_header head;
     head.len = htole(block_len);
     head.next = htole(next);
@@ -776,55 +1215,73 @@ void chunk_writer::write(const void *data, plen_t len)
     ASSERT(data);
     ASSERT(!pkg->aborted);
 
-#ifdef USE_ZLIB
-    zs.next_in  = (Bytef*)data;
-    zs.avail_in = len;
-    while (zs.avail_in)
-    {
-        if (!zs.avail_out)
-        {
-            raw_write(z_buffer, zs.next_out - z_buffer);
-            zs.next_out  = z_buffer;
-            zs.avail_out = ZB_SIZE;
-        }
-        // we don't allow Z_BUF_ERROR, so it's fatal for us
-        if (deflate(&zs, Z_NO_FLUSH) != Z_OK)
-            fail("save file compression failed: %s", zs.msg);
-    }
-#else
-    raw_write(data, len);
-#endif
+    compress(data, len, false);
 }
 
-void chunk_reader::init(plen_t start)
+void chunk_reader::init(plen_t start, package_codec _codec)
 {
+    package_lock lock(*pkg->async);
     ASSERT(!pkg->aborted);
-    pkg->n_users++;
-    pkg->reader_count[start]++;
     first_block = next_block = start;
     block_left = 0;
+    codec = _codec;
+    eof = false;
+    in_pos = in_len = 0;
 
+    if (!codec_supported(codec))
+    {
+        fail("save file uses %s compression, which this build doesn't "
+             "support", codec_name(codec));
+    }
+    if (codec != CODEC_NONE && !start)
+    {
+        corrupted("save file corrupted -- %s header missing",
+                  codec_name(codec));
+    }
+
+    switch (codec)
+    {
 #ifdef USE_ZLIB
-    if (!start)
-        corrupted("save file corrupted -- zlib header missing");
-
-    zs.zalloc    = 0;
-    zs.zfree     = 0;
-    zs.opaque    = Z_NULL;
-    zs.next_in   = Z_NULL;
-    zs.avail_in  = 0;
-    if (inflateInit(&zs))
-        fail("save file decompression failed during init: %s", zs.msg);
-    eof = false;
+    case CODEC_ZLIB:
+        zs.zalloc    = 0;
+        zs.zfree     = 0;
+        zs.opaque    = Z_NULL;
+        zs.next_in   = Z_NULL;
+        zs.avail_in  = 0;
+        if (inflateInit(&zs))
+            fail("save file decompression failed during init: %s", zs.msg);
+        break;
+#endif
+#ifdef USE_LZ4
+    case CODEC_LZ4:
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&lz4, LZ4F_VERSION)))
+            fail("save file decompression failed during init");
+        break;
 #endif
+#ifdef USE_ZSTD
+    case CODEC_ZSTD:
+        zstd = ZSTD_createDStream();
+        if (!zstd || ZSTD_isError(ZSTD_initDStream(zstd)))
+            fail("save file decompression failed during init");
+        break;
+#endif
+    default:
+        break;
+    }
+
+    // Only once nothing can fail: a reader that throws from here never
+    // gets destroyed, so it would never give these back.
+    pkg->n_users++;
+    pkg->reader_count[start]++;
 }
 
-chunk_reader::chunk_reader(package *parent, plen_t start)
+chunk_reader::chunk_reader(package *parent, plen_t start,
+                           package_codec _codec)
 {
     ASSERT(parent);
     dprintf("chunk_reader[%u]: starting\n", start);
     pkg = parent;
-    init(start);
+    init(start, _codec);
 }
 
 chunk_reader::chunk_reader(package *parent, const string &_name)
@@ -834,17 +1291,37 @@ chunk_reader::chunk_reader(package *parent, const string &_name)
         corrupted("save file corrupted -- chunk \"%s\" missing", _name.c_str());
     dprintf("chunk_reader(%s): starting\n", _name.c_str());
     pkg = parent;
-    init(parent->directory[_name]);
+    package_lock lock(*pkg->async);
+    init(parent->directory[_name],
+         lookup(parent->codecs, _name, CODEC_ZLIB));
 }
 
 chunk_reader::~chunk_reader()
 {
     dprintf("chunk_reader: closing\n");
 
+    switch (codec)
+    {
 #ifdef USE_ZLIB
-    if (inflateEnd(&zs) != Z_OK)
-        fail("save file decompression failed during clean-up: %s", zs.msg);
+    case CODEC_ZLIB:
+        if (inflateEnd(&zs) != Z_OK)
+            fail("save file decompression failed during clean-up: %s", zs.msg);
+        break;
+#endif
+#ifdef USE_LZ4
+    case CODEC_LZ4:
+        LZ4F_freeDecompressionContext(lz4);
+        break;
 #endif
+#ifdef USE_ZSTD
+    case CODEC_ZSTD:
+        ZSTD_freeDStream(zstd);
+        break;
+#endif
+    default:
+        break;
+    }
+    package_lock lock(*pkg->async);
     ASSERT(pkg->reader_count[first_block] > 0);
     if (!--pkg->reader_count[first_block])
         pkg->reader_count.erase(first_block);
@@ -854,6 +1331,7 @@ chunk_reader::~chunk_reader()
 
 plen_t chunk_reader::raw_read(void *data, plen_t len)
 {
+    package_lock lock(*pkg->async);
     void *buf = data;
     while (len)
     {
@@ -898,42 +1376,91 @@ plen_t chunk_reader::raw_read(void *data, plen_t len)
     return (char*)buf - (char*)data;
 }
 
+// Decompress as much as will fit in data from the buffered input, setting
+// eof at the end of the stream.
+plen_t chunk_reader::decompress(void *data, plen_t len)
+{
+    switch (codec)
+    {
+#ifdef USE_ZLIB
+    case CODEC_ZLIB:
+    {
+        zs.next_in   = z_buffer + in_pos;
+        zs.avail_in  = in_len - in_pos;
+        zs.next_out  = (Bytef*)data;
+        zs.avail_out = len;
+        int res = inflate(&zs, Z_NO_FLUSH);
+        in_pos = zs.next_in - z_buffer;
+        if (res == Z_STREAM_END)
+            eof = true;
+        // No progress is for the caller to worry about.
+        else if (res != Z_OK && res != Z_BUF_ERROR)
+            corrupted("save file decompression failed: %s", zs.msg);
+        return zs.next_out - (Bytef*)data;
+    }
+#endif
+#ifdef USE_LZ4
+    case CODEC_LZ4:
+    {
+        size_t out_len = len;
+        size_t in_used = in_len - in_pos;
+        size_t res = LZ4F_decompress(lz4, data, &out_len, z_buffer + in_pos,
+                                     &in_used, nullptr);
+        if (LZ4F_isError(res))
+        {
+            corrupted("save file decompression failed: %s",
+                      LZ4F_getErrorName(res));
+        }
+        in_pos += in_used;
+        eof = !res;
+        return out_len;
+    }
+#endif
+#ifdef USE_ZSTD
+    case CODEC_ZSTD:
+    {
+        ZSTD_inBuffer in = { z_buffer, in_len, in_pos };
+        ZSTD_outBuffer out = { data, len, 0 };
+        size_t res = ZSTD_decompressStream(zstd, &out, &in);
+        if (ZSTD_isError(res))
+        {
+            corrupted("save file decompression failed: %s",
+                      ZSTD_getErrorName(res));
+        }
+        in_pos = in.pos;
+        eof = !res;
+        return out.pos;
+    }
+#endif
+    default:
+        die("unknown codec %d", codec);
+    }
+}
+
 plen_t chunk_reader::read(void *data, plen_t len)
 {
     ASSERT(data);
     if (pkg->aborted)
         return 0;
 
-#ifdef USE_ZLIB
-    if (!len)
-        return 0;
-    if (eof)
-        return 0;
+    if (codec == CODEC_NONE)
+        return raw_read(data, len);
 
-    zs.next_out  = (Bytef*)data;
-    zs.avail_out = len;
-    while (zs.avail_out)
+    plen_t done = 0;
+    while (done < len && !eof)
     {
-        if (!zs.avail_in)
-        {
-            zs.next_in  = z_buffer;
-            zs.avail_in = raw_read(z_buffer, sizeof(z_buffer));
-            if (!zs.avail_in)
-                corrupted("save file corrupted -- block truncated");
-        }
-        int res = inflate(&zs, Z_NO_FLUSH);
-        if (res == Z_STREAM_END)
+        if (in_pos == in_len)
         {
-            eof = true;
-            return zs.next_out - (Bytef*)data;
+            in_pos = 0;
+            in_len = raw_read(z_buffer, sizeof(z_buffer));
         }
-        if (res != Z_OK)
-            corrupted("save file decompression failed: %s", zs.msg);
+        const plen_t had = in_pos;
+        const plen_t got = decompress((char*)data + done, len - done);
+        if (!got && in_pos == had && !eof)
+            corrupted("save file corrupted -- block truncated");
+        done += got;
     }
-    return zs.next_out - (Bytef*)data;
-#else
-    return raw_read(data, len);
-#endif
+    return done;
 }
 
 void chunk_reader::read_all(vector<char> &data)
@@ -9,6 +9,12 @@
 #ifdef USE_ZLIB
 #include <zlib.h>
 #endif
+#ifdef USE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
 
 #if !defined(DGAMELAUNCH) && !defined(__ANDROID__) && !defined(DEBUG_DIAGNOSTICS)
 #define DO_FSYNC
@@ -18,7 +24,22 @@
 
 typedef uint32_t plen_t;
 
+// How a chunk's contents are compressed. Saves from before the codec was
+// recorded use zlib throughout, so it must stay 0.
+enum package_codec
+{
+    CODEC_ZLIB,
+    CODEC_NONE,
+    CODEC_LZ4,
+    CODEC_ZSTD,
+    NUM_CODECS
+};
+
+const char *codec_name(package_codec codec);
+bool codec_supported(package_codec codec);
+
 class package;
+struct package_async;
 
 class chunk_writer
 {
@@ -28,14 +49,26 @@ private:
     plen_t first_block;
     plen_t cur_block;
     plen_t block_len;
+    package_codec codec;
+    unsigned char *z_buffer;
+    plen_t z_size, z_used;
 #ifdef USE_ZLIB
     z_stream zs;
-    Bytef *z_buffer;
 #endif
+#ifdef USE_LZ4
+    LZ4F_cctx *lz4;
+#endif
+#ifdef USE_ZSTD
+    ZSTD_CStream *zstd;
+#endif
+    void compress(const void *data, plen_t len, bool finish);
+    void flush_buffer();
+    void end_codec();
     void raw_write(const void *data, plen_t len);
     void finish_block(plen_t next);
 public:
     chunk_writer(package *parent, const string &_name);
+    chunk_writer(package *parent, const string &_name, package_codec _codec);
     ~chunk_writer();
     void write(const void *data, plen_t len);
     friend class package;
@@ -44,16 +77,25 @@ public:
 class chunk_reader
 {
 private:
-    chunk_reader(package *parent, plen_t start);
-    void init(plen_t start);
+    chunk_reader(package *parent, plen_t start, package_codec _codec);
+    void init(plen_t start, package_codec _codec);
     package *pkg;
     plen_t first_block, next_block;
     plen_t off, block_left;
-#ifdef USE_ZLIB
+    package_codec codec;
     bool eof;
+    unsigned char z_buffer[32768];
+    plen_t in_pos, in_len;
+#ifdef USE_ZLIB
     z_stream zs;
-    Bytef z_buffer[32768];
 #endif
+#ifdef USE_LZ4
+    LZ4F_dctx *lz4;
+#endif
+#ifdef USE_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+    plen_t decompress(void *data, plen_t len);
     plen_t raw_read(void *data, plen_t len);
 public:
     chunk_reader(package *parent, const string &_name);
@@ -71,7 +113,19 @@ public:
     ~package();
     chunk_writer* writer(const string &name);
     chunk_reader* reader(const string &name);
+    // The codec for chunks written from now on. The directory itself is
+    // always zlib, so that any version can find its way into the save.
+    void set_codec(package_codec codec);
+    package_codec get_chunk_codec(const string &name);
     void commit();
+    bool compact();
+    // Write an already marshalled chunk, or commit, on a background thread.
+    // Anything else that changes the package waits for it first, so the
+    // chunks in a commit are always the ones written before it was asked
+    // for.
+    void write_chunk_async(const string &name, vector<unsigned char> &&data);
+    void commit_async();
+    void finish_async();
     void delete_chunk(const string &name);
     bool has_chunk(const string &name);
     vector<string> list_chunks();
@@ -80,7 +134,7 @@ public:
 
     // statistics
     plen_t get_slack();
-    plen_t get_size() const { return file_len; };
+    plen_t get_size();
     plen_t get_chunk_fragmentation(const string &name);
     plen_t get_chunk_compressed_length(const string &name);
 private:
@@ -95,14 +149,19 @@ private:
     bool tmp;
 #endif
     map<string, plen_t> directory;
+    // Chunks not compressed with zlib.
+    map<string, package_codec> codecs;
+    package_codec codec;
     map<plen_t, plen_t> free_blocks;
     vector<plen_t> unlinked_blocks;
     map<plen_t, pair<plen_t, plen_t> > block_map;
     set<plen_t> new_chunks;
     map<plen_t, uint32_t> reader_count;
+    unique_ptr<package_async> async;
+    void commit_now();
     plen_t extend_block(plen_t at, plen_t size, plen_t by);
     plen_t alloc_block(plen_t &size);
-    void finish_chunk(const string &name, plen_t at);
+    void finish_chunk(const string &name, plen_t at, package_codec ch_codec);
     void free_chunk(const string &name);
     plen_t write_directory();
     void collect_blocks();
@@ -116,6 +175,7 @@ private:
     void load_traces();
     friend class chunk_writer;
     friend class chunk_reader;
+    friend struct package_async;
 };
 
 #endif
@@ -50,6 +50,18 @@ void seed_rng()
     _seed_rng(seed_key, ARRAYSZ(seed_key));
 }
 
+rng_substream::rng_substream(uint64_t key, uint64_t subkey)
+    : saved(rngs[RNG_GAMEPLAY])
+{
+    uint64_t seed_key[2] = { key, subkey };
+    rngs[RNG_GAMEPLAY] = PcgRNG(seed_key, ARRAYSZ(seed_key));
+}
+
+rng_substream::~rng_substream()
+{
+    rngs[RNG_GAMEPLAY] = saved;
+}
+
 // [low, high]
 int random_range(int low, int high)
 {
@@ -7,11 +7,25 @@
 #include <vector>
 
 #include "hash.h"
+#include "pcg.h"
 
 void seed_rng();
 void seed_rng(uint32_t seed);
 void seed_rng(uint64_t[], int);
 
+// While one of these is in scope, the gameplay RNG draws from a stream of
+// its own, seeded from the keys. The gameplay stream picks up where it left
+// off once it is gone.
+class rng_substream
+{
+public:
+    rng_substream(uint64_t key, uint64_t subkey);
+    ~rng_substream();
+
+private:
+    PcgRNG saved;
+};
+
 uint32_t get_uint32(int generator = RNG_GAMEPLAY);
 uint64_t get_uint64(int generator = RNG_GAMEPLAY);
 bool coinflip();
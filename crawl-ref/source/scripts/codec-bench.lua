@@ -0,0 +1,47 @@
+-- Compares the compression codecs available for save files, by copying the
+-- chunks of some real saves into scratch saves with each codec and reading
+-- them back.
+--
+-- Usage: crawl -script codec-bench [rounds] <save file>...
+
+local args = script.simple_args()
+local rounds = 5
+if tonumber(args[1]) then
+  rounds = tonumber(table.remove(args, 1))
+end
+if #args == 0 then
+  script.usage("Usage: crawl -script codec-bench [rounds] <save file>...")
+end
+
+local codecs = { "zlib", "none", "lz4", "zstd" }
+local totals = { }
+for _, codec in ipairs(codecs) do
+  totals[codec] = { write = 0, read = 0, size = 0 }
+end
+
+for _, file in ipairs(args) do
+  for _, codec in ipairs(codecs) do
+    local write_ms, read_ms, size = debug.codec_bench(file, codec, rounds)
+    if write_ms then
+      local t = totals[codec]
+      t.write = t.write + write_ms
+      t.read = t.read + read_ms
+      t.size = t.size + size
+    else
+      totals[codec] = nil
+    end
+  end
+end
+
+crawl.stderr(string.format("%d saves:", #args))
+for _, codec in ipairs(codecs) do
+  local t = totals[codec]
+  if t then
+    crawl.stderr(string.format("%-5s write: %8.2f ms, read: %8.2f ms, "
+                               .. "size: %6.2f MB",
+                               codec, t.write, t.read,
+                               t.size / (1024 * 1024)))
+  else
+    crawl.stderr(string.format("%-5s not in this build", codec))
+  end
+end
@@ -0,0 +1,69 @@
+-- Measures cell_see_cell() latency and the memory used by its cache.
+-- To compare cache layouts, run this with builds with and without
+-- COMPACT_GLOBALLOS (see AppHdr.h).
+--
+-- Usage: crawl -script los-bench [place] [levels] [queries per level]
+
+local args = script.simple_args()
+local place = args[1] or "D:10"
+local nlevels = tonumber(args[2] or 20)
+local nqueries = tonumber(args[3] or 200000)
+
+-- Queries cluster around the monsters of the level, as in play.
+local function query_centres()
+  local yx, yy = you.pos()
+  local centres = { dgn.point(yx, yy) }
+  for mons in test.level_monster_iterator() do
+    -- Monster coordinates are relative to the player.
+    table.insert(centres, dgn.point(yx + mons.x, yy + mons.y))
+  end
+  return centres
+end
+
+local function run_queries(centres)
+  local seen = 0
+  for i = 1, nqueries do
+    local c = centres[crawl.random_range(1, #centres)]
+    local x = c.x + crawl.random_range(-8, 8)
+    local y = c.y + crawl.random_range(-8, 8)
+    if dgn.in_bounds(x, y) then
+      seen = seen + los.cell_see_cell(c.x, c.y, x, y)
+    end
+  end
+  return seen
+end
+
+local _, compact = los.cache_memory()
+local rss_start = debug.rss()
+local total_ms, max_mem = 0, 0
+
+debug.goto_place(place)
+for lev = 1, nlevels do
+  debug.flush_map_memory()
+  debug.generate_level()
+  local centres = query_centres()
+  los.reset_cache_stats()
+
+  local start = crawl.millis()
+  run_queries(centres)
+  total_ms = total_ms + crawl.millis() - start
+
+  local mem = los.cache_memory()
+  if mem > max_mem then
+    max_mem = mem
+  end
+end
+
+local stats = los.cache_stats()
+crawl.stderr(string.format("layout: %s", compact and "compact" or "flat"))
+crawl.stderr(string.format("cell_see_cell: %.3f us/query (%d queries)",
+                           total_ms * 1000 / (nlevels * nqueries),
+                           nlevels * nqueries))
+crawl.stderr(string.format("last level: %d hits, %d misses",
+                           stats.hits, stats.misses))
+crawl.stderr(string.format("cache memory: %d KiB at most",
+                           max_mem / 1024))
+if rss_start then
+  crawl.stderr(string.format("RSS: %d KiB at start, %d KiB at end",
+                             rss_start, debug.rss()))
+end
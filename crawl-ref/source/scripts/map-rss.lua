@@ -0,0 +1,32 @@
+-- Measures the memory a game spends on vaults: the index of every map,
+-- loaded at startup, and the full definitions of the maps placed while
+-- generating levels. Shared memory is mostly the mapped des caches, which
+-- all games on a server have in common; the rest is this game's own.
+--
+-- Usage: crawl -script map-rss [place] [levels]
+
+local args = script.simple_args()
+local place = args[1] or "D:10"
+local nlevels = tonumber(args[2] or 20)
+
+local function report(when)
+  local maps, map_def_size, loaded = debug.map_stats()
+  local resident, shared = debug.rss()
+  local mem = "unknown"
+  if resident then
+    mem = string.format("%d KiB resident, %d KiB shared, %d KiB private",
+                        resident, shared, resident - shared)
+  end
+  crawl.stderr(string.format("%s: %s; %d maps (%d bytes each as map_def, "
+                             .. "%d KiB in all), %d fully loaded",
+                             when, mem, maps, map_def_size,
+                             maps * map_def_size / 1024, loaded))
+end
+
+report("after startup")
+debug.goto_place(place)
+for lev = 1, nlevels do
+  debug.flush_map_memory()
+  debug.generate_level()
+end
+report(string.format("after %d levels at %s", nlevels, place))
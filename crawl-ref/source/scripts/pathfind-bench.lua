@@ -0,0 +1,39 @@
+-- Measures monster_pathfind latency on freshly generated levels, both for
+-- searches across the whole level and for short chases like those of
+-- monsters tracking the player.
+--
+-- Usage: crawl -script pathfind-bench [place] [levels] [searches per level]
+
+local args = script.simple_args()
+local place = args[1] or "D:10"
+local nlevels = tonumber(args[2] or 20)
+local nsearches = tonumber(args[3] or 2000)
+
+local runs = {
+  { name = "any distance", max_dist = nil },
+  { name = "chase (<= 8)", max_dist = 8 },
+}
+
+for _, run in ipairs(runs) do
+  run.ns = 0
+  run.found = 0
+end
+
+debug.goto_place(place)
+for lev = 1, nlevels do
+  debug.flush_map_memory()
+  debug.generate_level()
+  for _, run in ipairs(runs) do
+    local ns, found = debug.pathfind_bench(nsearches, run.max_dist)
+    if ns then
+      run.ns = run.ns + ns
+      run.found = run.found + found
+    end
+  end
+end
+
+for _, run in ipairs(runs) do
+  crawl.stderr(string.format("%s: %.0f ns/search, %d of %d found",
+                             run.name, run.ns / nlevels, run.found,
+                             nlevels * nsearches))
+end
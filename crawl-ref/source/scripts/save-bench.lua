@@ -0,0 +1,28 @@
+-- Measures how long saving the game and reloading a level take, and the
+-- rate at which the save file is written.
+--
+-- Usage: crawl -script save-bench [rounds] [save name]
+--
+-- With a save name, that game (from the save directory) is restored and
+-- timed, and it is saved over, so use a copy of a late-game save. Without
+-- one, a level of Depths is generated and saved to a scratch save.
+
+local args = script.simple_args()
+local rounds = tonumber(args[1] or 20)
+local save_name = args[2]
+
+if not save_name then
+  debug.goto_place("Depths:3")
+  debug.flush_map_memory()
+  debug.generate_level()
+end
+
+local save_ms, load_ms, size = debug.save_bench(rounds, save_name)
+if not save_ms then
+  error("Couldn't restore " .. save_name)
+end
+
+local mb = size / (1024 * 1024)
+crawl.stderr(string.format("save: %.2f ms (%.1f MB/s), level load: %.2f ms, "
+                           .. "save size: %.2f MB",
+                           save_ms, mb / (save_ms / 1000), load_ms, mb))
@@ -523,6 +523,8 @@ void show_update_at(const coord_def &gp, layers_type layers)
             update_item_at(gp);
     }
 
+    travel_cell_changed(gp);
+
 #ifdef USE_TILE
     tile_draw_map_cell(gp, true);
 #endif
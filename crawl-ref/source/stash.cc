@@ -794,6 +794,18 @@ bool LevelStashes::needs_visit(const coord_def& c, bool autopickup) const
     return shop_needs_visit(c);
 }
 
+void LevelStashes::get_visit_squares(vector<coord_def> &squares,
+                                     bool autopickup) const
+{
+    for (const auto &entry : m_stashes)
+        if (needs_visit(entry.first, autopickup))
+            squares.push_back(entry.first);
+
+    for (const ShopInfo &shop : m_shops)
+        if (!shop.is_visited())
+            squares.push_back(shop.where());
+}
+
 bool LevelStashes::needs_stop(const coord_def &c) const
 {
     const Stash *s = find_stash(c);
@@ -98,6 +98,7 @@ public:
     void write(FILE *f, bool identify = false) const;
     void show_menu(const level_pos& place) const;
 
+    coord_def where() const { return shop.pos; }
     bool is_at(coord_def other) const { return shop.pos == other; }
     bool is_visited() const { return !shop.stock.empty(); }
 
@@ -187,6 +188,8 @@ public:
     // swag that merits a personal visit (for EXPLORE_GREEDY).
     bool  needs_visit(const coord_def& c, bool autopickup) const;
     bool  shop_needs_visit(const coord_def& c) const;
+    // Adds every square on the level that needs_visit() to squares.
+    void  get_visit_squares(vector<coord_def> &squares, bool autopickup) const;
 
     // Returns true if the items at c are not fully known to the stash-tracker
     // and the items are not all handled by autopickup.
@@ -21,6 +21,7 @@
 # include <fcntl.h>
 # include <sys/types.h>
 # include <sys/stat.h>
+# include <sys/mman.h>
 #endif
 
 #include "files.h"
@@ -532,3 +533,80 @@ int open_u(const char *pathname, int flags, mode_t mode)
     return open(OUTS(pathname), flags, mode);
 #endif
 }
+
+/**
+ * Map a whole file into memory, read-only. The mapping is shared with any
+ * other process mapping the same file, and stays valid even if the file is
+ * later replaced via rename.
+ *
+ * @param pathname The file to map.
+ * @param[out] size The size of the mapping.
+ * @return The start of the mapping, or nullptr if the file couldn't be
+ *         mapped (including if it is empty).
+ */
+const void *map_file_u(const char *pathname, size_t *size)
+{
+#ifdef TARGET_OS_WINDOWS
+    HANDLE fh = CreateFileW(OUTW(pathname), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+    if (fh == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    LARGE_INTEGER len;
+    if (!GetFileSizeEx(fh, &len) || !len.QuadPart
+        || (uint64_t)len.QuadPart > (size_t)-1)
+    {
+        CloseHandle(fh);
+        return nullptr;
+    }
+
+    HANDLE mh = CreateFileMappingW(fh, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(fh);
+    if (!mh)
+        return nullptr;
+
+    // The view keeps the mapping object alive.
+    const void *addr = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mh);
+    if (!addr)
+        return nullptr;
+    *size = len.QuadPart;
+    return addr;
+#else
+# ifdef __ANDROID__
+    // Assets live inside the apk; callers fall back to reading.
+    if (strstr(pathname, ANDROID_ASSETS) == pathname)
+        return nullptr;
+# endif
+    int fd = open(OUTS(pathname), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size <= 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return nullptr;
+    *size = st.st_size;
+    return addr;
+#endif
+}
+
+void unmap_file_u(const void *addr, size_t size)
+{
+    if (!addr)
+        return;
+#ifdef TARGET_OS_WINDOWS
+    UNUSED(size);
+    UnmapViewOfFile(addr);
+#else
+    munmap(const_cast<void *>(addr), size);
+#endif
+}
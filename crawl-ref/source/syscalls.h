@@ -38,4 +38,7 @@ FILE *fopen_u(const char *path, const char *mode);
 int mkdir_u(const char *pathname, mode_t mode);
 int open_u(const char *pathname, int flags, mode_t mode);
 
+const void *map_file_u(const char *pathname, size_t *size);
+void unmap_file_u(const void *addr, size_t size);
+
 #endif
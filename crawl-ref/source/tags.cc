@@ -98,7 +98,8 @@ extern set<pair<string, level_id> > auto_unique_annotations;
 extern abyss_state abyssal_state;
 
 reader::reader(const string &_read_filename, int minorVersion)
-    : _filename(_read_filename), _chunk(0), _pbuf(nullptr), _read_offset(0),
+    : _filename(_read_filename), _chunk(0), _pbuf(nullptr), _pbuf_size(0),
+      _read_offset(0), _staged(0), _stage_offset(0),
       _minorVersion(minorVersion), _safe_read(false)
 {
     _file       = fopen_u(_filename.c_str(), "rb");
@@ -106,8 +107,9 @@ reader::reader(const string &_read_filename, int minorVersion)
 }
 
 reader::reader(package *save, const string &chunkname, int minorVersion)
-    : _file(0), _chunk(0), opened_file(false), _pbuf(0), _read_offset(0),
-     _minorVersion(minorVersion), _safe_read(false)
+    : _file(0), _chunk(0), opened_file(false), _pbuf(0), _pbuf_size(0),
+      _read_offset(0), _staged(0), _stage_offset(0),
+      _minorVersion(minorVersion), _safe_read(false)
 {
     ASSERT(save);
     _chunk = new chunk_reader(save, chunkname);
@@ -141,8 +143,7 @@ void reader::advance(size_t offset)
 
 bool reader::valid() const
 {
-    return (_file && !feof(_file)) ||
-           (_pbuf && _read_offset < _pbuf->size());
+    return (_file && !feof(_file)) || _read_offset < _pbuf_size;
 }
 
 static NORETURN void _short_read(bool safe_read)
@@ -154,8 +155,17 @@ static NORETURN void _short_read(bool safe_read)
     die_noline("short read while reading save");
 }
 
-// Reads input in network byte order, from a file or buffer.
-unsigned char reader::readByte()
+// Refill the stage from the chunk, returning how much was read.
+size_t reader::fill_stage()
+{
+    _stage_offset = 0;
+    _staged = _chunk->read(_stage, sizeof(_stage));
+    return _staged;
+}
+
+// Reads input in network byte order, from a file or buffer. The common
+// cases, staged chunk data and in-memory buffers, are handled by readByte().
+unsigned char reader::read_unstaged()
 {
     if (_file)
     {
@@ -166,16 +176,14 @@ unsigned char reader::readByte()
     }
     else if (_chunk)
     {
-        unsigned char buf;
-        if (_chunk->read(&buf, 1) != 1)
+        if (!fill_stage())
             _short_read(_safe_read);
-        return buf;
+        return _stage[_stage_offset++];
     }
     else
     {
-        if (_read_offset >= _pbuf->size())
-            _short_read(_safe_read);
-        return (*_pbuf)[_read_offset++];
+        _short_read(_safe_read);
+        return 0;
     }
 }
 
@@ -193,15 +201,38 @@ void reader::read(void *data, size_t size)
     }
     else if (_chunk)
     {
-        if (_chunk->read(data, size) != size)
-            _short_read(_safe_read);
+        unsigned char *cdata = static_cast<unsigned char*>(data);
+        while (size)
+        {
+            if (_stage_offset == _staged)
+            {
+                // Large reads go straight through.
+                if (size >= sizeof(_stage) && cdata)
+                {
+                    if (_chunk->read(cdata, size) != size)
+                        _short_read(_safe_read);
+                    return;
+                }
+                if (!fill_stage())
+                    _short_read(_safe_read);
+            }
+
+            const size_t len = min(size, _staged - _stage_offset);
+            if (cdata)
+            {
+                memcpy(cdata, _stage + _stage_offset, len);
+                cdata += len;
+            }
+            _stage_offset += len;
+            size -= len;
+        }
     }
     else
     {
-        if (_read_offset+size > _pbuf->size())
+        if (_read_offset+size > _pbuf_size)
             _short_read(_safe_read);
         if (data && size)
-            memcpy(data, &(*_pbuf)[_read_offset], size);
+            memcpy(data, _pbuf + _read_offset, size);
 
         _read_offset += size;
     }
@@ -221,9 +252,9 @@ void reader::setMinorVersion(int minorVersion)
 void reader::fail_if_not_eof(const string &name)
 {
     char dummy;
-    if (_chunk ? _chunk->read(&dummy, 1) :
+    if (_chunk ? _stage_offset < _staged || _chunk->read(&dummy, 1) :
         _file ? (fgetc(_file) != EOF) :
-        _read_offset >= _pbuf->size())
+        _read_offset >= _pbuf_size)
     {
         fail("Incomplete read of \"%s\" - aborting.", name.c_str());
     }
@@ -239,13 +270,34 @@ void writer::check_ok(bool ok)
     }
 }
 
-void writer::writeByte(unsigned char ch)
+writer::~writer()
+{
+    if (_chunk)
+    {
+        flush_stage();
+        delete _chunk;
+    }
+}
+
+// Hand the staged bytes over to the chunk.
+void writer::flush_stage()
+{
+    if (_staged)
+        _chunk->write(_stage, _staged);
+    _staged = 0;
+}
+
+// Write a byte that writeByte() couldn't simply buffer.
+void writer::write_unstaged(unsigned char ch)
 {
     if (failed)
         return;
 
     if (_chunk)
-        _chunk->write(&ch, 1);
+    {
+        flush_stage();
+        _stage[_staged++] = ch;
+    }
     else if (_file)
         check_ok(fputc(ch, _file) != EOF);
     else
@@ -258,7 +310,22 @@ void writer::write(const void *data, size_t size)
         return;
 
     if (_chunk)
-        _chunk->write(data, size);
+    {
+        if (_staged + size <= sizeof(_stage))
+        {
+            memcpy(_stage + _staged, data, size);
+            _staged += size;
+            return;
+        }
+        flush_stage();
+        if (size >= sizeof(_stage))
+            _chunk->write(data, size);
+        else
+        {
+            memcpy(_stage, data, size);
+            _staged = size;
+        }
+    }
     else if (_file)
         check_ok(fwrite(data, 1, size, _file) == size);
     else
@@ -3470,6 +3537,8 @@ static void tag_read_you(reader &th)
         you.props[RU_SACRIFICE_PENALTY_KEY] = 0;
     if (th.getMinorVersion() < TAG_MINOR_ZIGFIGS)
         you.props["zig-fixup"] = true;
+    if (th.getMinorVersion() < TAG_MINOR_LEVELGEN_STREAMS)
+        you.props[GAMEPLAY_LEVELGEN_KEY] = true;
 #endif
 }
 
@@ -32,29 +32,41 @@ enum tag_type   // used during save/load process to identify data blocks
  * writer API
  * *********************************************************************** */
 
+// Bytes bound for a package chunk are staged in this many bytes and handed
+// over in bulk, as every call into the chunk goes through zlib.
+#define TAG_STAGE_SIZE 4096
+
 class writer
 {
 public:
     writer(const string &filename, FILE* output, bool ignore_errors = false)
         : _filename(filename), _file(output), _chunk(0),
-          _ignore_errors(ignore_errors), _pbuf(0), failed(false)
+          _ignore_errors(ignore_errors), _pbuf(0), _staged(0), failed(false)
     {
         ASSERT(output);
     }
     writer(vector<unsigned char>* poutput)
         : _filename(), _file(0), _chunk(0), _ignore_errors(false),
-          _pbuf(poutput), failed(false) { ASSERT(poutput); }
+          _pbuf(poutput), _staged(0), failed(false) { ASSERT(poutput); }
     writer(package *save, const string &chunkname)
         : _filename(), _file(0), _chunk(0), _ignore_errors(false),
-          failed(false)
+          _pbuf(0), _staged(0), failed(false)
     {
         ASSERT(save);
         _chunk = save->writer(chunkname);
     }
 
-    ~writer() { if (_chunk) delete _chunk; }
+    ~writer();
 
-    void writeByte(unsigned char byte);
+    void writeByte(unsigned char byte)
+    {
+        if (_pbuf)
+            _pbuf->push_back(byte);
+        else if (_chunk && _staged < sizeof(_stage))
+            _stage[_staged++] = byte;
+        else
+            write_unstaged(byte);
+    }
     void write(const void *data, size_t size);
     long tell();
 
@@ -62,6 +74,8 @@ public:
 
 private:
     void check_ok(bool ok);
+    void write_unstaged(unsigned char byte);
+    void flush_stage();
 
 private:
     string _filename;
@@ -71,6 +85,9 @@ private:
 
     vector<unsigned char>* _pbuf;
 
+    unsigned char _stage[TAG_STAGE_SIZE];
+    size_t _staged;
+
     bool failed;
 };
 
@@ -99,16 +116,31 @@ public:
     reader(const string &filename, int minorVersion = TAG_MINOR_INVALID);
     reader(FILE* input, int minorVersion = TAG_MINOR_INVALID)
         : _file(input), _chunk(0), opened_file(false), _pbuf(0),
-          _read_offset(0), _minorVersion(minorVersion), _safe_read(false) {}
+          _pbuf_size(0), _read_offset(0), _staged(0), _stage_offset(0),
+          _minorVersion(minorVersion), _safe_read(false) {}
     reader(const vector<unsigned char>& input,
            int minorVersion = TAG_MINOR_INVALID)
-        : _file(0), _chunk(0), opened_file(false), _pbuf(&input),
-          _read_offset(0), _minorVersion(minorVersion), _safe_read(false) {}
+        : _file(0), _chunk(0), opened_file(false), _pbuf(input.data()),
+          _pbuf_size(input.size()), _read_offset(0), _staged(0),
+          _stage_offset(0), _minorVersion(minorVersion), _safe_read(false) {}
+    // Read from memory that outlives the reader, such as a mapped file.
+    reader(const unsigned char *input, size_t size,
+           int minorVersion = TAG_MINOR_INVALID)
+        : _file(0), _chunk(0), opened_file(false), _pbuf(input),
+          _pbuf_size(size), _read_offset(0), _staged(0), _stage_offset(0),
+          _minorVersion(minorVersion), _safe_read(false) {}
     reader(package *save, const string &chunkname,
            int minorVersion = TAG_MINOR_INVALID);
     ~reader();
 
-    unsigned char readByte();
+    unsigned char readByte()
+    {
+        if (_stage_offset < _staged)
+            return _stage[_stage_offset++];
+        if (_read_offset < _pbuf_size)
+            return _pbuf[_read_offset++];
+        return read_unstaged();
+    }
     void read(void *data, size_t size);
     void advance(size_t size);
     int getMinorVersion() const;
@@ -121,13 +153,22 @@ public:
 
     void set_safe_read(bool setting) { _safe_read = setting; }
 
+private:
+    unsigned char read_unstaged();
+    size_t fill_stage();
+
 private:
     string _filename;
     FILE* _file;
     chunk_reader *_chunk;
     bool  opened_file;
-    const vector<unsigned char>* _pbuf;
-    unsigned int _read_offset;
+    const unsigned char* _pbuf;
+    size_t _pbuf_size;
+    size_t _read_offset;
+    // Read ahead from _chunk.
+    unsigned char _stage[TAG_STAGE_SIZE];
+    size_t _staged;
+    size_t _stage_offset;
     int _minorVersion;
     // always throw an exception rather than dying when reading past EOF
     bool _safe_read;
@@ -0,0 +1,24 @@
+-- Test that a level built ahead (pregen_levels) comes out the same as one
+-- built when the player arrives, whatever was drawn from the gameplay
+-- random stream in between, so that a seeded game has the same levels
+-- with the option on or off.
+
+local function test_level_both_ways(place)
+  crawl.message("Building " .. place .. " ahead and in place")
+  debug.goto_place(place)
+  debug.flush_map_memory()
+  dgn.reset_level()
+  local ahead, here = debug.build_level_both_ways()
+  if not ahead then
+    -- Not on this system, or the child failed.
+    crawl.message("Couldn't build " .. place .. " ahead, skipping")
+    return
+  end
+  test.map_assert(ahead == here,
+                  place .. " built ahead differs from " .. place
+                    .. " built in place")
+end
+
+for _, place in ipairs({ "D:2", "D:9", "Orc:1", "Lair:3", "Depths:2" }) do
+  test_level_both_ways(place)
+end
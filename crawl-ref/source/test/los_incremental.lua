@@ -0,0 +1,68 @@
+-- Check that updating the cell_see_cell() cache after a single terrain
+-- change gives the same answers as recomputing everything.
+
+local floor = dgn.find_feature_number("floor")
+local RANGE = 8
+
+local function origins_around(cx, cy)
+  local origins = { }
+  for dy = -4, 4, 4 do
+    for dx = -4, 4, 4 do
+      if dgn.in_bounds(cx + dx, cy + dy) then
+        table.insert(origins, dgn.point(cx + dx, cy + dy))
+      end
+    end
+  end
+  return origins
+end
+
+local function all_csc(origins)
+  local res = { }
+  for _, o in ipairs(origins) do
+    for y = -RANGE, RANGE do
+      for x = -RANGE, RANGE do
+        if dgn.in_bounds(o.x + x, o.y + y) then
+          table.insert(res, los.cell_see_cell(o.x, o.y, o.x + x, o.y + y))
+        end
+      end
+    end
+  end
+  return res
+end
+
+local function test_incremental_update()
+  you.random_teleport()
+  local cx, cy = you.pos()
+  local origins = origins_around(cx, cy)
+
+  -- Fill the cache, then change one cell.
+  all_csc(origins)
+  local x, y
+  repeat
+    x = cx + crawl.random_range(-RANGE, RANGE)
+    y = cy + crawl.random_range(-RANGE, RANGE)
+  until dgn.in_bounds(x, y) and (x ~= cx or y ~= cy)
+  local feat = dgn.grid(x, y) == floor and "stone_wall" or "floor"
+  dgn.terrain_changed(x, y, feat, false, false)
+
+  local updated = all_csc(origins)
+  debug.los_changed()
+  local fresh = all_csc(origins)
+  for i = 1, #fresh do
+    assert(updated[i] == fresh[i],
+           "cell_see_cell stale after changing (" .. x .. "," .. y
+           .. ") to " .. feat)
+  end
+end
+
+debug.goto_place("D:3")
+for lev = 1, 3 do
+  debug.flush_map_memory()
+  debug.generate_level()
+  for t = 1, 10 do
+    test_incremental_update()
+  end
+end
+
+local stats = los.cache_stats()
+assert(stats.pairs_kept > 0, "local invalidation dropped every pair")
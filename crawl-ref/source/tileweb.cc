@@ -6,6 +6,7 @@
 
 #include <cerrno>
 #include <cstdarg>
+#include <chrono>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -17,6 +18,7 @@
 #include "command.h"
 #include "coord.h"
 #include "directn.h"
+#include "end.h"
 #include "english.h"
 #include "env.h"
 #include "files.h"
@@ -36,6 +38,7 @@
 #include "skills.h"
 #include "state.h"
 #include "stringutil.h"
+#include "syscalls.h"
 #include "throw.h"
 #include "tiledef-dngn.h"
 #include "tiledef-gui.h"
@@ -65,8 +68,44 @@ static unsigned int get_milliseconds()
 
 TilesFramework tiles;
 
+// Adds the time until the end of the scope to a total, if there is one.
+class timed_scope
+{
+public:
+    explicit timed_scope(TilesFramework::output_time *total)
+        : m_total(total)
+    {
+        if (m_total)
+            m_start = chrono::steady_clock::now();
+    }
+
+    ~timed_scope()
+    {
+        if (!m_total)
+            return;
+        m_total->calls++;
+        m_total->nsecs += chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - m_start).count();
+    }
+
+private:
+    TilesFramework::output_time *m_total;
+    chrono::steady_clock::time_point m_start;
+};
+
 TilesFramework::TilesFramework()
     : m_crt_mode(CRT_NORMAL),
+      m_zstream_open(false),
+      m_zstream_new(false),
+      m_frame_bytes_in(0),
+      m_frame_bytes_out(0),
+      m_client_zstream_open(false),
+      m_client_bytes_in(0),
+      m_client_bytes_out(0),
+      m_record(nullptr),
+      m_replay_next(0),
+      m_input_polls(0),
+      m_timers(),
       m_controlled_from_web(false),
       m_last_ui_state(UI_INIT),
       m_view_loaded(false),
@@ -75,6 +114,14 @@ TilesFramework::TilesFramework()
       m_current_flash_colour(BLACK),
       m_next_flash_colour(BLACK),
       m_need_full_map(true),
+      m_cells_scanned(0),
+      m_cells_sent(0),
+      m_total_cells_scanned(0),
+      m_total_cells_sent(0),
+      m_packed_map(false),
+      m_map_updates(0),
+      m_map_bytes(0),
+      m_packed_map_bytes(0),
       m_text_crt("crt"),
       m_text_menu("menu_txt"),
       m_print_fg(15)
@@ -91,6 +138,18 @@ TilesFramework::~TilesFramework()
 
 void TilesFramework::shutdown()
 {
+    if (m_record)
+    {
+        _print_timers();
+        fclose(m_record);
+        m_record = nullptr;
+    }
+
+    if (m_zstream_open)
+        deflateEnd(&m_zstream);
+    if (m_client_zstream_open)
+        deflateEnd(&m_client_zstream);
+
     if (m_sock_name.empty())
         return;
 
@@ -111,10 +170,36 @@ bool TilesFramework::initialise()
     // Initially, switch to CRT.
     cgotoxy(1, 1, GOTO_CRT);
 
-    if (m_sock_name.empty())
+    if (!m_record_name.empty())
+    {
+        m_record = fopen_u(m_record_name.c_str(), "w");
+        if (!m_record)
+        {
+            die("Can't open the webtiles recording %s: %s",
+                m_record_name.c_str(), strerror(errno));
+        }
+        // The seed is what lets a replay play out the same way.
+        _record("=", make_stringf("{\"version\":\"%s\",\"seed\":%u}",
+                                  Version::Long, Options.seed));
+    }
+
+    if (!m_replay_name.empty())
+        _load_replay();
+    else if (m_sock_name.empty())
         return true;
+    else
+        _open_socket();
 
-    // Init socket
+    _send_version();
+    send_exit_reason("unknown");
+    _send_options();
+    _send_layout();
+
+    return true;
+}
+
+void TilesFramework::_open_socket()
+{
     m_sock = socket(PF_UNIX, SOCK_DGRAM, 0);
     if (m_sock < 0)
         die("Can't open the webtiles socket!");
@@ -138,13 +223,6 @@ bool TilesFramework::initialise()
 
     if (m_await_connection)
         _await_connection();
-
-    _send_version();
-    send_exit_reason("unknown");
-    _send_options();
-    _send_layout();
-
-    return true;
 }
 
 string TilesFramework::get_message()
@@ -154,6 +232,7 @@ string TilesFramework::get_message()
 
 void TilesFramework::write_message(const char *format, ...)
 {
+    timed_scope timing(_timer(WT_JSON));
     char buf[2048];
     int len;
 
@@ -173,63 +252,290 @@ void TilesFramework::finish_message()
     if (m_msg_buf.size() == 0)
         return;
 
+    if (m_record)
+        _record(">", m_msg_buf);
+
     if (m_sock_name.empty())
     {
+        if (!m_replay_name.empty())
+            _replay_deflate();
         m_msg_buf.clear();
         return;
     }
 
     m_msg_buf.append("\n");
-    const char* fragment_start = m_msg_buf.data();
-    const char* data_end = m_msg_buf.data() + m_msg_buf.size();
+
+    // Game messages are deflated once for all the receivers that take
+    // frames; messages for the server itself stay readable.
+    char type = '.';
+    if (m_msg_buf[0] != '*'
+        && any_of(m_dest_addrs.begin(), m_dest_addrs.end(),
+                  [](const dest_addr &dest) { return dest.frames; }))
+    {
+        timed_scope timing(_timer(WT_DEFLATE));
+        _deflate_message();
+        type = m_zstream_new ? 'Z' : 'z';
+        m_zstream_new = false;
+    }
+
+    timed_scope timing(_timer(WT_WRITE));
+    for (unsigned int i = 0; i < m_dest_addrs.size(); ++i)
+    {
+        const dest_addr &dest = m_dest_addrs[i];
+        bool gone = false;
+        if (!(dest.frames ? _send_to(dest, type == '.' ? m_msg_buf
+                                                       : m_frame_buf, type,
+                                     &gone)
+                          : _send_to(dest, m_msg_buf, 0, &gone)))
+        {
+            // Forget the dead; the others may catch up.
+            if (!dest.primary && !gone)
+            {
+                m_dropped_addrs.push_back(dest);
+                m_dropped_addrs.back().told_dropped = false;
+            }
+            m_dest_addrs.erase(m_dest_addrs.begin() + i);
+            i--;
+        }
+    }
+    m_msg_buf.clear();
+    m_need_flush = true;
+
+    for (unsigned int i = 0; i < m_dropped_addrs.size(); ++i)
+    {
+        dest_addr &dest = m_dropped_addrs[i];
+        bool gone = false;
+        if (!dest.told_dropped)
+            dest.told_dropped = _tell_dropped(dest, &gone);
+        if (gone)
+        {
+            m_dropped_addrs.erase(m_dropped_addrs.begin() + i);
+            i--;
+        }
+    }
+}
+
+// Tell a dropped receiver that it was dropped, once its socket has room
+// again. It may have part of a message, which it throws away; it asks for
+// everything again with "spectator_joined". Receivers that take frames get
+// this as a '!' frame.
+bool TilesFramework::_tell_dropped(const dest_addr &dest, bool *gone)
+{
+    return _send_to(dest, "*{\"msg\":\"dropped\"}\n",
+                    dest.frames ? '!' : 0, gone);
+}
+
+void TilesFramework::_forget_dropped(const sockaddr_un &addr)
+{
+    for (auto it = m_dropped_addrs.begin(); it != m_dropped_addrs.end(); ++it)
+        if (!strcmp(it->addr.sun_path, addr.sun_path))
+        {
+            m_dropped_addrs.erase(it);
+            return;
+        }
+}
+
+// Send a message to one receiver, in fragments. Returns false if the
+// receiver is gone (and then sets *gone, if given) or, for one that isn't
+// primary, has fallen behind;
+// that can happen in the middle of a message, so a dropped receiver is
+// told to throw away what it has (see _tell_dropped()).
+//
+// Messages end with a newline, unless the receiver takes frames: then
+// each fragment starts with '+' if more of the message follows, or else
+// with the type of the message (see _deflate_message()).
+bool TilesFramework::_send_to(const dest_addr &dest, const string &data,
+                              char type, bool *gone)
+{
+    const int max_size = type ? m_max_msg_size - 1 : m_max_msg_size;
+    const char* fragment_start = data.data();
+    const char* data_end = data.data() + data.size();
+    string frame;
     while (fragment_start < data_end)
     {
         int fragment_size = data_end - fragment_start;
-        if (fragment_size > m_max_msg_size)
-            fragment_size = m_max_msg_size;
+        if (fragment_size > max_size)
+            fragment_size = max_size;
 
-        for (unsigned int i = 0; i < m_dest_addrs.size(); ++i)
+        const char* buf = fragment_start;
+        int buf_size = fragment_size;
+        if (type)
         {
-            int retries = 30;
-            ssize_t sent = 0;
-            while (sent < fragment_size)
+            frame.assign(1, fragment_start + fragment_size < data_end ? '+'
+                                                                      : type);
+            frame.append(fragment_start, fragment_size);
+            buf = frame.data();
+            buf_size = frame.size();
+        }
+
+        const bool may_drop = !dest.primary;
+        int retries = 30;
+        ssize_t sent = 0;
+        while (sent < buf_size)
+        {
+            ssize_t retval = sendto(m_sock, buf + sent,
+                buf_size - sent, may_drop ? MSG_DONTWAIT : 0,
+                (sockaddr*) &dest.addr, sizeof(sockaddr_un));
+            if (retval <= 0)
             {
-                ssize_t retval = sendto(m_sock, fragment_start + sent,
-                    fragment_size - sent, 0, (sockaddr*) &m_dest_addrs[i],
-                    sizeof(sockaddr_un));
-                if (retval <= 0)
+                const char *errmsg = retval == 0 ? "No bytes sent"
+                                                 : strerror(errno);
+                if (retval == 0 || errno == ENOBUFS || errno == EWOULDBLOCK
+                    || errno == EINTR || errno == EAGAIN)
                 {
-                    const char *errmsg = retval == 0 ? "No bytes sent"
-                                                     : strerror(errno);
-                    if (--retries <= 0)
-                        die("Socket write error: %s", errmsg);
-
-                    if (retval == 0 || errno == ENOBUFS || errno == EWOULDBLOCK
-                        || errno == EINTR || errno == EAGAIN)
-                    {
-                        // Wait for half a second at first (up to five), then
-                        // try again.
-                        usleep(retries <= 10 ? 5000 * 1000 : 500 * 1000);
-                    }
-                    else if (errno == ECONNREFUSED || errno == ENOENT)
+                    if (may_drop)
                     {
-                        // the other side is dead
-                        m_dest_addrs.erase(m_dest_addrs.begin() + i);
-                        i--;
-                        break;
+                        // It can get everything again when a spectator
+                        // joins there.
+                        dprf("Dropping receiver %s: %s", dest.addr.sun_path,
+                             errmsg);
+                        return false;
                     }
-                    else
+                    if (--retries <= 0)
                         die("Socket write error: %s", errmsg);
+
+                    // Wait for half a second at first (up to five), then
+                    // try again.
+                    usleep(retries <= 10 ? 5000 * 1000 : 500 * 1000);
+                }
+                else if (errno == ECONNREFUSED || errno == ENOENT)
+                {
+                    // the other side is dead
+                    if (gone)
+                        *gone = true;
+                    return false;
                 }
                 else
-                    sent += retval;
+                    die("Socket write error: %s", errmsg);
             }
+            else
+                sent += retval;
         }
 
         fragment_start += fragment_size;
     }
-    m_msg_buf.clear();
-    m_need_flush = true;
+    return true;
+}
+
+void TilesFramework::_add_receiver(const sockaddr_un &addr, bool primary,
+                                   bool frames)
+{
+    for (const dest_addr &dest : m_dest_addrs)
+        if (!strcmp(dest.addr.sun_path, addr.sun_path))
+            return;
+    // It starts over, so it's no longer waiting to be taken back.
+    _forget_dropped(addr);
+
+    dest_addr dest = { addr, primary, false, true };
+    // Everything after this reply is framed.
+    if (frames && _send_to(dest, "*{\"msg\":\"frames\"}\n", 0))
+    {
+        dest.frames = true;
+        _reset_frames();
+    }
+    m_dest_addrs.push_back(dest);
+}
+
+// Start a new deflate stream, so that receivers can begin reading there.
+void TilesFramework::_reset_frames()
+{
+    if (m_zstream_open)
+        deflateReset(&m_zstream);
+    else
+    {
+        m_zstream.zalloc = Z_NULL;
+        m_zstream.zfree  = Z_NULL;
+        m_zstream.opaque = Z_NULL;
+        if (deflateInit2(&m_zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                         -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            die("Can't initialise webtiles compression: %s", m_zstream.msg);
+        }
+        m_zstream_open = true;
+    }
+    m_zstream_new = true;
+}
+
+static void _deflate_flushed(z_stream &zs, const string &in, string &out)
+{
+    out.clear();
+    zs.next_in = (Bytef *) in.data();
+    zs.avail_in = in.size();
+
+    char buf[16384];
+    do
+    {
+        zs.next_out = (Bytef *) buf;
+        zs.avail_out = sizeof(buf);
+        if (deflate(&zs, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+            die("Webtiles compression failed!");
+        out.append(buf, sizeof(buf) - zs.avail_out);
+    }
+    while (zs.avail_out == 0);
+
+    out.resize(out.size() - 4);
+}
+
+// Deflate the message buffer into m_frame_buf. As in the deflate-frame
+// websocket extension, each message is sync flushed and the empty block
+// that ends the flush (00 00 ff ff) is left off, so the server can send it
+// to clients unchanged. Frames are of type 'Z' if they start a new stream,
+// else 'z'; other messages are '.'.
+void TilesFramework::_deflate_message()
+{
+    _deflate_flushed(m_zstream, m_msg_buf, m_frame_buf);
+    m_frame_bytes_in += m_msg_buf.size();
+    m_frame_bytes_out += m_frame_buf.size();
+}
+
+// A replay has no receivers, but deflates each game message as if one
+// took frames, into nothing. For comparison, it also does what the server
+// does for each client that doesn't: deflate a flush's messages at once,
+// as {"msgs":[...]} (see _deflate_client_batch()).
+void TilesFramework::_replay_deflate()
+{
+    if (m_msg_buf[0] == '*')
+        return;
+
+    m_msg_buf.append("\n");
+    {
+        timed_scope timing(_timer(WT_DEFLATE));
+        if (!m_zstream_open)
+            _reset_frames();
+        _deflate_message();
+    }
+
+    if (!m_client_batch.empty())
+        m_client_batch += ",";
+    m_client_batch.append(m_msg_buf, 0, m_msg_buf.size() - 1);
+}
+
+void TilesFramework::_deflate_client_batch()
+{
+    if (m_client_batch.empty())
+        return;
+
+    const string batch = "{\"msgs\":[" + m_client_batch + "]}";
+    m_client_batch.clear();
+
+    timed_scope timing(_timer(WT_CLIENT_DEFLATE));
+    if (!m_client_zstream_open)
+    {
+        m_client_zstream.zalloc = Z_NULL;
+        m_client_zstream.zfree  = Z_NULL;
+        m_client_zstream.opaque = Z_NULL;
+        if (deflateInit2(&m_client_zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                         -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            die("Can't initialise webtiles compression: %s",
+                m_client_zstream.msg);
+        }
+        m_client_zstream_open = true;
+    }
+    string out;
+    _deflate_flushed(m_client_zstream, batch, out);
+    m_client_bytes_in += batch.size();
+    m_client_bytes_out += out.size();
 }
 
 void TilesFramework::send_message(const char *format, ...)
@@ -261,6 +567,150 @@ void TilesFramework::flush_messages()
         send_message("*{\"msg\":\"flush_messages\"}");
         m_need_flush = false;
     }
+    if (!m_replay_name.empty())
+        _deflate_client_batch();
+}
+
+TilesFramework::output_time *TilesFramework::_timer(webtiles_timer timer)
+{
+    return m_record || !m_replay_name.empty() ? &m_timers[timer] : nullptr;
+}
+
+// Recordings are lines of text: "=" and a header, then "<" for each input
+// with how it was received (see _replay_input()), and ">" for each message
+// sent.
+void TilesFramework::_record(const char *prefix, const string &data)
+{
+    fprintf(m_record, "%s %s\n", prefix, data.c_str());
+}
+
+// A key read from the terminal is recorded as a key control message, so a
+// replay feeds it back like one from the web.
+void TilesFramework::record_key(int key)
+{
+    if (!m_record)
+        return;
+
+    _record(m_stdin_received.empty() ? "< b 0" : m_stdin_received.c_str(),
+            make_stringf("{\"msg\":\"key\",\"keycode\":%d}", key));
+    m_stdin_received.clear();
+}
+
+void TilesFramework::_load_replay()
+{
+    FILE *f = fopen_u(m_replay_name.c_str(), "r");
+    if (!f)
+    {
+        die("Can't open the webtiles recording %s: %s",
+            m_replay_name.c_str(), strerror(errno));
+    }
+
+    string line;
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), f))
+    {
+        line += buf;
+        if (line.back() != '\n' && !feof(f))
+            continue;
+
+        char how;
+        int polls, start;
+        if (sscanf(line.c_str(), "< %c %d %n", &how, &polls, &start) == 2)
+        {
+            m_replay_inputs.push_back({ how == 'b', polls,
+                                        trimmed_string(line.substr(start)) });
+        }
+        line.clear();
+    }
+    fclose(f);
+}
+
+// Feed the next recorded input to a blocking call; a poll only gets one if
+// it was received by a poll, after as many that found nothing.
+bool TilesFramework::_replay_input(wint_t& c, bool block)
+{
+    while (true)
+    {
+        if (m_replay_next == m_replay_inputs.size() && block)
+            _finish_replay();
+
+        if (m_replay_next == m_replay_inputs.size()
+            || !block && (m_replay_inputs[m_replay_next].block
+                          || m_replay_inputs[m_replay_next].polls
+                             > m_input_polls))
+        {
+            m_input_polls++;
+            return false;
+        }
+
+        if (block)
+            flush_messages();
+
+        const replay_input &input = m_replay_inputs[m_replay_next++];
+        if (m_record)
+        {
+            _record(make_stringf("< %c %d", block ? 'b' : 'p',
+                                 m_input_polls).c_str(), input.data);
+        }
+        m_input_polls = 0;
+
+        sockaddr_un addr;
+        addr.sun_family = AF_UNIX;
+        addr.sun_path[0] = '\0';
+        try
+        {
+            c = _handle_control_message(addr, input.data);
+        }
+        catch (JsonWrapper::MalformedException&)
+        {
+            dprf("Malformed control message!");
+            c = 0;
+        }
+
+        if (c != 0)
+            return true;
+    }
+}
+
+void TilesFramework::_finish_replay()
+{
+    flush_messages();
+    fprintf(stderr, "Replayed %u inputs from %s.\n",
+            (unsigned int) m_replay_inputs.size(), m_replay_name.c_str());
+    const uint64_t updates = max<uint64_t>(m_map_updates, 1);
+    const uint64_t turns = max(you.num_turns, 1);
+    fprintf(stderr, "Map: %" PRIu64 " updates over %d turns; JSON: %" PRIu64
+            " bytes (%" PRIu64 "/update, %" PRIu64 "/turn); packed: %" PRIu64
+            " bytes (%" PRIu64 "/update, %" PRIu64 "/turn)\n",
+            m_map_updates, you.num_turns,
+            m_map_bytes, m_map_bytes / updates, m_map_bytes / turns,
+            m_packed_map_bytes, m_packed_map_bytes / updates,
+            m_packed_map_bytes / turns);
+    fprintf(stderr, "Game messages: %" PRIu64 " bytes, deflated once to %"
+            PRIu64 " (\"deflate\"); per client, in flushes: %" PRIu64
+            " bytes, deflated to %" PRIu64 " (\"client deflate\", for each"
+            " client)\n", m_frame_bytes_in, m_frame_bytes_out,
+            m_client_bytes_in, m_client_bytes_out);
+    _print_timers();
+    end(0);
+}
+
+void TilesFramework::_print_timers()
+{
+    static const char *names[] =
+    {
+        "_send_map", "_send_player", "_send_cell", "JSON output", "deflate",
+        "writes", "client deflate",
+    };
+    COMPILE_CHECK(ARRAYSZ(names) == NUM_WEBTILES_TIMERS);
+
+    for (int i = 0; i < NUM_WEBTILES_TIMERS; ++i)
+    {
+        const output_time &t = m_timers[i];
+        fprintf(stderr, "%-14s %10" PRIu64 " calls %10.1f ms %8.2f us/call\n",
+                names[i], t.calls, t.nsecs / 1e6,
+                t.calls ? t.nsecs / 1e3 / t.calls : 0.0);
+    }
 }
 
 void TilesFramework::_await_connection()
@@ -272,7 +722,7 @@ void TilesFramework::_await_connection()
         _receive_control_message();
 }
 
-wint_t TilesFramework::_receive_control_message()
+wint_t TilesFramework::_receive_control_message(bool block)
 {
     if (m_sock_name.empty())
         return 0;
@@ -291,6 +741,12 @@ wint_t TilesFramework::_receive_control_message()
         die("Socket read error: %s", strerror(errno));
 
     string data(buf, len);
+    if (m_record)
+    {
+        _record(make_stringf("< %c %d", block ? 'b' : 'p',
+                             m_input_polls).c_str(), data);
+    }
+    m_input_polls = 0;
     try
     {
         return _handle_control_message(srcaddr, data);
@@ -317,8 +773,14 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     {
         JsonWrapper primary = json_find_member(obj.node, "primary");
         primary.check(JSON_BOOL);
+        JsonWrapper frames = json_find_member(obj.node, "frames");
 
-        m_dest_addrs.push_back(addr);
+        if (!m_sock_name.empty())
+        {
+            _add_receiver(addr, primary->bool_,
+                          frames.node && frames->tag == JSON_BOOL
+                          && frames->bool_);
+        }
         m_controlled_from_web = primary->bool_;
     }
     else if (msgtype == "key")
@@ -330,7 +792,27 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     }
     else if (msgtype == "spectator_joined")
     {
+        // Take back a receiver that was dropped for falling behind.
+        for (auto it = m_dropped_addrs.begin(); it != m_dropped_addrs.end();
+             ++it)
+        {
+            if (!strcmp(it->addr.sun_path, addr.sun_path))
+            {
+                // It mustn't add what comes next to a partial message.
+                bool gone = false;
+                if (!it->told_dropped)
+                    it->told_dropped = _tell_dropped(*it, &gone);
+                if (it->told_dropped)
+                    m_dest_addrs.push_back(*it);
+                if (it->told_dropped || gone)
+                    m_dropped_addrs.erase(it);
+                break;
+            }
+        }
         flush_messages();
+        // The new spectator can only read frames from a new stream.
+        if (m_zstream_open)
+            _reset_frames();
         _send_everything();
         flush_messages();
     }
@@ -356,6 +838,8 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
                                                                    (int) end->number_);
         }
     }
+    else if (msgtype == "packed_map")
+        m_packed_map = true;
     else if (msgtype == "note")
     {
         JsonWrapper content = json_find_member(obj.node, "content");
@@ -388,6 +872,9 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
 
 bool TilesFramework::await_input(wint_t& c, bool block)
 {
+    if (!m_replay_name.empty())
+        return _replay_input(c, block);
+
     int result;
     fd_set fds;
     int maxfd = m_sock_name.empty() ? STDIN_FILENO : m_sock;
@@ -418,12 +905,15 @@ bool TilesFramework::await_input(wint_t& c, bool block)
         while (result == -1 && errno == EINTR);
 
         if (result == 0)
+        {
+            m_input_polls++;
             return false;
+        }
         else if (result > 0)
         {
             if (!m_sock_name.empty() && FD_ISSET(m_sock, &fds))
             {
-                c = _receive_control_message();
+                c = _receive_control_message(block);
 
                 if (c != 0)
                     return true;
@@ -431,6 +921,15 @@ bool TilesFramework::await_input(wint_t& c, bool block)
 
             if (FD_ISSET(STDIN_FILENO, &fds))
             {
+                // The key itself is recorded by record_key() once it has
+                // been read; a poll may see it before the read blocks.
+                if (m_record && m_stdin_received.empty())
+                {
+                    m_stdin_received = make_stringf("< %c %d",
+                                                    block ? 'b' : 'p',
+                                                    m_input_polls);
+                }
+                m_input_polls = 0;
                 c = 0;
                 return true;
             }
@@ -456,6 +955,17 @@ void TilesFramework::dump()
         fprintf(stderr, "start: %d end: %d type: %c\n",
                 frame.start, frame.prefix_end, frame.type);
     }
+    fprintf(stderr, "Webtiles map cells scanned: %d, sent: %d (last update); "
+            "scanned: %" PRIu64 ", sent: %" PRIu64 " (in all)\n",
+            m_cells_scanned, m_cells_sent, m_total_cells_scanned,
+            m_total_cells_sent);
+    fprintf(stderr, "Webtiles map updates: %" PRIu64 ", bytes: %" PRIu64
+            " (%s cell encoding)\n", m_map_updates, m_map_bytes,
+            m_packed_map ? "packed" : "JSON");
+    fprintf(stderr, "Webtiles frames: %" PRIu64 " bytes deflated to %" PRIu64
+            "\n", m_frame_bytes_in, m_frame_bytes_out);
+    if (m_record || !m_replay_name.empty())
+        _print_timers();
 }
 
 void TilesFramework::send_exit_reason(const string& type, const string& message)
@@ -705,6 +1215,7 @@ player_info::player_info()
  */
 void TilesFramework::_send_player(bool force_full)
 {
+    timed_scope timing(_timer(WT_SEND_PLAYER));
     player_info& c = m_current_player_info;
 
     json_open_object();
@@ -1112,12 +1623,217 @@ static inline void _write_tileidx(tileidx_t t)
         tiles.write_message("[%d,%d]", lo, hi);
 }
 
+// The compact encoding of map cells, for clients that ask for it with a
+// "packed_map" message. Each cell that changed is a record of varints:
+// how many cells on (in map order) it is from the last one, which fields
+// follow (as packed_field bits), and then those fields. Tile indices are
+// unsigned and other numbers zigzag coded. Cells with monsters, dolls or
+// monster tiles still go in "cells" as JSON. packed_cells.js decodes this.
+enum packed_field
+{
+    PF_FEAT,
+    PF_MAP_FEAT,
+    PF_GLYPH,
+    PF_COLOUR,
+    PF_FG,
+    PF_BASE,
+    PF_BG,
+    PF_CLOUD,
+    PF_BLOODY,
+    PF_OLD_BLOOD,
+    PF_SILENCED,
+    PF_HALO,
+    PF_MOLDY,
+    PF_GLOWING_MOLD,
+    PF_SANCTUARY,
+    PF_LIQUEFIED,
+    PF_ORB_GLOW,
+    PF_QUAD_GLOW,
+    PF_DISJUNCT,
+    PF_MANGROVE_WATER,
+    PF_BLOOD_ROTATION,
+    PF_TRAVEL_TRAIL,
+    PF_HEAT_AURA,
+    PF_FLAVOUR,
+    PF_OVERLAYS,
+};
+
+static void _pack_uint(string &buf, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        buf += (char) (value & 0x7f | 0x80);
+        value >>= 7;
+    }
+    buf += (char) value;
+}
+
+static void _pack_int(string &buf, int value)
+{
+    _pack_uint(buf, ((uint32_t) value << 1) ^ (uint32_t) (value >> 31));
+}
+
+static string _base64(const string &data)
+{
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    string out;
+    out.reserve((data.size() + 2) / 3 * 4);
+    for (size_t i = 0; i < data.size(); i += 3)
+    {
+        const size_t left = data.size() - i;
+        const uint32_t n = (uint8_t) data[i] << 16
+                           | (left > 1 ? (uint8_t) data[i + 1] << 8 : 0)
+                           | (left > 2 ? (uint8_t) data[i + 2] : 0);
+        out += digits[n >> 18 & 63];
+        out += digits[n >> 12 & 63];
+        out += left > 1 ? digits[n >> 6 & 63] : '=';
+        out += left > 2 ? digits[n & 63] : '=';
+    }
+    return out;
+}
+
+// Only cells with monsters or dolls need the full encoding.
+static bool _can_pack_cell(const screen_cell_t &next_sc,
+                           const map_cell &current_mc, const map_cell &next_mc)
+{
+    const tileidx_t fg_idx = next_sc.tile.fg & TILE_FLAG_MASK;
+    return !current_mc.monsterinfo() && !next_mc.monsterinfo()
+           && fg_idx < TILE_MAIN_MAX && fg_idx < TILEP_MCACHE_START
+           && fg_idx != TILEP_PLAYER;
+}
+
+// Add a record for a cell to buf, unless nothing about it changed. The same
+// fields are sent as by _send_cell().
+static bool _pack_cell(string &buf, int skip,
+                       const screen_cell_t &current_sc,
+                       const screen_cell_t &next_sc,
+                       const map_cell &current_mc, const map_cell &next_mc,
+                       bool force_full)
+{
+    uint32_t mask = 0;
+    string fields;
+    auto pack = [&](packed_field field, bool changed, int value)
+    {
+        if (changed)
+        {
+            mask |= 1 << field;
+            _pack_int(fields, value);
+        }
+    };
+
+    pack(PF_FEAT, current_mc.feat() != next_mc.feat(), next_mc.feat());
+
+    const map_feature mf = get_cell_map_feature(next_mc);
+    pack(PF_MAP_FEAT, get_cell_map_feature(current_mc) != mf, mf);
+
+    const char32_t glyph = next_sc.glyph;
+    if (current_sc.glyph != glyph)
+    {
+        mask |= 1 << PF_GLYPH;
+        _pack_uint(fields, glyph);
+    }
+    const int col = (_get_brand(next_sc.colour) << 4)
+                    | macro_colour(next_sc.colour & 0xF);
+    pack(PF_COLOUR, (current_sc.colour != next_sc.colour
+                     || current_sc.glyph == ' ') && glyph != ' ', col);
+
+    const packed_cell &next_pc = next_sc.tile;
+    const packed_cell &current_pc = current_sc.tile;
+    const tileidx_t fg_idx = next_pc.fg & TILE_FLAG_MASK;
+
+    if (next_pc.fg != current_pc.fg)
+    {
+        mask |= 1 << PF_FG;
+        _pack_uint(fields, next_pc.fg);
+        pack(PF_BASE, fg_idx && fg_idx <= TILE_MAIN_MAX,
+             tileidx_known_base_item(fg_idx));
+    }
+    if (next_pc.bg != current_pc.bg)
+    {
+        mask |= 1 << PF_BG;
+        _pack_uint(fields, next_pc.bg);
+    }
+    if (next_pc.cloud != current_pc.cloud)
+    {
+        mask |= 1 << PF_CLOUD;
+        _pack_uint(fields, next_pc.cloud);
+    }
+
+    pack(PF_BLOODY, next_pc.is_bloody != current_pc.is_bloody,
+         next_pc.is_bloody);
+    pack(PF_OLD_BLOOD, next_pc.old_blood != current_pc.old_blood,
+         next_pc.old_blood);
+    pack(PF_SILENCED, next_pc.is_silenced != current_pc.is_silenced,
+         next_pc.is_silenced);
+    pack(PF_HALO, next_pc.halo != current_pc.halo, next_pc.halo);
+    pack(PF_MOLDY, next_pc.is_moldy != current_pc.is_moldy,
+         next_pc.is_moldy);
+    pack(PF_GLOWING_MOLD, next_pc.glowing_mold != current_pc.glowing_mold,
+         next_pc.glowing_mold);
+    pack(PF_SANCTUARY, next_pc.is_sanctuary != current_pc.is_sanctuary,
+         next_pc.is_sanctuary);
+    pack(PF_LIQUEFIED, next_pc.is_liquefied != current_pc.is_liquefied,
+         next_pc.is_liquefied);
+    pack(PF_ORB_GLOW, next_pc.orb_glow != current_pc.orb_glow,
+         next_pc.orb_glow);
+    pack(PF_QUAD_GLOW, next_pc.quad_glow != current_pc.quad_glow,
+         next_pc.quad_glow);
+    pack(PF_DISJUNCT, next_pc.disjunct != current_pc.disjunct,
+         next_pc.disjunct);
+    pack(PF_MANGROVE_WATER, next_pc.mangrove_water != current_pc.mangrove_water,
+         next_pc.mangrove_water);
+    pack(PF_BLOOD_ROTATION, next_pc.blood_rotation != current_pc.blood_rotation,
+         next_pc.blood_rotation);
+    pack(PF_TRAVEL_TRAIL, next_pc.travel_trail != current_pc.travel_trail,
+         next_pc.travel_trail);
+#if TAG_MAJOR_VERSION == 34
+    pack(PF_HEAT_AURA, next_pc.heat_aura != current_pc.heat_aura,
+         next_pc.heat_aura);
+#endif
+
+    if (_needs_flavour(next_pc) &&
+        (next_pc.flv.floor != current_pc.flv.floor
+         || next_pc.flv.special != current_pc.flv.special
+         || !_needs_flavour(current_pc)
+         || force_full))
+    {
+        mask |= 1 << PF_FLAVOUR;
+        _pack_int(fields, next_pc.flv.floor);
+        _pack_int(fields, next_pc.flv.special);
+    }
+
+    bool overlays_changed =
+        next_pc.num_dngn_overlay != current_pc.num_dngn_overlay;
+    for (int i = 0; i < next_pc.num_dngn_overlay && !overlays_changed; i++)
+        if (next_pc.dngn_overlay[i] != current_pc.dngn_overlay[i])
+            overlays_changed = true;
+    if (overlays_changed)
+    {
+        mask |= 1 << PF_OVERLAYS;
+        _pack_uint(fields, next_pc.num_dngn_overlay);
+        for (int i = 0; i < next_pc.num_dngn_overlay; ++i)
+            _pack_int(fields, next_pc.dngn_overlay[i]);
+    }
+
+    if (!mask)
+        return false;
+
+    _pack_uint(buf, skip);
+    _pack_uint(buf, mask);
+    buf += fields;
+    return true;
+}
+
 void TilesFramework::_send_cell(const coord_def &gc,
                                 const screen_cell_t &current_sc, const screen_cell_t &next_sc,
                                 const map_cell &current_mc, const map_cell &next_mc,
                                 map<uint32_t, coord_def>& new_monster_locs,
                                 bool force_full)
 {
+    timed_scope timing(_timer(WT_SEND_CELL));
+
     if (current_mc.feat() != next_mc.feat())
         json_write_int("f", next_mc.feat());
 
@@ -1358,26 +2074,50 @@ void TilesFramework::_mcache_ref(bool inc)
 {
     for (int y = 0; y < GYM; y++)
         for (int x = 0; x < GXM; x++)
-        {
-            coord_def gc(x, y);
+            _mcache_ref(coord_def(x, y), inc);
+}
 
-            int fg_idx = m_current_view(gc).tile.fg & TILE_FLAG_MASK;
-            if (fg_idx >= TILEP_MCACHE_START)
-            {
-                mcache_entry *entry = mcache.get(fg_idx);
-                if (entry)
-                {
-                    if (inc)
-                        entry->inc_ref();
-                    else
-                        entry->dec_ref();
-                }
-            }
+void TilesFramework::_mcache_ref(const coord_def &gc, bool inc)
+{
+    int fg_idx = m_current_view(gc).tile.fg & TILE_FLAG_MASK;
+    if (fg_idx >= TILEP_MCACHE_START)
+    {
+        mcache_entry *entry = mcache.get(fg_idx);
+        if (entry)
+        {
+            if (inc)
+                entry->inc_ref();
+            else
+                entry->dec_ref();
         }
+    }
+}
+
+// The cells to look at for a map update, in order: every cell, or only
+// those marked dirty since the last one.
+vector<int> TilesFramework::_map_cells_to_send(bool force_full)
+{
+    vector<int> cells;
+    if (force_full)
+    {
+        cells.resize(GXM * GYM);
+        for (int i = 0; i < GXM * GYM; i++)
+            cells[i] = i;
+    }
+    else
+    {
+        sort(m_dirty_list.begin(), m_dirty_list.end());
+        for (int i : m_dirty_list)
+            if (m_dirty_cells[i] && (cells.empty() || cells.back() != i))
+                cells.push_back(i);
+    }
+    m_dirty_list.clear();
+    return cells;
 }
 
 void TilesFramework::_send_map(bool force_full)
 {
+    timed_scope timing(_timer(WT_SEND_MAP));
     map<uint32_t, coord_def> new_monster_locs;
 
     force_full = force_full || m_need_full_map;
@@ -1415,74 +2155,146 @@ void TilesFramework::_send_map(bool force_full)
 
     coord_def last_gc(0, 0);
     bool send_gc = true;
+    string packed;
+    int last_packed = -1;
+    // A replay has no client to pick an encoding, so it sends JSON and packs
+    // alongside, to compare sizes.
+    const bool replay = !m_replay_name.empty();
+    int64_t packing_saves = 0;
+
+    const vector<int> cells = _map_cells_to_send(force_full);
+    m_cells_scanned = cells.size();
+    m_cells_sent = 0;
 
     json_open_array("cells");
-    for (int y = 0; y < GYM; y++)
-        for (int x = 0; x < GXM; x++)
-        {
-            coord_def gc(x, y);
+    for (int i : cells)
+    {
+        const int x = i % GXM, y = i / GXM;
+        coord_def gc(x, y);
 
-            if (!is_dirty(gc) && !force_full)
-                continue;
+        if (cell_needs_redraw(gc))
+        {
+            screen_cell_t *cell = &m_next_view(gc);
 
-            if (cell_needs_redraw(gc))
-            {
-                screen_cell_t *cell = &m_next_view(gc);
+            draw_cell(cell, gc, false, m_current_flash_colour);
+            cell->tile.flv = env.tile_flv(gc);
+            pack_cell_overlays(gc, &(cell->tile));
+        }
 
-                draw_cell(cell, gc, false, m_current_flash_colour);
-                cell->tile.flv = env.tile_flv(gc);
-                pack_cell_overlays(gc, &(cell->tile));
-            }
+        mark_clean(gc);
 
-            mark_clean(gc);
+        if (m_origin.equals(-1, -1))
+            m_origin = gc;
 
-            if (m_origin.equals(-1, -1))
-                m_origin = gc;
+        const screen_cell_t& sc = force_full ? default_cell
+            : m_current_view(gc);
+        const map_cell& mc = force_full ? default_map_cell
+            : m_current_map_knowledge(gc);
 
-            json_open_object();
-            if (send_gc
-                || last_gc.x + 1 != gc.x
-                || last_gc.y != gc.y)
+        const bool packable = (m_packed_map || replay)
+            && _can_pack_cell(m_next_view(gc), mc, env.map_knowledge(gc));
+        if (packable && !replay)
+        {
+            timed_scope cell_timing(_timer(WT_SEND_CELL));
+            if (_pack_cell(packed, i - last_packed, sc, m_next_view(gc),
+                           mc, env.map_knowledge(gc), force_full))
             {
-                json_write_int("x", x - m_origin.x);
-                json_write_int("y", y - m_origin.y);
-                json_treat_as_empty();
+                last_packed = i;
+                m_cells_sent++;
             }
+            continue;
+        }
+        else if (packable
+                 && _pack_cell(packed, i - last_packed, sc, m_next_view(gc),
+                               mc, env.map_knowledge(gc), force_full))
+        {
+            last_packed = i;
+        }
+        const size_t cell_start = m_msg_buf.size();
 
-            const screen_cell_t& sc = force_full ? default_cell
-                : m_current_view(gc);
-            const map_cell& mc = force_full ? default_map_cell
-                : m_current_map_knowledge(gc);
-            _send_cell(gc,
-                       sc,
-                       m_next_view(gc),
-                       mc, env.map_knowledge(gc),
-                       new_monster_locs, force_full);
-
-            if (!json_is_empty())
-            {
-                send_gc = false;
-                last_gc = gc;
-            }
-            json_close_object(true);
+        json_open_object();
+        if (send_gc
+            || last_gc.x + 1 != gc.x
+            || last_gc.y != gc.y)
+        {
+            json_write_int("x", x - m_origin.x);
+            json_write_int("y", y - m_origin.y);
+            json_treat_as_empty();
+        }
+
+        _send_cell(gc,
+                   sc,
+                   m_next_view(gc),
+                   mc, env.map_knowledge(gc),
+                   new_monster_locs, force_full);
+
+        if (!json_is_empty())
+        {
+            send_gc = false;
+            last_gc = gc;
+            m_cells_sent++;
         }
+        json_close_object(true);
+
+        if (packable)
+            packing_saves += m_msg_buf.size() - cell_start;
+    }
     json_close_array(true);
 
+    if (replay && !packed.empty())
+    {
+        packing_saves -= make_stringf(
+            ",\"packed\":{\"x\":%d,\"y\":%d,\"w\":%d,\"cells\":\"\"}",
+            m_origin.x, m_origin.y, GXM).size() + _base64(packed).size();
+    }
+    else if (!packed.empty())
+    {
+        json_open_object("packed");
+        json_write_int("x", m_origin.x);
+        json_write_int("y", m_origin.y);
+        json_write_int("w", GXM);
+        json_write_string("cells", _base64(packed));
+        json_close_object();
+    }
+
     json_close_object(true);
 
+    m_map_updates++;
+    m_map_bytes += m_msg_buf.size();
+    // Give or take the coordinates of JSON cells that follow packed ones.
+    if (replay)
+        m_packed_map_bytes += m_msg_buf.size() - packing_saves;
     finish_message();
 
     if (force_full)
         _send_cursor(CURSOR_MAP);
 
-    if (m_mcache_ref_done)
-        _mcache_ref(false);
+    // Only the cells looked at can have changed since the last update.
+    if (force_full || !m_mcache_ref_done)
+    {
+        if (m_mcache_ref_done)
+            _mcache_ref(false);
 
-    m_current_map_knowledge = env.map_knowledge;
-    m_current_view = m_next_view;
+        m_current_map_knowledge = env.map_knowledge;
+        m_current_view = m_next_view;
 
-    _mcache_ref(true);
-    m_mcache_ref_done = true;
+        _mcache_ref(true);
+        m_mcache_ref_done = true;
+    }
+    else
+    {
+        for (int i : cells)
+        {
+            const coord_def gc(i % GXM, i / GXM);
+            _mcache_ref(gc, false);
+            m_current_map_knowledge(gc) = env.map_knowledge(gc);
+            m_current_view(gc) = m_next_view(gc);
+            _mcache_ref(gc, true);
+        }
+    }
+
+    m_total_cells_scanned += m_cells_scanned;
+    m_total_cells_sent += m_cells_sent;
 
     m_monster_locs = new_monster_locs;
 }
@@ -1957,7 +2769,22 @@ void TilesFramework::mark_for_redraw(const coord_def& gc)
 
 void TilesFramework::mark_dirty(const coord_def& gc)
 {
-    m_dirty_cells[gc.y * GXM + gc.x] = true;
+    const int i = gc.y * GXM + gc.x;
+    if (!m_dirty_cells[i])
+    {
+        m_dirty_cells[i] = true;
+        m_dirty_list.push_back(i);
+    }
+
+    // Cells marked, cleaned and marked again over and over (as the view is
+    // while no one is watching) would otherwise pile up.
+    if (m_dirty_list.size() > GXM * GYM)
+    {
+        m_dirty_list.clear();
+        for (int j = 0; j < GXM * GYM; j++)
+            if (m_dirty_cells[j])
+                m_dirty_list.push_back(j);
+    }
 }
 
 void TilesFramework::mark_clean(const coord_def& gc)
@@ -1978,6 +2805,7 @@ bool TilesFramework::cell_needs_redraw(const coord_def& gc)
 
 void TilesFramework::write_message_escaped(const string& s)
 {
+    timed_scope timing(_timer(WT_JSON));
     m_msg_buf.reserve(m_msg_buf.size() + s.size());
 
     for (unsigned char c : s)
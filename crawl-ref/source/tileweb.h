@@ -9,6 +9,7 @@
 #include <bitset>
 #include <map>
 #include <sys/un.h>
+#include <zlib.h>
 
 #include "map_knowledge.h"
 #include "status.h"
@@ -33,6 +34,20 @@ enum WebtilesUIState
     UI_VIEW_MAP,
 };
 
+// Parts of the webtiles output that are timed when recording or replaying
+// a session.
+enum webtiles_timer
+{
+    WT_SEND_MAP,
+    WT_SEND_PLAYER,
+    WT_SEND_CELL,
+    WT_JSON,
+    WT_DEFLATE,
+    WT_WRITE,
+    WT_CLIENT_DEFLATE,
+    NUM_WEBTILES_TIMERS
+};
+
 struct player_info
 {
     player_info();
@@ -144,7 +159,10 @@ public:
     void send_message(PRINTF(1, ));
     void flush_messages();
 
-    bool has_receivers() { return !m_dest_addrs.empty(); }
+    bool has_receivers()
+    {
+        return !m_dest_addrs.empty() || !m_replay_name.empty();
+    }
     bool is_controlled_from_web() { return m_controlled_from_web; }
 
     /* Webtiles can receive input both via stdin, and on the
@@ -163,6 +181,8 @@ public:
        if input came via a control message.
      */
     bool await_input(wint_t& c, bool block);
+    // Record a key read from stdin after await_input().
+    void record_key(int key);
 
     void check_for_control_messages();
 
@@ -191,6 +211,15 @@ public:
 
     string m_sock_name;
     bool m_await_connection;
+    // Files to record the session to, and to replay one from.
+    string m_record_name;
+    string m_replay_name;
+
+    struct output_time
+    {
+        uint64_t calls;
+        uint64_t nsecs;
+    };
 
     WebtilesCRTMode m_crt_mode;
 
@@ -207,14 +236,76 @@ protected:
     int m_sock;
     int m_max_msg_size;
     string m_msg_buf;
-    vector<sockaddr_un> m_dest_addrs;
+    struct dest_addr
+    {
+        sockaddr_un addr;
+        // Only the receiver we were started for is waited on when its
+        // socket is full; others (servers relaying to spectators) are
+        // dropped, so they can't stall the game.
+        bool primary;
+        // Whether it takes framed datagrams, with game messages deflated.
+        bool frames;
+        // For a dropped receiver, whether it has been told so.
+        bool told_dropped;
+    };
+    vector<dest_addr> m_dest_addrs;
+    vector<dest_addr> m_dropped_addrs;
+
+    // The deflate stream shared by all receivers that take frames.
+    z_stream m_zstream;
+    bool m_zstream_open;
+    bool m_zstream_new;
+    string m_frame_buf;
+    uint64_t m_frame_bytes_in;
+    uint64_t m_frame_bytes_out;
+
+    // In a replay, what the server would deflate for each client without
+    // frames: every flush's game messages together.
+    z_stream m_client_zstream;
+    bool m_client_zstream_open;
+    string m_client_batch;
+    uint64_t m_client_bytes_in;
+    uint64_t m_client_bytes_out;
+
+    // Recording and replaying sessions. Each input is replayed at the same
+    // await_input() call it was received in: as the next blocking one,
+    // or after as many polls that found nothing as when it was recorded.
+    FILE *m_record;
+    // How the stdin input waiting to be read was received.
+    string m_stdin_received;
+    struct replay_input
+    {
+        bool block;
+        int polls;
+        string data;
+    };
+    vector<replay_input> m_replay_inputs;
+    size_t m_replay_next;
+    int m_input_polls;
+    output_time m_timers[NUM_WEBTILES_TIMERS];
 
     bool m_controlled_from_web;
     bool m_need_flush;
 
+    void _open_socket();
     void _await_connection();
+    output_time *_timer(webtiles_timer timer);
+    void _record(const char *prefix, const string &data);
+    void _load_replay();
+    bool _replay_input(wint_t& c, bool block);
+    NORETURN void _finish_replay();
+    void _print_timers();
+    bool _send_to(const dest_addr &dest, const string &data, char type,
+                  bool *gone = nullptr);
+    bool _tell_dropped(const dest_addr &dest, bool *gone = nullptr);
+    void _forget_dropped(const sockaddr_un &addr);
+    void _add_receiver(const sockaddr_un &addr, bool primary, bool frames);
+    void _reset_frames();
+    void _deflate_message();
+    void _replay_deflate();
+    void _deflate_client_batch();
     wint_t _handle_control_message(sockaddr_un addr, string data);
-    wint_t _receive_control_message();
+    wint_t _receive_control_message(bool block = true);
 
     struct JsonFrame
     {
@@ -256,6 +347,10 @@ protected:
 
     bitset<GXM * GYM> m_dirty_cells;
     bitset<GXM * GYM> m_cells_needing_redraw;
+    // Cells marked dirty since the last map update, unsorted. Cells cleaned
+    // since are left in, and may be in more than once.
+    vector<int> m_dirty_list;
+    vector<int> _map_cells_to_send(bool force_full);
     void mark_dirty(const coord_def& gc);
     void mark_clean(const coord_def& gc);
     bool is_dirty(const coord_def& gc);
@@ -267,6 +362,19 @@ protected:
     FixedArray<map_cell, GXM, GYM> m_current_map_knowledge;
     map<uint32_t, coord_def> m_monster_locs;
     bool m_need_full_map;
+    // Cells looked at and sent by the last map update, and over the game.
+    int m_cells_scanned;
+    int m_cells_sent;
+    uint64_t m_total_cells_scanned;
+    uint64_t m_total_cells_sent;
+    // Whether the client asked for the compact map cell encoding.
+    bool m_packed_map;
+    // Map updates sent over the game, and their size.
+    uint64_t m_map_updates;
+    uint64_t m_map_bytes;
+    // In a replay, the map goes out as JSON, and this is what it would have
+    // come to with the packed encoding.
+    uint64_t m_packed_map_bytes;
 
     coord_def m_cursor[CURSOR_MAX];
     coord_def m_last_clicked_grid;
@@ -296,6 +404,7 @@ protected:
 
     bool m_mcache_ref_done;
     void _mcache_ref(bool inc);
+    void _mcache_ref(const coord_def &gc, bool inc);
 
     void _send_cursor(cursor_type type);
     void _send_map(bool force_full = false);
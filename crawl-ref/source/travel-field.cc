@@ -0,0 +1,199 @@
+/**
+ * @file
+ * @brief Distances to the nearest of many goals, repaired as the map changes.
+ *
+ * Explore looks for the nearest unexplored or interesting square after
+ * almost every step, and between two steps only a few cells of the map
+ * change. Rather than flooding the level from the player each time, we keep
+ * the distance from every cell to its nearest goal. When cells change, the
+ * routes running through them are dropped and found again from the cells
+ * around them, which still know their own routes. The caller says which
+ * cells may have changed, so nothing else has to be looked at.
+**/
+
+#include "AppHdr.h"
+
+#include "travel-field.h"
+
+#include <queue>
+
+#include "coord.h"
+#include "directn.h"
+
+// If more cells than this change, search the whole level again.
+static const int MAX_REPAIRED_CELLS = GXM * GYM / 16;
+
+travel_goal_field::travel_goal_field()
+    : built(false), rebuilt(false)
+{
+}
+
+void travel_goal_field::rebuild(const travel_cost_grid_t &costs,
+                                const travel_goal_grid_t &goals)
+{
+    memcpy(cell_costs, costs, sizeof(cell_costs));
+    memcpy(cell_goals, goals, sizeof(cell_goals));
+    rebuilt = true;
+    search_all();
+}
+
+void travel_goal_field::update(const travel_cost_grid_t &costs,
+                               const travel_goal_grid_t &goals,
+                               const vector<coord_def> &changed)
+{
+    if (!built)
+    {
+        rebuild(costs, goals);
+        return;
+    }
+
+    vector<coord_def> really_changed;
+    for (const coord_def &c : changed)
+    {
+        if (costs[c.x][c.y] != cell_costs[c.x][c.y]
+            || goals[c.x][c.y] != cell_goals[c.x][c.y])
+        {
+            cell_costs[c.x][c.y] = costs[c.x][c.y];
+            cell_goals[c.x][c.y] = goals[c.x][c.y];
+            really_changed.push_back(c);
+        }
+    }
+
+    rebuilt = (int) really_changed.size() > MAX_REPAIRED_CELLS;
+    if (rebuilt)
+        search_all();
+    else if (!really_changed.empty())
+        repair(really_changed);
+}
+
+int travel_goal_field::route_from(const coord_def &c, coord_def &goal) const
+{
+    ASSERT(built);
+    if (!map_bounds(c) || dist[c.x][c.y] == INFINITE_DISTANCE)
+        return INFINITE_DISTANCE;
+
+    goal = c;
+    while (next[goal.x][goal.y] >= 0)
+        goal += Compass[next[goal.x][goal.y]];
+    return dist[c.x][c.y];
+}
+
+// The best route from c that doesn't go through cells already marked as
+// lost, if any. Returns the cost, and sets dir to where it goes next.
+static int _best_route(const travel_cost_grid_t &costs,
+                       const travel_goal_grid_t &goals,
+                       const int dist[GXM][GYM], const bool lost[GXM][GYM],
+                       const coord_def &c, int8_t &dir)
+{
+    dir = -1;
+    if (!costs[c.x][c.y])
+        return INFINITE_DISTANCE;
+
+    int best = goals[c.x][c.y] == TRAVEL_NO_GOAL ? INFINITE_DISTANCE
+                                                 : goals[c.x][c.y];
+    for (int i = 0; i < 8; ++i)
+    {
+        const coord_def n = c + Compass[i];
+        if (map_bounds(n) && !lost[n.x][n.y] && dist[n.x][n.y] < best)
+        {
+            best = dist[n.x][n.y];
+            dir = i;
+        }
+    }
+
+    return best == INFINITE_DISTANCE ? best : best + costs[c.x][c.y];
+}
+
+void travel_goal_field::search_all()
+{
+    vector<pair<int, coord_def>> seeds;
+    for (int x = 0; x < GXM; ++x)
+        for (int y = 0; y < GYM; ++y)
+        {
+            dist[x][y] = INFINITE_DISTANCE;
+            next[x][y] = -1;
+            if (cell_costs[x][y] && cell_goals[x][y] != TRAVEL_NO_GOAL)
+            {
+                dist[x][y] = cell_goals[x][y] + cell_costs[x][y];
+                seeds.emplace_back(dist[x][y], coord_def(x, y));
+            }
+        }
+
+    built = true;
+    search(seeds);
+}
+
+void travel_goal_field::repair(const vector<coord_def> &changed)
+{
+    static bool lost[GXM][GYM];
+
+    // Every route through a changed cell is lost: find them by following
+    // the routes backwards from the changed cells.
+    vector<coord_def> lost_cells(changed);
+    for (const coord_def &c : lost_cells)
+        lost[c.x][c.y] = true;
+    for (unsigned int i = 0; i < lost_cells.size(); ++i)
+    {
+        const coord_def c = lost_cells[i];
+        for (int dir = 0; dir < 8; ++dir)
+        {
+            const coord_def n = c - Compass[dir];
+            if (map_bounds(n) && !lost[n.x][n.y] && next[n.x][n.y] == dir)
+            {
+                lost[n.x][n.y] = true;
+                lost_cells.push_back(n);
+            }
+        }
+    }
+
+    for (const coord_def &c : lost_cells)
+        dist[c.x][c.y] = INFINITE_DISTANCE;
+
+    // Start again from the best of the routes that survived.
+    vector<pair<int, coord_def>> seeds;
+    for (const coord_def &c : lost_cells)
+    {
+        dist[c.x][c.y] = _best_route(cell_costs, cell_goals, dist, lost, c,
+                                     next[c.x][c.y]);
+        if (dist[c.x][c.y] != INFINITE_DISTANCE)
+            seeds.emplace_back(dist[c.x][c.y], c);
+    }
+
+    for (const coord_def &c : lost_cells)
+        lost[c.x][c.y] = false;
+
+    search(seeds);
+}
+
+// Spread routes out from the seeds to every cell they improve on.
+void travel_goal_field::search(vector<pair<int, coord_def>> &seeds)
+{
+    typedef pair<int, coord_def> queued_cell;
+    priority_queue<queued_cell, vector<queued_cell>, greater<queued_cell>>
+        queue(greater<queued_cell>(), move(seeds));
+
+    while (!queue.empty())
+    {
+        const queued_cell top = queue.top();
+        queue.pop();
+        const coord_def c = top.second;
+        if (top.first != dist[c.x][c.y])
+            continue;
+
+        for (int dir = 0; dir < 8; ++dir)
+        {
+            // Routes from n step onto c, so n gets the direction of c.
+            const coord_def n = c - Compass[dir];
+            if (!map_bounds(n) || !cell_costs[n.x][n.y])
+                continue;
+
+            const int d = top.first + cell_costs[n.x][n.y];
+            if (d < dist[n.x][n.y])
+            {
+                dist[n.x][n.y] = d;
+                next[n.x][n.y] = dir;
+                queue.emplace(d, n);
+            }
+        }
+    }
+}
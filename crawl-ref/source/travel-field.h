@@ -0,0 +1,60 @@
+/**
+ * @file
+ * @brief Distances to the nearest of many goals, repaired as the map changes.
+**/
+
+#ifndef TRAVEL_FIELD_H
+#define TRAVEL_FIELD_H
+
+#include "travel-regions.h"
+
+// The extra cost of ending a route at each cell, or TRAVEL_NO_GOAL.
+typedef int16_t travel_goal_grid_t[GXM][GYM];
+
+#define TRAVEL_NO_GOAL INT16_MAX
+
+// For every cell, the cost of the cheapest route to any goal. A route pays
+// the cost of every cell it leaves, plus the extra cost of its goal.
+class travel_goal_field
+{
+public:
+    travel_goal_field();
+
+    // Search the whole level with these costs and goals.
+    void rebuild(const travel_cost_grid_t &costs,
+                 const travel_goal_grid_t &goals);
+
+    // Bring the field up to date after the costs or goals of some cells
+    // changed. Cells in changed that are the same as before are skipped.
+    // Only the routes through the rest are searched again, unless so many
+    // changed that starting over is cheaper.
+    void update(const travel_cost_grid_t &costs,
+                const travel_goal_grid_t &goals,
+                const vector<coord_def> &changed);
+
+    bool is_built() const { return built; }
+
+    // The cost of the best route from c, or INFINITE_DISTANCE if there is
+    // none. If there is, goal is set to where it ends.
+    int route_from(const coord_def &c, coord_def &goal) const;
+
+    // Whether the last update had to search the whole level.
+    bool was_rebuilt() const { return rebuilt; }
+
+private:
+    void search_all();
+    void repair(const vector<coord_def> &changed);
+    void search(vector<pair<int, coord_def>> &seeds);
+
+    bool built;
+    bool rebuilt;
+    travel_cost_grid_t cell_costs;
+    travel_goal_grid_t cell_goals;
+    int dist[GXM][GYM];
+    // The Compass index of the next cell of each route, or -1 at its goal.
+    int8_t next[GXM][GYM];
+
+    DISALLOW_COPY_AND_ASSIGN(travel_goal_field);
+};
+
+#endif
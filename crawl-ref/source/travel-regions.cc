@@ -0,0 +1,413 @@
+/**
+ * @file
+ * @brief Hierarchical pathfinding for travel over large levels.
+ *
+ * The level is cut into square regions. Every cell on the edge of a region
+ * from which travel can step into another region is a portal, and each
+ * region remembers the cost between every pair of its portals without
+ * leaving the region. Any route is a walk inside one region after another,
+ * moving on at a portal, so the shortest route over the portals is the
+ * shortest route over the cells.
+ *
+ * For a trip, the cost from every portal to the destination is worked out
+ * once, over the portals alone. Each step then only searches the region
+ * the player is in. Regions are only measured again when the cost of a
+ * cell in or next to them changes, and the trip's costs are then worked
+ * out again.
+**/
+
+#include "AppHdr.h"
+
+#include "travel-regions.h"
+
+#include <queue>
+
+#include "coord.h"
+#include "directn.h"
+
+#define REGION_SIZE 8
+
+static const int REGIONS_X = (GXM + REGION_SIZE - 1) / REGION_SIZE;
+static const int REGIONS_Y = (GYM + REGION_SIZE - 1) / REGION_SIZE;
+static const int REGION_CELLS = REGION_SIZE * REGION_SIZE;
+
+struct travel_region
+{
+    // Cells of this region from which travel can leave it.
+    vector<coord_def> portals;
+    // For each portal, the cells in other regions it leads to.
+    vector<vector<coord_def>> exits;
+    // The cost from portal i to portal j is dist[i * portals.size() + j],
+    // and step[i * portals.size() + j] is the local index of the first
+    // cell of that route after portal i.
+    vector<int> dist;
+    vector<int8_t> step;
+    // For the current trip, the cost from each portal to the destination,
+    // and the first cell of that route after the portal.
+    vector<int> trip_dist;
+    vector<coord_def> trip_step;
+};
+
+static travel_region regions[REGIONS_X][REGIONS_Y];
+static bool regions_built = false;
+// The costs the regions were last measured with.
+static travel_cost_grid_t region_costs;
+// The index of the portal at each cell in its region's list, or -1.
+static int8_t portal_index[GXM][GYM];
+
+// The destination the portals' trip costs lead to, if they are up to date.
+static coord_def trip_dest;
+static bool trip_known = false;
+
+static coord_def _region_of(const coord_def &c)
+{
+    return coord_def(c.x / REGION_SIZE, c.y / REGION_SIZE);
+}
+
+static coord_def _region_corner(const coord_def &r)
+{
+    return r * REGION_SIZE;
+}
+
+static int _region_width(const coord_def &r)
+{
+    return min(REGION_SIZE, GXM - r.x * REGION_SIZE);
+}
+
+static int _region_height(const coord_def &r)
+{
+    return min(REGION_SIZE, GYM - r.y * REGION_SIZE);
+}
+
+static bool _in_region(const coord_def &r, const coord_def &c)
+{
+    return _region_of(c) == r;
+}
+
+static int _local_index(const coord_def &c)
+{
+    return c.x % REGION_SIZE * REGION_SIZE + c.y % REGION_SIZE;
+}
+
+static coord_def _local_cell(const coord_def &r, int index)
+{
+    return _region_corner(r)
+           + coord_def(index / REGION_SIZE, index % REGION_SIZE);
+}
+
+// Find the portals of region r, and where each of them leads.
+static void _find_portals(const coord_def &r)
+{
+    travel_region &region = regions[r.x][r.y];
+    for (const coord_def &p : region.portals)
+        portal_index[p.x][p.y] = -1;
+    region.portals.clear();
+    region.exits.clear();
+
+    const coord_def corner = _region_corner(r);
+    const int width = _region_width(r);
+    const int height = _region_height(r);
+    for (int x = 0; x < width; ++x)
+        for (int y = 0; y < height; ++y)
+        {
+            if (x > 0 && y > 0 && x < width - 1 && y < height - 1)
+                continue;
+
+            const coord_def p = corner + coord_def(x, y);
+            if (!region_costs[p.x][p.y])
+                continue;
+
+            vector<coord_def> exits;
+            for (int dir = 0; dir < 8; ++dir)
+            {
+                const coord_def q = p + Compass[dir];
+                if (map_bounds(q) && !_in_region(r, q)
+                    && region_costs[q.x][q.y])
+                {
+                    exits.push_back(q);
+                }
+            }
+
+            if (!exits.empty())
+            {
+                portal_index[p.x][p.y] = region.portals.size();
+                region.portals.push_back(p);
+                region.exits.push_back(move(exits));
+            }
+        }
+}
+
+// Costs of the cheapest routes within region r, either from origin to each
+// cell (forward) or from each cell to origin. If step is given, it gets
+// the local index of the cell each route comes from (forward) or goes to
+// next (backward), or -1 at origin and where there is no route.
+static void _search_region(const coord_def &r, const coord_def &origin,
+                           bool forward, int dist[REGION_CELLS],
+                           int step[REGION_CELLS] = nullptr)
+{
+    for (int i = 0; i < REGION_CELLS; ++i)
+    {
+        dist[i] = INFINITE_DISTANCE;
+        if (step)
+            step[i] = -1;
+    }
+
+    typedef pair<int, int> queued_cell;
+    priority_queue<queued_cell, vector<queued_cell>, greater<queued_cell>>
+        queue;
+
+    dist[_local_index(origin)] = 0;
+    queue.emplace(0, _local_index(origin));
+    while (!queue.empty())
+    {
+        const queued_cell top = queue.top();
+        queue.pop();
+        if (top.first != dist[top.second])
+            continue;
+
+        const coord_def c = _local_cell(r, top.second);
+        for (int dir = 0; dir < 8; ++dir)
+        {
+            const coord_def n = c + Compass[dir];
+            if (!map_bounds(n) || !_in_region(r, n) || !region_costs[n.x][n.y])
+                continue;
+
+            // Going forward we pay for stepping onto n, going back for
+            // stepping from n onto c.
+            const int d = top.first + (forward ? region_costs[n.x][n.y]
+                                               : region_costs[c.x][c.y]);
+            const int index = _local_index(n);
+            if (d >= dist[index])
+                continue;
+
+            dist[index] = d;
+            if (step)
+                step[index] = top.second;
+            queue.emplace(d, index);
+        }
+    }
+}
+
+static void _measure_region(const coord_def &r)
+{
+    travel_region &region = regions[r.x][r.y];
+    const int n = region.portals.size();
+    region.dist.assign(n * n, INFINITE_DISTANCE);
+    region.step.assign(n * n, -1);
+
+    int dist[REGION_CELLS];
+    int step[REGION_CELLS];
+    for (int j = 0; j < n; ++j)
+    {
+        _search_region(r, region.portals[j], false, dist, step);
+        for (int i = 0; i < n; ++i)
+        {
+            const int index = _local_index(region.portals[i]);
+            region.dist[i * n + j] = dist[index];
+            region.step[i * n + j] = step[index];
+        }
+    }
+}
+
+static void _rebuild_regions(const travel_cost_grid_t &costs)
+{
+    memcpy(region_costs, costs, sizeof(region_costs));
+    memset(portal_index, -1, sizeof(portal_index));
+    for (int rx = 0; rx < REGIONS_X; ++rx)
+        for (int ry = 0; ry < REGIONS_Y; ++ry)
+        {
+            _find_portals(coord_def(rx, ry));
+            _measure_region(coord_def(rx, ry));
+        }
+
+    regions_built = true;
+    trip_known = false;
+}
+
+void travel_regions_update(const travel_cost_grid_t &costs,
+                           const vector<coord_def> &changed)
+{
+    if (!regions_built)
+    {
+        _rebuild_regions(costs);
+        return;
+    }
+
+    // A cell's cost is part of its region's inner costs; the portals of
+    // every region next to it can move.
+    bool measure[REGIONS_X][REGIONS_Y] = {};
+    bool near[REGIONS_X][REGIONS_Y] = {};
+    bool any_changed = false;
+    for (const coord_def &c : changed)
+    {
+        if (costs[c.x][c.y] == region_costs[c.x][c.y])
+            continue;
+
+        region_costs[c.x][c.y] = costs[c.x][c.y];
+        any_changed = true;
+
+        const coord_def r = _region_of(c);
+        measure[r.x][r.y] = true;
+        for (int dir = 0; dir < 9; ++dir)
+        {
+            const coord_def n = c + Compass[dir];
+            if (map_bounds(n))
+                near[_region_of(n).x][_region_of(n).y] = true;
+        }
+    }
+
+    if (!any_changed)
+        return;
+
+    for (int rx = 0; rx < REGIONS_X; ++rx)
+        for (int ry = 0; ry < REGIONS_Y; ++ry)
+        {
+            if (!near[rx][ry])
+                continue;
+
+            const vector<coord_def> old_portals = regions[rx][ry].portals;
+            _find_portals(coord_def(rx, ry));
+            if (regions[rx][ry].portals != old_portals)
+                measure[rx][ry] = true;
+        }
+
+    for (int rx = 0; rx < REGIONS_X; ++rx)
+        for (int ry = 0; ry < REGIONS_Y; ++ry)
+            if (measure[rx][ry])
+                _measure_region(coord_def(rx, ry));
+
+    trip_known = false;
+}
+
+// Work out the cost from every portal to dest, searching back from dest
+// over the portals.
+static void _plan_trip(const coord_def &dest)
+{
+    for (int rx = 0; rx < REGIONS_X; ++rx)
+        for (int ry = 0; ry < REGIONS_Y; ++ry)
+        {
+            travel_region &region = regions[rx][ry];
+            region.trip_dist.assign(region.portals.size(), INFINITE_DISTANCE);
+            region.trip_step.assign(region.portals.size(), coord_def());
+        }
+
+    typedef pair<int, coord_def> queued_portal;
+    priority_queue<queued_portal, vector<queued_portal>,
+                   greater<queued_portal>> queue;
+
+    const coord_def dest_region = _region_of(dest);
+    int dest_dist[REGION_CELLS];
+    int dest_step[REGION_CELLS];
+    _search_region(dest_region, dest, false, dest_dist, dest_step);
+
+    travel_region &last = regions[dest_region.x][dest_region.y];
+    for (unsigned int i = 0; i < last.portals.size(); ++i)
+    {
+        const int index = _local_index(last.portals[i]);
+        if (dest_dist[index] == INFINITE_DISTANCE)
+            continue;
+
+        last.trip_dist[i] = dest_dist[index];
+        if (dest_step[index] >= 0)
+            last.trip_step[i] = _local_cell(dest_region, dest_step[index]);
+        queue.emplace(dest_dist[index], last.portals[i]);
+    }
+
+    while (!queue.empty())
+    {
+        const queued_portal top = queue.top();
+        queue.pop();
+        const coord_def p = top.second;
+        const coord_def r = _region_of(p);
+        travel_region &region = regions[r.x][r.y];
+        const int n = region.portals.size();
+        const int i = portal_index[p.x][p.y];
+        if (top.first != region.trip_dist[i])
+            continue;
+
+        // Routes from the other portals of the region that lead through p.
+        for (int j = 0; j < n; ++j)
+        {
+            const int d = top.first + region.dist[j * n + i];
+            if (j == i || region.dist[j * n + i] == INFINITE_DISTANCE
+                || d >= region.trip_dist[j])
+            {
+                continue;
+            }
+            region.trip_dist[j] = d;
+            region.trip_step[j] = _local_cell(r, region.step[j * n + i]);
+            queue.emplace(d, region.portals[j]);
+        }
+
+        // Routes from other regions that step onto p.
+        for (const coord_def &q : region.exits[i])
+        {
+            const coord_def qr = _region_of(q);
+            travel_region &from = regions[qr.x][qr.y];
+            const int k = portal_index[q.x][q.y];
+            const int d = top.first + region_costs[p.x][p.y];
+            if (d < from.trip_dist[k])
+            {
+                from.trip_dist[k] = d;
+                from.trip_step[k] = p;
+                queue.emplace(d, q);
+            }
+        }
+    }
+
+    trip_dest = dest;
+    trip_known = true;
+}
+
+/**
+ * Find the first step of a shortest route between two cells, with the
+ * costs the regions were last brought up to date with.
+ *
+ * @param from  Where the route starts; its own cost is ignored.
+ * @param to    Where the route ends.
+ * @return The cell adjacent to from to step onto, or the origin if there
+ *         is no route.
+ */
+coord_def travel_region_step(const coord_def &from, const coord_def &to)
+{
+    ASSERT(regions_built);
+    if (!trip_known || trip_dest != to)
+        _plan_trip(to);
+
+    const coord_def from_region = _region_of(from);
+    int from_dist[REGION_CELLS];
+    int from_step[REGION_CELLS];
+    _search_region(from_region, from, true, from_dist, from_step);
+
+    // The best way out of from's region, or straight to to if it's there.
+    int best = INFINITE_DISTANCE;
+    coord_def via;
+    if (from_region == _region_of(to))
+    {
+        best = from_dist[_local_index(to)];
+        via = to;
+    }
+
+    const travel_region &start = regions[from_region.x][from_region.y];
+    for (unsigned int i = 0; i < start.portals.size(); ++i)
+    {
+        const int d = from_dist[_local_index(start.portals[i])];
+        if (d != INFINITE_DISTANCE && start.trip_dist[i] != INFINITE_DISTANCE
+            && d + start.trip_dist[i] < best)
+        {
+            best = d + start.trip_dist[i];
+            via = start.portals[i];
+        }
+    }
+
+    if (best == INFINITE_DISTANCE)
+        return coord_def();
+
+    if (via == from)
+        return start.trip_step[portal_index[from.x][from.y]];
+
+    int index = _local_index(via);
+    while (from_step[index] != _local_index(from))
+        index = from_step[index];
+    return _local_cell(from_region, index);
+}
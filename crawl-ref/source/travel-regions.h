@@ -0,0 +1,20 @@
+/**
+ * @file
+ * @brief Hierarchical pathfinding for travel over large levels.
+**/
+
+#ifndef TRAVEL_REGIONS_H
+#define TRAVEL_REGIONS_H
+
+// The cost of stepping onto each cell, or 0 where travel may not go.
+typedef uint8_t travel_cost_grid_t[GXM][GYM];
+
+// Bring the regions up to date after the costs of some cells changed. Only
+// the regions around cells whose cost is really different are measured
+// again, except the first time, when all of them are.
+void travel_regions_update(const travel_cost_grid_t &costs,
+                           const vector<coord_def> &changed);
+
+coord_def travel_region_step(const coord_def &from, const coord_def &to);
+
+#endif
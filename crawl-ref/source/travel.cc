@@ -15,6 +15,7 @@
 #include <cstdarg>
 #include <cstdio>
 #include <memory>
+#include <queue>
 #include <set>
 #include <sstream>
 
@@ -33,6 +34,7 @@
 #include "files.h"
 #include "food.h"
 #include "format.h"
+#include "hash.h"
 #include "godabil.h"
 #include "godpassive.h"
 #include "godprayer.h"
@@ -54,6 +56,8 @@
 #include "stringutil.h"
 #include "terrain.h"
 #include "traps.h"
+#include "travel-field.h"
+#include "travel-regions.h"
 #include "unicode.h"
 #include "unwind.h"
 #include "view.h"
@@ -215,6 +219,126 @@ static inline int _feature_traverse_cost(dungeon_feature_type feature)
     return 1;
 }
 
+// Let travel step onto c, whether or not it's safe.
+static void _allow_travel(travel_cost_grid_t &costs, const coord_def &c)
+{
+    costs[c.x][c.y] = _feature_traverse_cost(env.map_knowledge(c).feat());
+}
+
+// Fill costs with the cost of stepping onto each cell for travel, or 0
+// where travel may not go.
+static void _fill_travel_costs(travel_cost_grid_t &costs, bool ignore_danger,
+                               bool try_fallback = false)
+{
+    memset(costs, 0, sizeof(travel_cost_grid_t));
+    for (rectangle_iterator ri(1); ri; ++ri)
+        if (_is_travelsafe_square(*ri, false, ignore_danger, try_fallback))
+            _allow_travel(costs, *ri);
+}
+
+// The cost _fill_travel_costs() would give c.
+static uint8_t _travel_cost_at(const coord_def &c, bool ignore_danger)
+{
+    if (_is_travelsafe_square(c, false, ignore_danger))
+        return _feature_traverse_cost(env.map_knowledge(c).feat());
+    return 0;
+}
+
+// Past this many changed cells, kept routes are built again from scratch.
+static const unsigned int MAX_CHANGED_CELLS = GXM * GYM / 8;
+
+// Routes kept from one step of travel or explore to the next, and the cells
+// whose map knowledge changed since they were last brought up to date.
+struct kept_routes
+{
+    bool kept;
+    vector<coord_def> changed;
+    // What else the routes depend on, besides the map.
+    string state;
+
+    kept_routes() : kept(false) { }
+
+    void cell_changed(const coord_def &c)
+    {
+        if (!kept)
+            return;
+
+        if (changed.size() >= MAX_CHANGED_CELLS)
+            forget();
+        else
+            changed.push_back(c);
+    }
+
+    void forget()
+    {
+        kept = false;
+        changed.clear();
+    }
+
+    // Forget the routes if what they depend on is different now.
+    void check_state(const string &now)
+    {
+        if (now != state)
+            forget();
+        state = now;
+    }
+
+    // The cells to look at again, each once: the changed ones and the
+    // given ones, and their neighbours too if asked.
+    vector<coord_def> cells_to_update(const vector<coord_def> &also,
+                                      bool neighbours)
+    {
+        static bool listed[GXM][GYM];
+        changed.insert(changed.end(), also.begin(), also.end());
+
+        vector<coord_def> cells;
+        auto add = [&](const coord_def &c)
+        {
+            if (in_bounds(c) && !listed[c.x][c.y])
+            {
+                listed[c.x][c.y] = true;
+                cells.push_back(c);
+            }
+        };
+        for (const coord_def &c : changed)
+        {
+            add(c);
+            if (neighbours)
+                for (adjacent_iterator ai(c); ai; ++ai)
+                    add(*ai);
+        }
+        for (const coord_def &c : cells)
+            listed[c.x][c.y] = false;
+
+        changed.clear();
+        return cells;
+    }
+};
+
+static kept_routes explore_routes;
+static kept_routes travel_routes;
+
+void travel_cell_changed(const coord_def &c)
+{
+    explore_routes.cell_changed(c);
+    travel_routes.cell_changed(c);
+}
+
+void travel_forget_routes()
+{
+    explore_routes.forget();
+    travel_routes.forget();
+}
+
+// What travel's costs depend on about the player.
+static string _traversal_state()
+{
+    return make_stringf("%d,%d,%d,%d,%d", player_likes_water(true),
+                        player_likes_lava(true),
+                        have_passive(passive_t::water_walk),
+                        you.permanent_flight(), g_Slime_Wall_Check);
+}
+
 bool is_unknown_stair(const coord_def &p)
 {
     dungeon_feature_type feat = env.map_knowledge(p).feat();
@@ -489,6 +613,7 @@ static bool _is_safe_move(const coord_def& c)
 
 void travel_init_load_level()
 {
+    travel_forget_routes();
     curr_excludes.clear();
     travel_cache.set_level_excludes();
     travel_cache.update_waypoints();
@@ -604,6 +729,10 @@ static int _slowest_ally_speed()
 
 static void _start_running()
 {
+    // Only the cells travel is told about are looked at again, and not
+    // everything that can happen between two runs says so.
+    travel_forget_routes();
+
     _userdef_run_startrunning_hook();
     you.running.init_travel_speed();
 
@@ -666,10 +795,155 @@ static void _set_target_square(const coord_def &target)
     you.running.pos = target;
 }
 
+// Explore's routes to the nearest unexplored and greed-inducing squares,
+// kept from one step to the next, and what they were last built from.
+static travel_goal_field explore_unexplored_field;
+static travel_goal_field explore_greed_field;
+static travel_cost_grid_t explore_costs;
+static travel_goal_grid_t explore_unexplored_goals;
+static travel_goal_grid_t explore_greed_goals;
+static vector<coord_def> explore_greed_squares;
+static coord_def explore_routes_pos;
+
+static uint8_t _explore_cost_at(const coord_def &c)
+{
+    if (c == you.pos())
+        return _feature_traverse_cost(env.map_knowledge(c).feat());
+    return _travel_cost_at(c, false);
+}
+
+static int16_t _unexplored_goal_at(const coord_def &c, int16_t goal)
+{
+    if (!explore_costs[c.x][c.y])
+        return TRAVEL_NO_GOAL;
+
+    for (adjacent_iterator ai(c); ai; ++ai)
+        if (in_bounds(*ai) && !env.map_knowledge(*ai).seen())
+            return goal;
+    return TRAVEL_NO_GOAL;
+}
+
+static int16_t _greed_goal_at(const coord_def &c, int16_t goal)
+{
+    if (explore_costs[c.x][c.y] && _is_travelsafe_square(c))
+        return goal;
+    return TRAVEL_NO_GOAL;
+}
+
+// Find the explore target that the first flood of the level would find, but
+// from the routes kept from the last search. Returns the origin if there is
+// no target this way, in which case the level has to be flooded after all.
+static coord_def _explore_field_target(run_mode_type rmode)
+{
+    // The wall bias makes explore look at more than the nearest target.
+    if (Options.explore_wall_bias)
+        return coord_def();
+
+    unwind_bool slime_wall_check(g_Slime_Wall_Check,
+                                 !actor_slime_wall_immune(&you));
+
+    const bool greedy = rmode == RMODE_EXPLORE_GREEDY && can_autopickup();
+    const int greed = Options.explore_item_greed;
+    const int16_t unexplored_goal = greedy && greed > 0 ? greed : 0;
+    const int16_t greed_goal = greed < 0 ? -greed : 0;
+
+    vector<coord_def> greed_squares;
+    if (greedy)
+    {
+        if (const LevelStashes *ls = StashTrack.find_current_level())
+            ls->get_visit_squares(greed_squares, true);
+    }
+
+    explore_routes.check_state(make_stringf("%d,%d,", greedy, greed)
+                               + _traversal_state());
+
+    if (!explore_routes.kept)
+    {
+        unwind_slime_wall_precomputer slime_neighbours(g_Slime_Wall_Check);
+        _fill_travel_costs(explore_costs, false);
+        _allow_travel(explore_costs, you.pos());
+        for (rectangle_iterator ri(0); ri; ++ri)
+        {
+            explore_unexplored_goals[ri->x][ri->y] =
+                _unexplored_goal_at(*ri, unexplored_goal);
+            explore_greed_goals[ri->x][ri->y] = TRAVEL_NO_GOAL;
+        }
+        for (const coord_def &c : greed_squares)
+            explore_greed_goals[c.x][c.y] = _greed_goal_at(c, greed_goal);
+
+        explore_unexplored_field.rebuild(explore_costs,
+                                         explore_unexplored_goals);
+        if (greedy)
+            explore_greed_field.rebuild(explore_costs, explore_greed_goals);
+    }
+    else
+    {
+        // A cell's cost depends on its neighbours (slime walls), and so does
+        // whether it borders the unexplored; travel may also always leave
+        // wherever the player stands.
+        vector<coord_def> changed = explore_routes.cells_to_update(
+            { explore_routes_pos, you.pos() }, true);
+
+        for (const coord_def &c : changed)
+            explore_costs[c.x][c.y] = _explore_cost_at(c);
+        for (const coord_def &c : changed)
+        {
+            explore_unexplored_goals[c.x][c.y] =
+                _unexplored_goal_at(c, unexplored_goal);
+        }
+        explore_unexplored_field.update(explore_costs,
+                                        explore_unexplored_goals, changed);
+
+        if (greedy)
+        {
+            for (const coord_def &c : explore_greed_squares)
+                explore_greed_goals[c.x][c.y] = TRAVEL_NO_GOAL;
+            for (const coord_def &c : greed_squares)
+                explore_greed_goals[c.x][c.y] = _greed_goal_at(c, greed_goal);
+            changed.insert(changed.end(), explore_greed_squares.begin(),
+                           explore_greed_squares.end());
+            changed.insert(changed.end(), greed_squares.begin(),
+                           greed_squares.end());
+            explore_greed_field.update(explore_costs, explore_greed_goals,
+                                       changed);
+        }
+    }
+
+    explore_routes.changed.clear();
+    explore_greed_squares = move(greed_squares);
+    explore_routes_pos = you.pos();
+    explore_routes.kept = true;
+
+    coord_def unexplored_place;
+    const int unexplored_dist =
+        explore_unexplored_field.route_from(you.pos(), unexplored_place);
+
+    coord_def greedy_place;
+    int greedy_dist = INFINITE_DISTANCE;
+    if (greedy)
+        greedy_dist = explore_greed_field.route_from(you.pos(), greedy_place);
+
+    if (unexplored_dist == INFINITE_DISTANCE
+        && greedy_dist == INFINITE_DISTANCE)
+    {
+        return coord_def();
+    }
+
+    return unexplored_dist < greedy_dist ? unexplored_place : greedy_place;
+}
+
 static void _explore_find_target_square()
 {
     bool runed_door_pause = false;
 
+    const coord_def field_target =
+        _explore_field_target(static_cast<run_mode_type>(you.running.runmode));
+    if (!field_target.origin())
+    {
+        _set_target_square(field_target);
+        return;
+    }
+
     travel_pathfind tp;
     tp.set_floodseed(you.pos(), true);
 
@@ -1193,6 +1467,56 @@ coord_def travel_pathfind::pathfind(run_mode_type rmode, bool fallback_explore)
                                  !actor_slime_wall_immune(&you));
     unwind_slime_wall_precomputer slime_neighbours(g_Slime_Wall_Check);
 
+    // Travel takes its next step from a route over regions of the level,
+    // which is much cheaper than flooding all of it. Only the cells whose
+    // map knowledge changed are looked at again. The flood still has the
+    // last word if there's no route or its first step isn't safe.
+    if (runmode == RMODE_TRAVEL && !floodout && !annotate_map && !features
+        && !try_fallback)
+    {
+        static travel_cost_grid_t costs;
+        // The ends of the last route, which travel may step onto anyway.
+        static vector<coord_def> ends;
+
+        travel_routes.check_state(make_stringf("%d,", ignore_danger)
+                                  + _traversal_state());
+        vector<coord_def> changed;
+        if (!travel_routes.kept)
+        {
+            // Anything may have changed since the last trip, so compare
+            // every cell; the regions are measured again only where it did.
+            static travel_cost_grid_t fresh;
+            _fill_travel_costs(fresh, ignore_danger);
+            _allow_travel(fresh, dest);
+            _allow_travel(fresh, start);
+            for (rectangle_iterator ri(0); ri; ++ri)
+                if (fresh[ri->x][ri->y] != costs[ri->x][ri->y])
+                    changed.push_back(*ri);
+            memcpy(costs, fresh, sizeof(costs));
+        }
+        else
+        {
+            // A cell's cost depends on its neighbours only by slime walls.
+            ends.push_back(dest);
+            ends.push_back(start);
+            changed = travel_routes.cells_to_update(ends, g_Slime_Wall_Check);
+            for (const coord_def &c : changed)
+                costs[c.x][c.y] = _travel_cost_at(c, ignore_danger);
+            _allow_travel(costs, dest);
+            _allow_travel(costs, start);
+        }
+        travel_regions_update(costs, changed);
+        ends = { dest, start };
+        travel_routes.kept = true;
+
+        const coord_def step = travel_region_step(dest, start);
+        if (!step.origin() && _is_safe_move(step))
+        {
+            next_travel_move = step;
+            return travel_move();
+        }
+    }
+
     // How many points are we currently considering? We start off with just one
     // point, and spread outwards like a flood-filler.
     points = 1;
@@ -2688,8 +3012,35 @@ static int _find_transtravel_stair(const level_id &cur,
     return local_distance;
 }
 
+// If the target is a stair, we already know its distance to every other
+// stair on its level, and don't need to load the level to find out.
+static bool _cached_populate_stair_distances(const level_pos &target)
+{
+    LevelInfo &li = travel_cache.get_level_info(target.id);
+    const stair_info *from = li.get_stair(target.pos);
+    if (!from || !from->can_travel())
+        return false;
+
+    curr_stairs.clear();
+    for (stair_info si : li.get_stairs())
+    {
+        si.distance = li.distance_between(from, &si);
+        if (!si.distance && target.pos != si.position
+            || si.distance < -1)
+        {
+            si.distance = -1;
+        }
+
+        curr_stairs.push_back(si);
+    }
+    return true;
+}
+
 static bool _loadlev_populate_stair_distances(const level_pos &target)
 {
+    if (_cached_populate_stair_distances(target))
+        return true;
+
     level_excursion excursion;
     excursion.go_to(target.id);
     _populate_stair_distances(target);
@@ -3074,27 +3425,118 @@ void LevelInfo::set_distance_between_stairs(int a, int b, int dist)
     stair_distances[b * stairs.size() + a] = dist;
 }
 
+// Find the travel distance from seed to each of targets, the same as a
+// flood from seed would: each step costs as much as the cell it leaves.
+// Targets that can't be reached get -1.
+static void _travel_distances_from(const travel_cost_grid_t &costs,
+                                   const coord_def &seed,
+                                   const vector<coord_def> &targets,
+                                   vector<int> &dists)
+{
+    static int dist[GXM][GYM];
+    static bool wanted[GXM][GYM];
+
+    for (rectangle_iterator ri(0); ri; ++ri)
+        dist[ri->x][ri->y] = INFINITE_DISTANCE;
+
+    int remaining = 0;
+    for (const coord_def &t : targets)
+    {
+        if (!wanted[t.x][t.y])
+        {
+            wanted[t.x][t.y] = true;
+            ++remaining;
+        }
+    }
+
+    typedef pair<int, coord_def> queued_cell;
+    priority_queue<queued_cell, vector<queued_cell>, greater<queued_cell>>
+        queue;
+    dist[seed.x][seed.y] = 0;
+    queue.emplace(0, seed);
+
+    // Stop as soon as all the targets are reached.
+    while (!queue.empty() && remaining)
+    {
+        const queued_cell top = queue.top();
+        queue.pop();
+        const coord_def c = top.second;
+        if (top.first != dist[c.x][c.y])
+            continue;
+
+        if (wanted[c.x][c.y])
+        {
+            wanted[c.x][c.y] = false;
+            --remaining;
+        }
+
+        // Travel always sets out from seed, safe or not.
+        const int cost = c == seed
+            ? _feature_traverse_cost(env.map_knowledge(c).feat())
+            : costs[c.x][c.y];
+
+        for (adjacent_iterator ai(c); ai; ++ai)
+        {
+            if (!costs[ai->x][ai->y])
+                continue;
+
+            const int d = top.first + cost;
+            if (d < dist[ai->x][ai->y])
+            {
+                dist[ai->x][ai->y] = d;
+                queue.emplace(d, *ai);
+            }
+        }
+    }
+
+    dists.clear();
+    for (const coord_def &t : targets)
+    {
+        wanted[t.x][t.y] = false;
+        dists.push_back(dist[t.x][t.y] == INFINITE_DISTANCE ? -1
+                                                            : dist[t.x][t.y]);
+    }
+}
+
 void LevelInfo::update_stair_distances()
 {
+    // Travel between stairs uses the fallback pass of find_travel_pos().
+    static travel_cost_grid_t costs;
+    _fill_travel_costs(costs, false, true);
+
+    vector<coord_def> positions;
+    for (const stair_info &si : stairs)
+        positions.push_back(si.position);
+
+    // Nothing that stair distances depend on has changed since we last
+    // worked them out.
     const int nstairs = stairs.size();
+    const uint64_t key =
+        hash3(hash32(costs, sizeof(costs)),
+              nstairs ? hash32(&positions[0], nstairs * sizeof(coord_def))
+                      : 0,
+              nstairs);
+    if (key == stair_distance_key
+        && stair_distances.size() == (size_t) (nstairs * nstairs))
+    {
+        return;
+    }
+    stair_distance_key = key;
+
     // Now we update distances for all the stairs, relative to all other
     // stairs.
+    vector<coord_def> others;
+    vector<int> dists;
     for (int s = 0; s < nstairs - 1; ++s)
     {
         set_distance_between_stairs(s, s, 0);
 
-        // For each stair, we need to ask travel to populate the distance
-        // array.
-        find_travel_pos(stairs[s].position, nullptr, nullptr, nullptr);
-
         // Assume movement distance between stairs is commutative,
         // i.e. going from a->b is the same distance as b->a.
+        others.assign(positions.begin() + s + 1, positions.end());
+        _travel_distances_from(costs, positions[s], others, dists);
         for (int other = s + 1; other < nstairs; ++other)
-        {
-            const coord_def op = stairs[other].position;
-            const int dist = travel_point_distance[op.x][op.y];
-            set_distance_between_stairs(s, other, dist);
-        }
+            set_distance_between_stairs(s, other, dists[other - s - 1]);
     }
     if (nstairs)
         set_distance_between_stairs(nstairs - 1, nstairs - 1, 0);
@@ -3234,8 +3676,6 @@ int LevelInfo::get_stair_index(const coord_def &pos) const
 
 void LevelInfo::correct_stair_list(const vector<coord_def> &s)
 {
-    stair_distances.clear();
-
     // Fix up the grid for the placeholder stair.
     for (stair_info &stair : stairs)
         stair.grid = grd(stair.position);
@@ -3402,6 +3842,7 @@ void LevelInfo::load(reader& inf, int minorVersion)
     }
 
     stair_distances.clear();
+    stair_distance_key = 0;
     if (stair_count)
     {
         stair_distances.reserve(stair_count * stair_count);
@@ -82,6 +82,12 @@ bool is_stair_exclusion(const coord_def &p);
 void start_explore(bool grab_items = false);
 void do_explore_cmd();
 
+// Travel and explore keep their routes from one step to the next. Tell them
+// when what the player knows of a cell may have changed, or when anything
+// may have.
+void travel_cell_changed(const coord_def &c);
+void travel_forget_routes();
+
 struct level_pos;
 class level_id;
 
@@ -287,7 +293,8 @@ public:
 // Information on a level that interlevel travel needs.
 struct LevelInfo
 {
-    LevelInfo() : stairs(), excludes(), stair_distances(), id()
+    LevelInfo() : stairs(), excludes(), stair_distances(),
+                  stair_distance_key(0), id()
     {
         daction_counters.init(0);
     }
@@ -354,6 +361,9 @@ private:
     exclude_set excludes;
 
     vector<short> stair_distances;  // Dist between stairs
+    // A hash of the stairs and the travel costs on the level when
+    // stair_distances were last worked out; not saved.
+    uint64_t stair_distance_key;
     level_id id;
 
     friend class TravelCache;
@@ -39,6 +39,11 @@ game_data_no_cache = True
 # Watch socket dirs for games not started by the server
 watch_socket_dirs = False
 
+# Have crawl deflate game messages once for all clients, rather than the
+# server compressing them separately for each websocket. Older versions
+# of crawl ignore this.
+compress_in_game = False
+
 # Game configs
 # %n in paths and urls is replaced by the current username
 # morgue_url is for a publicly available URL to access morgue_path
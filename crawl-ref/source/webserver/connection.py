@@ -3,29 +3,37 @@ import fcntl
 import os, os.path
 import time
 import warnings
+import functools
 
 from datetime import datetime, timedelta
 from tornado.escape import json_encode
 
 from config import server_socket_path
 
+FRAMES_REPLY = '*{"msg":"frames"}\n'
+DROPPED_MSG = '*{"msg":"dropped"}\n'
+
 class WebtilesSocketConnection(object):
     def __init__(self, io_loop, socketpath, logger):
         self.io_loop = io_loop
         self.crawl_socketpath = socketpath
         self.logger = logger
         self.message_callback = None
+        self.frame_callback = None
         self.socket = None
         self.socketpath = None
         self.open = False
         self.close_callback = None
 
         self.msg_buffer = None
+        self.frames = False
 
-    def connect(self, primary = True):
+    def connect(self, primary = True, frames = False):
         if not os.path.exists(self.crawl_socketpath):
             # Wait until the socket exists
-            self.io_loop.add_timeout(time.time() + 1, self.connect)
+            self.io_loop.add_timeout(time.time() + 1,
+                                     functools.partial(self.connect,
+                                                       primary, frames))
             return
 
         self.socket = socket.socket(socket.AF_UNIX, socket.SOCK_DGRAM)
@@ -53,7 +61,8 @@ class WebtilesSocketConnection(object):
 
         msg = json_encode({
                 "msg": "attach",
-                "primary": primary
+                "primary": primary,
+                "frames": frames
                 })
 
         self.open = True
@@ -70,6 +79,14 @@ class WebtilesSocketConnection(object):
             pass
 
     def _handle_data(self, data):
+        if self.frames:
+            self._handle_frame_data(data)
+            return
+
+        if data == DROPPED_MSG:
+            self._handle_dropped()
+            return
+
         if self.msg_buffer is not None:
             data = self.msg_buffer + data
 
@@ -81,8 +98,43 @@ class WebtilesSocketConnection(object):
         else:
             self.msg_buffer = None
 
-            if self.message_callback:
+            if data == FRAMES_REPLY:
+                # Crawl sends framed messages from here on
+                self.frames = True
+            elif self.message_callback:
+                self.message_callback(data)
+
+    def _handle_frame_data(self, data):
+        # Each datagram starts with "+" if more of the message follows,
+        # else with the type of the message: "." for JSON, "z" for a game
+        # message deflated by crawl, "Z" for one that starts a new deflate
+        # stream. "!" means crawl stopped sending to us (see
+        # _handle_dropped).
+        kind = data[0]
+        data = data[1:]
+        if kind == "!":
+            self._handle_dropped()
+            return
+
+        if self.msg_buffer is not None:
+            data = self.msg_buffer + data
+
+        if kind == "+":
+            self.msg_buffer = data
+            return
+
+        self.msg_buffer = None
+        if kind == ".":
+            if self.message_callback and data != FRAMES_REPLY:
                 self.message_callback(data)
+        elif self.frame_callback:
+            self.frame_callback(data, kind == "Z")
+
+    def _handle_dropped(self):
+        # Crawl dropped us for falling behind, maybe in the middle of a
+        # message; ask for everything again.
+        self.msg_buffer = None
+        self.send_message('{"msg":"spectator_joined"}')
 
     def send_message(self, data):
         start = datetime.now()
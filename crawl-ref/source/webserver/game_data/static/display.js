@@ -1,7 +1,7 @@
 define(["jquery", "comm", "./map_knowledge", "./view_data", "./monster_list",
-        "./minimap", "./dungeon_renderer"],
+        "./minimap", "./dungeon_renderer", "./packed_cells"],
 function ($, comm, map_knowledge, view_data, monster_list, minimap,
-          dungeon_renderer) {
+          dungeon_renderer, packed_cells) {
     "use strict";
 
     var overlaid_locs = [];
@@ -89,6 +89,9 @@ function ($, comm, map_knowledge, view_data, monster_list, minimap,
         if (data.vgrdc)
             minimap.do_view_center_update(data.vgrdc.x, data.vgrdc.y);
 
+        if (data.packed)
+            map_knowledge.merge(packed_cells.decode(data.packed));
+
         if (data.cells)
             map_knowledge.merge(data.cells);
 
@@ -122,6 +125,13 @@ function ($, comm, map_knowledge, view_data, monster_list, minimap,
     {
     }
 
+    // Ask for map cells in the compact encoding; until crawl gets this,
+    // it sends them all as JSON.
+    $(document).off("game_init.display")
+        .on("game_init.display", function () {
+            comm.send_message("packed_map");
+        });
+
     comm.register_handlers({
         "map": handle_map_message,
         "overlay": handle_overlay_message,
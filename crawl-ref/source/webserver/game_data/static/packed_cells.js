@@ -0,0 +1,146 @@
+define([],
+function () {
+    "use strict";
+
+    // Decodes the compact encoding of map cells written by _pack_cell() in
+    // tileweb.cc into the same objects as the "cells" of a map message.
+    // The fields, in the order of their bits; those in the cell itself
+    // rather than its tile are marked.
+    var fields = ["f", "mf", "g", "col", "fg", "base", "bg", "cloud",
+                  "bloody", "old_blood", "silenced", "halo", "moldy",
+                  "glowing_mold", "sanctuary", "liquefied", "orb_glow",
+                  "quad_glow", "disjunct", "mangrove_water",
+                  "blood_rotation", "travel_trail", "heat_aura", "flv",
+                  "ov"];
+    var cell_fields = { f: true, mf: true, g: true, col: true };
+    var tile_fields = { fg: true, bg: true, cloud: true };
+    var bool_fields = { bloody: true, old_blood: true, silenced: true,
+                        moldy: true, glowing_mold: true, sanctuary: true,
+                        liquefied: true, quad_glow: true, disjunct: true,
+                        mangrove_water: true };
+
+    function decode(packed)
+    {
+        var data = atob(packed.cells);
+        var pos = 0;
+
+        function read_uint()
+        {
+            var value = 0, scale = 1, b;
+            do
+            {
+                b = data.charCodeAt(pos++);
+                value += (b & 0x7f) * scale;
+                scale *= 128;
+            } while (b & 0x80);
+            return value;
+        }
+
+        function read_int()
+        {
+            var v = read_uint();
+            return v % 2 ? -(v + 1) / 2 : v / 2;
+        }
+
+        // Tile indices can be wider than a double holds exactly; like in
+        // the JSON, they come as [lo, hi] when they don't fit in 32 bits.
+        function read_tileidx()
+        {
+            var lo = 0, hi = 0, shift = 0, b;
+            do
+            {
+                b = data.charCodeAt(pos++);
+                var bits = b & 0x7f;
+                if (shift < 28)
+                    lo += bits * Math.pow(2, shift);
+                else if (shift == 28)
+                {
+                    lo += (bits & 0xf) * Math.pow(2, 28);
+                    hi += bits >> 4;
+                }
+                else
+                    hi += bits * Math.pow(2, shift - 32);
+                shift += 7;
+            } while (b & 0x80);
+            if (lo >= 0x80000000)
+                lo -= 0x100000000;
+            return hi ? [lo, hi] : lo;
+        }
+
+        function code_point_string(c)
+        {
+            if (c < 0x10000)
+                return String.fromCharCode(c);
+            c -= 0x10000;
+            return String.fromCharCode(0xd800 + (c >> 10),
+                                       0xdc00 + (c & 0x3ff));
+        }
+
+        var cells = [];
+        var index = -1;
+        while (pos < data.length)
+        {
+            index += read_uint();
+            var mask = read_uint();
+            var cell = { x: index % packed.w - packed.x,
+                         y: Math.floor(index / packed.w) - packed.y };
+            var t = {}, has_tile = false;
+
+            for (var bit = 0; bit < fields.length; bit++)
+            {
+                if (!(mask & (1 << bit)))
+                    continue;
+
+                var name = fields[bit];
+                var value;
+                if (name == "g")
+                    value = code_point_string(read_uint());
+                else if (tile_fields[name])
+                    value = read_tileidx();
+                else if (name == "flv")
+                {
+                    value = { f: read_int() };
+                    var special = read_int();
+                    if (special)
+                        value.s = special;
+                }
+                else if (name == "ov")
+                {
+                    value = [];
+                    for (var n = read_uint(); n > 0; n--)
+                        value.push(read_int());
+                }
+                else
+                {
+                    value = read_int();
+                    if (bool_fields[name])
+                        value = !!value;
+                }
+
+                if (cell_fields[name])
+                    cell[name] = value;
+                else
+                {
+                    t[name] = value;
+                    has_tile = true;
+                }
+            }
+
+            // Only cells without dolls or monster tiles are packed.
+            if (t.fg !== undefined)
+            {
+                t.doll = null;
+                t.mcache = null;
+            }
+            if (has_tile)
+                cell.t = t;
+            cells.push(cell);
+        }
+
+        return cells;
+    }
+
+    return {
+        decode: decode,
+    };
+});
@@ -4,6 +4,7 @@ import datetime, time
 import hashlib
 import logging
 import re
+import zlib
 
 import config
 
@@ -356,6 +357,7 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
                                                   logger, io_loop)
         self.socketpath = None
         self.conn = None
+        self.inflater = None
         self.ttyrec_filename = None
         self.inprogress_lock = None
         self.inprogress_lock_file = None
@@ -544,8 +546,9 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
         self.socketpath = socketpath
         self.conn = WebtilesSocketConnection(self.io_loop, self.socketpath, self.logger)
         self.conn.message_callback = self._on_socket_message
+        self.conn.frame_callback = self._on_socket_frame
         self.conn.close_callback = self._on_socket_close
-        self.conn.connect(primary)
+        self.conn.connect(primary, getattr(config, "compress_in_game", False))
 
     def gen_inprogress_lock(self):
         self.inprogress_lock = os.path.join(self.config_path("inprogress_path"),
@@ -611,6 +614,8 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
 
 
     def add_watcher(self, watcher):
+        # It can read game frames once crawl starts a new stream for it
+        watcher.game_stream_started = False
         super(CrawlProcessHandler, self).add_watcher(watcher)
 
         if self.conn and self.conn.open:
@@ -724,17 +729,40 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
                 self.logger.warning("Unknown message from the crawl process: %s",
                                     msgobj["msg"])
         else:
-            self.check_where()
-            if time.time() > self.last_watcher_join + 2:
-                # Treat socket messages as activity, since it's otherwise
-                # hard to determine activity for games found via
-                # watch_socket_dirs.
-                # But don't if a spectator just joined, since we don't
-                # want that to reset idle time.
-                self.note_activity()
-
+            self._note_game_message()
             self.write_to_all(msg, not self.queue_messages)
 
+    def _on_socket_frame(self, frame, new_stream):
+        # A game message deflated by crawl; see CrawlWebSocket.write_frame.
+        if self.process:
+            self.process.output_callback = None
+        self._note_game_message()
+
+        # Clients that don't take compressed messages get the text, which
+        # we can only follow from the start of a stream
+        if new_stream:
+            self.inflater = zlib.decompressobj(-zlib.MAX_WBITS)
+        text = None
+        if any(not r.deflate for r in self._receivers):
+            if self.inflater:
+                text = self.inflater.decompress(frame + "\x00\x00\xff\xff")
+        else:
+            self.inflater = None
+
+        for receiver in self._receivers:
+            receiver.write_frame(frame, new_stream, text,
+                                 not self.queue_messages)
+
+    def _note_game_message(self):
+        self.check_where()
+        if time.time() > self.last_watcher_join + 2:
+            # Treat socket messages as activity, since it's otherwise
+            # hard to determine activity for games found via
+            # watch_socket_dirs.
+            # But don't if a spectator just joined, since we don't
+            # want that to reset idle time.
+            self.note_activity()
+
 
 
 class DGLLessCrawlProcessHandler(CrawlProcessHandler):
@@ -1203,7 +1203,7 @@ function (exports, $, key_conversion, chat, comm) {
 
         do_layout();
 
-        var inflater = null;
+        var inflater = null, game_inflater = null;
 
         if ("Uint8Array" in window &&
             "Blob" in window &&
@@ -1243,22 +1243,42 @@ function (exports, $, key_conversion, chat, comm) {
             {
                 if (inflater && msg.data instanceof ArrayBuffer)
                 {
-                    var data = new Uint8Array(msg.data.byteLength + 4);
-                    data.set(new Uint8Array(msg.data), 0);
-                    data.set([0, 0, 255, 255], msg.data.byteLength);
-                    var decompressed = [inflater.append(data)];
+                    // The first byte says which stream this continues: 0
+                    // for the server's, 1 for the game's, 2 for the start
+                    // of a new game stream.
+                    var bytes = new Uint8Array(msg.data);
+                    var stream = inflater;
+                    if (bytes[0] == 2 || bytes[0] == 1 && !game_inflater)
+                        game_inflater = new Inflater();
+                    if (bytes[0] != 0)
+                        stream = game_inflater;
+
+                    var data = new Uint8Array(bytes.length - 1 + 4);
+                    data.set(bytes.subarray(1), 0);
+                    data.set([0, 0, 255, 255], bytes.length - 1);
+                    var decompressed = [stream.append(data)];
                     if (decompressed[0] === -1)
                     {
                         console.error("Decompression error!");
-                        var x = inflater.append(data);
+                        var x = stream.append(data);
                     }
+                    var game = bytes[0] != 0;
                     decode_utf8(decompressed, function (s) {
                         if (window.log_messages === 2)
                             console.log("Message: " + s);
                         if (window.log_message_size)
                             console.log("Message size: " + s.length);
 
-                        enqueue_messages(s);
+                        if (!game)
+                        {
+                            enqueue_messages(s);
+                            return;
+                        }
+                        // Game frames are batched, one message per line.
+                        var lines = s.split("\n");
+                        for (var i = 0; i < lines.length; ++i)
+                            if (lines[i].length)
+                                enqueue_messages(lines[i]);
                     });
                     return;
                 }
@@ -23,6 +23,13 @@ shutting_down = False
 login_tokens = {}
 rand = random.SystemRandom()
 
+# Compressed messages start with a byte saying which deflate stream they
+# continue: the server's own for this socket, or the one of the game
+# process, which crawl restarts when someone joins.
+SERVER_STREAM = "\x00"
+GAME_STREAM = "\x01"
+NEW_GAME_STREAM = "\x02"
+
 def shutdown():
     global shutting_down
     shutting_down = True
@@ -130,7 +137,13 @@ class CrawlWebSocket(tornado.websocket.WebSocketHandler):
         self.total_message_bytes = 0
         self.compressed_bytes_sent = 0
         self.uncompressed_bytes_sent = 0
+        self.game_frame_bytes_sent = 0
+        self.game_stream_started = False
         self.message_queue = []
+        # Game frames waiting for crawl's flush, and whether the first of
+        # them starts a new stream.
+        self.frame_queue = []
+        self.frame_queue_new = False
 
         self.subprotocol = None
 
@@ -555,6 +568,7 @@ class CrawlWebSocket(tornado.websocket.WebSocketHandler):
                                 exc_info=True)
 
     def flush_messages(self):
+        self._flush_frames()
         if self.client_closed or len(self.message_queue) == 0:
             return
         msg = "{\"msgs\":[" + ",".join(self.message_queue) + "]}"
@@ -570,7 +584,8 @@ class CrawlWebSocket(tornado.websocket.WebSocketHandler):
                 compressed += self._compressobj.flush(zlib.Z_SYNC_FLUSH)
                 compressed = compressed[:-4]
                 self.compressed_bytes_sent += len(compressed)
-                super(CrawlWebSocket, self).write_message(compressed, binary=True)
+                super(CrawlWebSocket, self).write_message(SERVER_STREAM + compressed,
+                                                          binary=True)
             else:
                 self.uncompressed_bytes_sent += len(msg)
                 super(CrawlWebSocket, self).write_message(msg)
@@ -581,10 +596,57 @@ class CrawlWebSocket(tornado.websocket.WebSocketHandler):
 
     def write_message(self, msg, send=True):
         if self.client_closed: return
+        # Keep the order of messages and frames
+        self._flush_frames()
         self.message_queue.append(utf8(msg))
         if send:
             self.flush_messages()
 
+    def _flush_frames(self):
+        if self.client_closed or len(self.frame_queue) == 0:
+            return
+        # Each frame had the 00 00 FF FF of its sync flush removed. Put it
+        # back between frames, so that they inflate as one message; the
+        # client adds the last one.
+        frames = "\x00\x00\xff\xff".join(self.frame_queue)
+        prefix = NEW_GAME_STREAM if self.frame_queue_new else GAME_STREAM
+        self.frame_queue = []
+        self.frame_queue_new = False
+
+        try:
+            self.game_frame_bytes_sent += len(frames)
+            super(CrawlWebSocket, self).write_message(prefix + frames,
+                                                      binary=True)
+        except:
+            self.logger.warning("Exception trying to send message.", exc_info = True)
+            if self.ws_connection != None:
+                self.ws_connection._abort()
+
+    def write_frame(self, frame, new_stream, text, send=True):
+        """Sends a game message that crawl has already deflated. Clients
+        without compression get the text instead, if there is any."""
+        if self.client_closed: return
+        if not self.deflate:
+            if text is not None:
+                self.write_message(text, send)
+            return
+
+        if new_stream:
+            self.game_stream_started = True
+        elif not self.game_stream_started:
+            # Joined in the middle of the stream; crawl starts a new one
+            # for the redraw it sends us.
+            return
+
+        # Frames are queued like messages, until crawl flushes. A new
+        # stream starts a websocket message of its own.
+        if self.message_queue or new_stream:
+            self.flush_messages()
+        self.frame_queue.append(frame)
+        self.frame_queue_new = self.frame_queue_new or new_stream
+        if send:
+            self._flush_frames()
+
     def send_message(self, msg, **data):
         """Sends a JSON message to the client."""
         data["msg"] = msg
@@ -616,5 +678,7 @@ class CrawlWebSocket(tornado.websocket.WebSocketHandler):
         else:
             comp_ratio = 100 - 100 * (self.compressed_bytes_sent + self.uncompressed_bytes_sent) / self.total_message_bytes
 
-        self.logger.info("Socket closed. (%s bytes sent, compression ratio %s%%)",
-                         self.total_message_bytes, comp_ratio)
+        self.logger.info("Socket closed. (%s bytes sent, compression ratio %s%%, "
+                         "%s bytes of game frames)",
+                         self.total_message_bytes, comp_ratio,
+                         self.game_frame_bytes_sent)